@@ -0,0 +1,217 @@
+// @brief  the gaps between syns on the wire at a given `rate`: the epoll engine, which sends
+//         what fell due at each wakeup of epoll, in whole milliseconds, against the io_uring engine,
+//         which links every connect behind an absolute timeout at its departure time.
+//         the syns are captured with kernel timestamps on the far end of a veth pair, sent to
+//         an address nobody answers, so every connect times out and only the syns are seen.
+//         needs root, run it in its own network namespace:
+//         unshare -n sh -c 'ip link add pa type veth peer name pb && ip link set pa up && ip link set pb up &&
+//             ip addr add 10.99.0.1/24 dev pa && ip neigh add 10.99.0.2 lladdr 02:00:00:00:00:02 dev pa &&
+//             ./bench_pacing pb 10.99.0.2 20000 20000'
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "../lib_scan_engine_epoll.hpp"
+#include "../lib_scan_engine_uring.hpp"
+
+namespace {
+    // timestamps of the syns to `target` seen on `ifname`, until `stop`.
+    class SynCapture {
+        int fd;
+        uint32_t target;
+        std::vector<int64_t> stamps;
+        std::thread worker;
+        std::atomic<bool> stop;
+
+        void run() {
+            char frame[256];
+            char control[256];
+
+            while (!stop.load()) {
+                struct pollfd pfd = { fd, POLLIN, 0 };
+                if (poll(&pfd, 1, 50) <= 0) {
+                    continue;
+                }
+
+                struct iovec iov = { frame, sizeof(frame) };
+                struct msghdr msg;
+                std::memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+
+                ssize_t n = recvmsg(fd, &msg, MSG_DONTWAIT);
+                if (n < (ssize_t)(sizeof(struct iphdr) + sizeof(struct tcphdr))) {
+                    continue;
+                }
+
+                const struct iphdr* ip = (const struct iphdr*)frame;
+                if (ip->protocol != IPPROTO_TCP || ip->daddr != target || n < (ssize_t)(ip->ihl * 4 + sizeof(struct tcphdr))) {
+                    continue;
+                }
+                const struct tcphdr* tcp = (const struct tcphdr*)(frame + ip->ihl * 4);
+                if (!tcp->syn || tcp->ack) {
+                    continue;
+                }
+
+                for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+                    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+                        struct timespec ts;
+                        std::memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+                        stamps.emplace_back((int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+                    }
+                }
+            }
+        }
+    public:
+        SynCapture(const std::string& ifname, const std::string& ip) : fd{ -1 }, target{ 0 }, stamps{}, worker{}, stop{ false } {
+            inet_pton(AF_INET, ip.c_str(), &target);
+
+            // cooked frames start at the ip header.
+            fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+            if (fd < 0) {
+                std::error_code ec(errno, std::system_category());
+                throw std::system_error{ ec, "sys call socket failed on AF_PACKET, run as root" };
+            }
+
+            int on = 1;
+            int buffer = 64 * 1024 * 1024;
+            setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &buffer, sizeof(buffer));
+
+            struct sockaddr_ll address;
+            std::memset(&address, 0, sizeof(address));
+            address.sll_family = AF_PACKET;
+            address.sll_protocol = htons(ETH_P_IP);
+            address.sll_ifindex = (int)if_nametoindex(ifname.c_str());
+            if (address.sll_ifindex == 0 || bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+                std::error_code ec(errno, std::system_category());
+                close(fd);
+                throw std::system_error{ ec, "bind to " + ifname + " failed" };
+            }
+
+            worker = std::thread{ [this] { run(); } };
+        }
+
+        ~SynCapture() {
+            finish();
+            close(fd);
+        }
+
+        // stops the capture, the syns still in flight get a moment to arrive.
+        const std::vector<int64_t>& finish() {
+            if (worker.joinable()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                stop.store(true);
+                worker.join();
+            }
+            return stamps;
+        }
+
+        unsigned drops() {
+            struct tpacket_stats stats;
+            socklen_t len = sizeof(stats);
+            return (getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0 ? stats.tp_drops : 0);
+        }
+    };
+
+    double cpu_seconds() {
+        struct rusage usage;
+        getrusage(RUSAGE_THREAD, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+
+    void run(scan_engine::ScanEngine& engine, const std::string& ifname, const std::string& ip, int count, int rate) {
+        scan_engine::ScanConfig config;
+        config.ips.emplace_back(ip);
+        for (int i = 0; i < count; ++i) {
+            config.ports.emplace_back(1 + i % 65535);
+        }
+        config.rate = rate;
+        config.timeout_millisec = 100;
+        config.window = std::max(256, rate / 5);     // twice the connects of one timeout.
+
+        SynCapture capture{ ifname, ip };
+
+        double cpu = cpu_seconds();
+        auto start = std::chrono::steady_clock::now();
+        engine.scan(config, [](const scan_engine::ScanResult&) {});
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        cpu = cpu_seconds() - cpu;
+
+        std::vector<int64_t> stamps = capture.finish();
+        std::vector<double> gaps;
+        for (size_t i = 1; i < stamps.size(); ++i) {
+            gaps.emplace_back((stamps[i] - stamps[i - 1]) / 1000.0);
+        }
+        std::sort(gaps.begin(), gaps.end());
+
+        auto at = [&gaps](double q) {
+            return (gaps.empty() ? 0.0 : gaps[std::min(gaps.size() - 1, (size_t)(q * gaps.size()))]);
+        };
+
+        double mean = 0;
+        double square = 0;
+        for (double gap : gaps) {
+            mean += gap;
+        }
+        mean /= std::max<size_t>(gaps.size(), 1);
+        for (double gap : gaps) {
+            square += (gap - mean) * (gap - mean);
+        }
+
+        std::cout << std::left << std::setw(10) << engine.name() << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(8) << stamps.size() << " syns, drops " << capture.drops() << ", " << std::setprecision(2) << wall << " s, cpu "
+                  << cpu << " s\n"
+                  << "          gap us: p1 " << std::setprecision(1) << at(0.01) << ", p50 " << at(0.5) << ", p99 " << at(0.99)
+                  << ", p99.9 " << at(0.999) << ", max " << at(1.0) << ", mean " << mean << ", stddev "
+                  << std::sqrt(square / std::max<size_t>(gaps.size(), 1)) << " (ideal " << 1e6 / rate << ")\n";
+    }
+}
+
+// g++ bench_pacing.cpp -std=c++11 -O2 -pthread -o bench_pacing
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "usage: bench_pacing <capture ifname> <silent target ip> [count] [rate]\n";
+        return 1;
+    }
+
+    std::string ifname = argv[1];
+    std::string ip = argv[2];
+    int count = (argc > 3 ? std::atoi(argv[3]) : 20000);
+    int rate = (argc > 4 ? std::atoi(argv[4]) : 20000);
+
+    try {
+        scan_engine::EpollEngine epoll;
+        run(epoll, ifname, ip, count, rate);
+
+        scan_engine::IoUringEngine uring;
+        run(uring, ifname, ip, count, rate);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
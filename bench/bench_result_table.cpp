@@ -0,0 +1,111 @@
+// @brief  result aggregation under contention: a mutex around std::bitset tables against
+//         result_table::ConcurrentPortsTable, and a mutex around one vector of records
+//         against result_table::StagedResults, from 1 to 32 threads.
+//         every thread records the same number of results, so a flat rate means no collapse.
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <bitset>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+#include "../lib_result_table.hpp"
+
+namespace {
+    const size_t hosts = 64;
+    const size_t per_thread = 1 << 20;
+
+    struct Record {
+        uint32_t host;
+        uint16_t port;
+        uint16_t state;
+        uint32_t rtt_micros;
+    };
+
+    // spreads (host, port) over the whole table, like a scan over many hosts.
+    inline uint64_t next(uint64_t& x) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return x;
+    }
+
+    template<typename Work>
+    double run(int threads, Work work) {
+        std::vector<std::thread> workers;
+        auto start = std::chrono::steady_clock::now();
+
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([t, &work] { work(t); });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return threads * per_thread / seconds / 1e6;
+    }
+}
+
+// g++ bench/bench_result_table.cpp -std=c++11 -O2 -pthread -o bench_result_table
+int main() {
+    std::cout << "threads  mutex bitset  fetch_or table  mutex vector  staged    (million results/s)\n";
+
+    for (int threads : { 1, 2, 4, 8, 16, 32 }) {
+        std::vector<std::bitset<65536>> bitsets(hosts);
+        std::mutex bitsets_mutex;
+        double locked_bits = run(threads, [&](int t) {
+            uint64_t x = 0x9E3779B97F4A7C15ull + t;
+            for (size_t i = 0; i < per_thread; ++i) {
+                uint64_t r = next(x);
+                std::lock_guard<std::mutex> lock(bitsets_mutex);
+                bitsets[r % hosts].set((r >> 32) & 0xFFFF);
+            }
+        });
+
+        result_table::ConcurrentPortsTable table{ hosts };
+        double atomic_bits = run(threads, [&](int t) {
+            uint64_t x = 0x9E3779B97F4A7C15ull + t;
+            for (size_t i = 0; i < per_thread; ++i) {
+                uint64_t r = next(x);
+                table.set(r % hosts, (int)((r >> 32) & 0xFFFF));
+            }
+        });
+
+        std::vector<Record> records;
+        std::mutex records_mutex;
+        double locked_records = run(threads, [&](int t) {
+            uint64_t x = 0x9E3779B97F4A7C15ull + t;
+            for (size_t i = 0; i < per_thread; ++i) {
+                uint64_t r = next(x);
+                std::lock_guard<std::mutex> lock(records_mutex);
+                records.push_back(Record{ (uint32_t)(r % hosts), (uint16_t)(r >> 32), 1, (uint32_t)t });
+            }
+        });
+
+        result_table::StagedResults<Record> staged;
+        double staged_records = run(threads, [&](int t) {
+            auto stage = staged.stage();
+            uint64_t x = 0x9E3779B97F4A7C15ull + t;
+            for (size_t i = 0; i < per_thread; ++i) {
+                uint64_t r = next(x);
+                stage.append(Record{ (uint32_t)(r % hosts), (uint16_t)(r >> 32), 1, (uint32_t)t });
+            }
+        });
+
+        size_t drained = staged.drain([](const Record&) {});
+        if (drained != records.size()) {
+            std::cerr << "staged " << drained << " records, expected " << records.size() << "\n";
+            return 1;
+        }
+
+        std::cout << std::setw(7) << threads << std::fixed << std::setprecision(1)
+                  << std::setw(14) << locked_bits << std::setw(16) << atomic_bits
+                  << std::setw(14) << locked_records << std::setw(10) << staged_records << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+// @brief  target file parsing: std::getline and inet_pton, the way config_parser reads a file,
+//         against lib_target_file.hpp's mapped, sse2 scanned, in-place parser. then merging
+//         the parsed networks into disjoint ranges, std::sort against the parallel radix sort.
+//         writes a file of `lines` random entries (one in 8 is a cidr) to `path` first.
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+
+#include <arpa/inet.h>
+
+#include "../lib_target_file.hpp"
+
+namespace {
+    void write_targets(const std::string& path, size_t lines) {
+        std::ofstream out{ path };
+        uint64_t x = 0x9E3779B97F4A7C15ull;
+
+        for (size_t i = 0; i < lines; ++i) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+
+            out << ((x >> 24) & 0xFF) << '.' << ((x >> 16) & 0xFF) << '.' << ((x >> 8) & 0xFF) << '.' << (x & 0xFF);
+            if (i % 8 == 0) {
+                out << '/' << (16 + (x >> 40) % 17);
+            }
+            out << '\n';
+        }
+    }
+
+    // the getline path, one std::string per line.
+    size_t parse_getline(const std::string& path, std::vector<target_file::Ipv4Network>& networks) {
+        std::ifstream in{ path };
+        std::string line;
+
+        while (std::getline(in, line)) {
+            size_t slash = line.find('/');
+            std::string ip = line.substr(0, slash);
+
+            struct in_addr addr;
+            if (inet_pton(AF_INET, ip.c_str(), &addr) != 1) {
+                continue;
+            }
+
+            uint32_t prefix = (slash == std::string::npos ? 32 : (uint32_t)std::atoi(line.c_str() + slash + 1));
+            networks.emplace_back(target_file::Ipv4Network{ ntohl(addr.s_addr), prefix });
+        }
+        return networks.size();
+    }
+
+    // merge_ranges with std::sort, the reference for the radix sorted one.
+    target_file::Ranges merge_with_std_sort(const std::vector<target_file::Ipv4Network>& networks) {
+        target_file::Ranges ranges;
+        for (const auto& network : networks) {
+            ranges.emplace_back(network.first(), network.last());
+        }
+        std::sort(ranges.begin(), ranges.end());
+
+        target_file::Ranges merged;
+        for (const auto& range : ranges) {
+            if (!merged.empty() && (uint64_t)range.first <= (uint64_t)merged.back().second + 1) {
+                merged.back().second = std::max(merged.back().second, range.second);
+            }
+            else {
+                merged.emplace_back(range);
+            }
+        }
+        return merged;
+    }
+
+    template<typename Parse>
+    double best_seconds(Parse parse) {
+        double best = 1e9;
+        for (int round = 0; round < 3; ++round) {
+            auto start = std::chrono::steady_clock::now();
+            parse();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            best = (seconds < best ? seconds : best);
+        }
+        return best;
+    }
+}
+
+// g++ bench/bench_target_file.cpp -std=c++11 -O2 -pthread -o bench_target_file
+// ./bench_target_file /tmp/targets.txt 10000000
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " <path> <lines>\n";
+        return 1;
+    }
+
+    std::string path = argv[1];
+    size_t lines = std::strtoull(argv[2], nullptr, 10);
+    write_targets(path, lines);
+
+    size_t bytes = 0;
+    {
+        target_file::MappedFile file{ path };
+        bytes = file.size();
+    }
+
+    size_t getline_entries = 0;
+    double getline_seconds = best_seconds([&] {
+        std::vector<target_file::Ipv4Network> networks;
+        getline_entries = parse_getline(path, networks);
+    });
+
+    size_t mapped_entries = 0;
+    double mapped_seconds = best_seconds([&] {
+        std::vector<target_file::Ipv4Network> networks;
+        mapped_entries = target_file::load_targets(path, networks).entries;
+    });
+
+    if (getline_entries != mapped_entries) {
+        std::cerr << "getline parsed " << getline_entries << " entries, mapped " << mapped_entries << "\n";
+        return 1;
+    }
+
+    std::vector<target_file::Ipv4Network> networks;
+    target_file::load_targets(path, networks);
+
+    target_file::Ranges sorted_ranges;
+    double sort_seconds = best_seconds([&] {
+        sorted_ranges = merge_with_std_sort(networks);
+    });
+
+    target_file::Ranges radix_ranges;
+    double radix_seconds = best_seconds([&] {
+        radix_ranges = target_file::merge_ranges(networks);
+    });
+
+    if (sorted_ranges != radix_ranges) {
+        std::cerr << "std::sort merged into " << sorted_ranges.size() << " ranges, radix sort into " << radix_ranges.size() << "\n";
+        return 1;
+    }
+
+    std::cout << lines << " lines, " << bytes / 1e6 << " MB\n" << std::fixed << std::setprecision(3);
+    std::cout << "getline + inet_pton  " << getline_seconds << " s  " << bytes / getline_seconds / 1e9 << " GB/s\n";
+    std::cout << "mapped + sse2        " << mapped_seconds << " s  " << bytes / mapped_seconds / 1e9 << " GB/s\n";
+    std::cout << radix_ranges.size() << " disjoint ranges, " << std::thread::hardware_concurrency() << " threads\n";
+    std::cout << "merge, std::sort     " << sort_seconds << " s\n";
+    std::cout << "merge, radix sort    " << radix_seconds << " s\n";
+    return 0;
+}
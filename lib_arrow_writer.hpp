@@ -0,0 +1,409 @@
+#pragma once
+
+// @brief  writes scan results as an apache arrow ipc file (feather v2), without libarrow.
+//         results are appended into column buffers and flushed as one record batch
+//         every `batch_rows` rows, so the cost per row is a few push_backs.
+//         the ipc metadata is flatbuffers, built by the small builder below.
+#include <stdexcept>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+
+namespace arrow_ipc {
+    class ArrowWriteException : public std::runtime_error {
+    public:
+        ArrowWriteException(const std::string& msg)
+            : std::runtime_error{ "arrow write error: " + msg }
+        {}
+    };
+
+    // minimal flatbuffers builder, the buffer grows from back to front like the official one.
+    // offsets are measured from the end of the buffer until `finish`.
+    class FlatBuilder {
+        std::vector<uint8_t> data;      // data[0] is the current front.
+        std::vector<std::pair<int, uint32_t>> fields;
+        uint32_t table_start;
+
+        void prepend(const void* bytes, size_t n) {
+            data.insert(data.begin(), (const uint8_t*)bytes, (const uint8_t*)bytes + n);
+        }
+
+        // pad, so that after `additional` more bytes the front is aligned.
+        void align(size_t alignment, size_t additional) {
+            size_t pad = (alignment - ((data.size() + additional) % alignment)) % alignment;
+            data.insert(data.begin(), pad, 0);
+        }
+    public:
+        FlatBuilder() : data{}, fields{}, table_start{ 0 } {}
+
+        uint32_t size() const {
+            return (uint32_t)data.size();
+        }
+
+        template<typename T>
+        uint32_t push(T value) {
+            align(sizeof(T), 0);
+            prepend(&value, sizeof(T));
+            return size();
+        }
+
+        uint32_t push_offset(uint32_t target) {
+            align(4, 0);
+            uint32_t value = size() + 4 - target;
+            prepend(&value, 4);
+            return size();
+        }
+
+        uint32_t create_string(const std::string& str) {
+            align(4, str.size() + 1);
+            data.insert(data.begin(), 0);
+            prepend(str.data(), str.size());
+            return push((uint32_t)str.size());
+        }
+
+        uint32_t create_offset_vector(const std::vector<uint32_t>& offsets) {
+            align(4, offsets.size() * 4);
+            for (size_t i = offsets.size(); i > 0; --i) {
+                push_offset(offsets[i - 1]);
+            }
+            return push((uint32_t)offsets.size());
+        }
+
+        // vector of flatbuffers structs, given as raw little endian bytes.
+        uint32_t create_struct_vector(const void* bytes, size_t count, size_t struct_size) {
+            align(8, count * struct_size);
+            align(4, count * struct_size);
+            prepend(bytes, count * struct_size);
+            return push((uint32_t)count);
+        }
+
+        void start_table() {
+            fields.clear();
+            table_start = size();
+        }
+
+        template<typename T>
+        void add_field(int id, T value) {
+            fields.emplace_back(id, push(value));
+        }
+
+        void add_offset_field(int id, uint32_t target) {
+            fields.emplace_back(id, push_offset(target));
+        }
+
+        uint32_t end_table() {
+            uint32_t table_end = push((int32_t)0);
+
+            int max_id = -1;
+            for (const auto& f : fields) {
+                max_id = (f.first > max_id ? f.first : max_id);
+            }
+
+            std::vector<uint16_t> vtable(max_id + 3, 0);
+            vtable[0] = (uint16_t)(vtable.size() * 2);
+            vtable[1] = (uint16_t)(table_end - table_start);
+            for (const auto& f : fields) {
+                vtable[f.first + 2] = (uint16_t)(table_end - f.second);
+            }
+
+            for (size_t i = vtable.size(); i > 0; --i) {
+                push(vtable[i - 1]);
+            }
+
+            // table soffset points back to its vtable.
+            int32_t soffset = (int32_t)(size() - table_end);
+            std::memcpy(data.data() + data.size() - table_end, &soffset, 4);
+            return table_end;
+        }
+
+        std::vector<uint8_t> finish(uint32_t root) {
+            align(8, 4);
+            push_offset(root);
+            return data;
+        }
+    };
+
+    // column layout of the exported results.
+    //   host          utf8
+    //   port          uint16
+    //   state         uint8      a `ResultState`
+    //   rtt_micros    uint32
+    //   banner        binary     what the port sent first, empty when nothing
+    //   timestamp     timestamp[us, UTC]
+    enum ResultState : uint8_t {
+        state_closed = 0,       // refused.
+        state_opened = 1,
+        state_timed_out = 2
+    };
+
+    class ResultArrowWriter {
+        enum TypeId : uint8_t {
+            type_int = 2,
+            type_binary = 4,
+            type_utf8 = 5,
+            type_timestamp = 10
+        };
+
+        enum : uint8_t {
+            header_schema = 1,
+            header_record_batch = 3
+        };
+
+        enum : int16_t {
+            metadata_v5 = 4
+        };
+
+        struct Block {
+            int64_t offset;
+            int32_t metadata_length;
+            int32_t padding;
+            int64_t body_length;
+        };
+
+        std::ofstream out;
+        int64_t file_offset;
+        size_t batch_rows;
+        std::vector<Block> batches;
+
+        std::vector<int32_t> host_offsets;
+        std::string host_data;
+        std::vector<uint16_t> ports;
+        std::vector<uint8_t> states;
+        std::vector<uint32_t> rtts;
+        std::vector<int32_t> banner_offsets;
+        std::string banner_data;
+        std::vector<int64_t> timestamps;
+
+        void write(const void* bytes, size_t n) {
+            out.write((const char*)bytes, n);
+            file_offset += n;
+        }
+
+        void write_padding(size_t n) {
+            static const char zeros[8] = { 0 };
+            write(zeros, (8 - n % 8) % 8);
+        }
+
+        static uint32_t build_field(FlatBuilder& fb, const std::string& name, TypeId type, int bit_width, bool is_signed) {
+            uint32_t type_table = 0;
+            uint32_t timezone = (type == type_timestamp ? fb.create_string("UTC") : 0);
+
+            fb.start_table();
+            if (type == type_int) {
+                fb.add_field(0, (int32_t)bit_width);
+                fb.add_field(1, (uint8_t)is_signed);
+            }
+            else if (type == type_timestamp) {
+                fb.add_offset_field(1, timezone);
+                fb.add_field(0, (int16_t)2);        // microsecond.
+            }
+            type_table = fb.end_table();
+
+            uint32_t name_str = fb.create_string(name);
+            uint32_t children = fb.create_offset_vector({});
+
+            fb.start_table();
+            fb.add_offset_field(0, name_str);
+            fb.add_offset_field(3, type_table);
+            fb.add_offset_field(5, children);
+            fb.add_field(1, (uint8_t)0);            // not nullable.
+            fb.add_field(2, (uint8_t)type);
+            return fb.end_table();
+        }
+
+        static uint32_t build_schema(FlatBuilder& fb) {
+            std::vector<uint32_t> fields;
+            fields.emplace_back(build_field(fb, "host", type_utf8, 0, false));
+            fields.emplace_back(build_field(fb, "port", type_int, 16, false));
+            fields.emplace_back(build_field(fb, "state", type_int, 8, false));
+            fields.emplace_back(build_field(fb, "rtt_micros", type_int, 32, false));
+            fields.emplace_back(build_field(fb, "banner", type_binary, 0, false));
+            fields.emplace_back(build_field(fb, "timestamp", type_timestamp, 0, false));
+
+            uint32_t field_vector = fb.create_offset_vector(fields);
+
+            fb.start_table();
+            fb.add_offset_field(1, field_vector);
+            fb.add_field(0, (int16_t)0);            // little endian.
+            return fb.end_table();
+        }
+
+        static std::vector<uint8_t> build_message(FlatBuilder& fb, uint8_t header_type, uint32_t header, int64_t body_length) {
+            fb.start_table();
+            fb.add_field(3, body_length);
+            fb.add_offset_field(2, header);
+            fb.add_field(0, (int16_t)metadata_v5);
+            fb.add_field(1, header_type);
+            return fb.finish(fb.end_table());
+        }
+
+        // continuation marker, metadata size, metadata padded to 8 bytes.
+        int32_t write_message_metadata(const std::vector<uint8_t>& metadata) {
+            int32_t padded = (int32_t)((metadata.size() + 7) / 8 * 8);
+            int32_t continuation = -1;
+
+            write(&continuation, 4);
+            write(&padded, 4);
+            write(metadata.data(), metadata.size());
+            write_padding(metadata.size());
+            return padded + 8;
+        }
+
+        void write_schema() {
+            FlatBuilder fb;
+            uint32_t schema = build_schema(fb);
+            write_message_metadata(build_message(fb, header_schema, schema, 0));
+        }
+
+        void flush_batch() {
+            size_t rows = ports.size();
+            if (rows == 0) {
+                return;
+            }
+
+            // body buffers, in schema order: (validity, offsets, data) for utf8 and binary, (validity, data) otherwise.
+            std::vector<std::pair<const void*, size_t>> buffers;
+            auto add_column = [&buffers](const void* bytes, size_t n) {
+                buffers.emplace_back(nullptr, 0);
+                buffers.emplace_back(bytes, n);
+            };
+
+            buffers.emplace_back(nullptr, 0);
+            buffers.emplace_back(host_offsets.data(), host_offsets.size() * 4);
+            buffers.emplace_back(host_data.data(), host_data.size());
+            add_column(ports.data(), rows * 2);
+            add_column(states.data(), rows);
+            add_column(rtts.data(), rows * 4);
+            buffers.emplace_back(nullptr, 0);
+            buffers.emplace_back(banner_offsets.data(), banner_offsets.size() * 4);
+            buffers.emplace_back(banner_data.data(), banner_data.size());
+            add_column(timestamps.data(), rows * 8);
+
+            std::vector<int64_t> buffer_specs;     // (offset, length) pairs.
+            int64_t body_length = 0;
+            for (const auto& b : buffers) {
+                buffer_specs.emplace_back(body_length);
+                buffer_specs.emplace_back((int64_t)b.second);
+                body_length += (b.second + 7) / 8 * 8;
+            }
+
+            std::vector<int64_t> nodes;            // (length, null_count) per column.
+            for (int i = 0; i < 6; ++i) {
+                nodes.emplace_back((int64_t)rows);
+                nodes.emplace_back(0);
+            }
+
+            FlatBuilder fb;
+            uint32_t buffer_vector = fb.create_struct_vector(buffer_specs.data(), buffers.size(), 16);
+            uint32_t node_vector = fb.create_struct_vector(nodes.data(), 6, 16);
+
+            fb.start_table();
+            fb.add_field(0, (int64_t)rows);
+            fb.add_offset_field(1, node_vector);
+            fb.add_offset_field(2, buffer_vector);
+            uint32_t record_batch = fb.end_table();
+
+            Block block;
+            block.offset = file_offset;
+            block.padding = 0;
+            block.body_length = body_length;
+            block.metadata_length = write_message_metadata(build_message(fb, header_record_batch, record_batch, body_length));
+
+            for (const auto& b : buffers) {
+                write(b.first, b.second);
+                write_padding(b.second);
+            }
+
+            batches.emplace_back(block);
+
+            host_offsets.assign(1, 0);
+            host_data.clear();
+            ports.clear();
+            states.clear();
+            rtts.clear();
+            banner_offsets.assign(1, 0);
+            banner_data.clear();
+            timestamps.clear();
+        }
+
+        void write_footer() {
+            FlatBuilder fb;
+            uint32_t schema = build_schema(fb);
+            uint32_t batch_vector = fb.create_struct_vector(batches.data(), batches.size(), sizeof(Block));
+            uint32_t dictionary_vector = fb.create_struct_vector(nullptr, 0, sizeof(Block));
+
+            fb.start_table();
+            fb.add_offset_field(1, schema);
+            fb.add_offset_field(2, dictionary_vector);
+            fb.add_offset_field(3, batch_vector);
+            fb.add_field(0, (int16_t)metadata_v5);
+            std::vector<uint8_t> footer = fb.finish(fb.end_table());
+
+            int32_t footer_size = (int32_t)footer.size();
+            write(footer.data(), footer.size());
+            write(&footer_size, 4);
+            write("ARROW1", 6);
+        }
+    public:
+        ResultArrowWriter(const std::string& filePath, size_t _batch_rows = 65536)
+            : out{ filePath, std::ios::binary }, file_offset{ 0 }, batch_rows{ _batch_rows }, batches{},
+              host_offsets(1, 0), host_data{}, ports{}, states{}, rtts{}, banner_offsets(1, 0), banner_data{}, timestamps{}
+        {
+            if (!out.is_open()) {
+                throw ArrowWriteException{ "open for writing failed: " + filePath };
+            }
+
+            write("ARROW1\0\0", 8);
+            write_schema();
+        }
+
+        ResultArrowWriter(const ResultArrowWriter&) = delete;
+        ResultArrowWriter& operator=(const ResultArrowWriter&) = delete;
+
+        ~ResultArrowWriter() {
+            try {
+                close();
+            }
+            catch (...) {}
+        }
+
+        // `banner` may be nullptr when `banner_length` is 0.
+        void append(const std::string& host, int port, ResultState state, uint32_t rtt_micros, const char* banner, size_t banner_length,
+                    int64_t timestamp_micros) {
+            host_data.append(host);
+            host_offsets.emplace_back((int32_t)host_data.size());
+            ports.emplace_back((uint16_t)port);
+            states.emplace_back(state);
+            rtts.emplace_back(rtt_micros);
+            if (banner_length > 0) {
+                banner_data.append(banner, banner_length);
+            }
+            banner_offsets.emplace_back((int32_t)banner_data.size());
+            timestamps.emplace_back(timestamp_micros);
+
+            if (ports.size() >= batch_rows) {
+                flush_batch();
+            }
+        }
+
+        void close() {
+            if (!out.is_open()) {
+                return;
+            }
+
+            flush_batch();
+
+            int32_t eos[2] = { -1, 0 };
+            write(eos, 8);
+            write_footer();
+            out.close();
+
+            if (out.fail()) {
+                throw ArrowWriteException{ "write failed" };
+            }
+        }
+    };
+}
@@ -4,6 +4,7 @@
 #include <fstream>
 #include <string>
 #include <map>
+#include <vector>
 #include <cctype>
 
 namespace config_parser {
@@ -14,7 +15,23 @@ namespace config_parser {
         {}
     };
 
+    // the keys under one `[name]` header, the keys before any header have an empty name.
+    struct Section {
+        std::string name;
+        std::map<std::string, std::string> entries;
+    };
+
     class ConfigParser {
+        // "[name]" -> name, or empty string when the line is not a header.
+        static std::string section_header(const std::string& line) {
+            size_t first = line.find_first_not_of(" \t\r");
+            size_t last = line.find_last_not_of(" \t\r");
+            if (first == std::string::npos || line[first] != '[' || line[last] != ']' || last - first < 2) {
+                return "";
+            }
+            return line.substr(first + 1, last - first - 1);
+        }
+
         void process_line(const std::string& line, std::map<std::string, std::string>& resultMap) {
             size_t i = 0;
             size_t keyStart = 0;
@@ -96,5 +113,37 @@ namespace config_parser {
 
             return resultMap;
         }
+
+        // sections in file order, a repeated header continues the earlier section.
+        std::vector<Section> parse_sections(const std::string& filePath) {
+            std::ifstream in{ filePath };
+            if (!in.is_open()) {
+                throw FileNotFoundException{ filePath };
+            }
+
+            std::vector<Section> sections(1);
+            size_t current = 0;
+            std::string line;
+
+            while (std::getline(in, line)) {
+                std::string name = section_header(line);
+                if (!name.empty()) {
+                    current = sections.size();
+                    for (size_t i = 1; i < sections.size(); ++i) {
+                        if (sections[i].name == name) {
+                            current = i;
+                        }
+                    }
+                    if (current == sections.size()) {
+                        sections.emplace_back(Section{ name, {} });
+                    }
+                }
+                else if (!line.empty()) {
+                    process_line(line, sections[current].entries);
+                }
+            }
+
+            return sections;
+        }
     };
 }
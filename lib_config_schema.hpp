@@ -0,0 +1,154 @@
+#pragma once
+
+// @brief  typed config schema: every key a config struct accepts, its type, range and
+//         whether it is required. `apply` validates a parsed section in one pass and writes
+//         straight into the struct, unknown keys are errors rather than silently ignored.
+//         errors come back as strings in the "config invalid: <key>" style.
+#include <string>
+#include <map>
+#include <functional>
+#include <sstream>
+#include <cstdlib>
+
+namespace config_schema {
+    // a whole decimal number in [min, max], false on anything else, including overflow.
+    inline bool parse_integer(const std::string& str, long long min, long long max, long long& out) {
+        if (str.empty() || str.size() > 18) {
+            return false;
+        }
+
+        bool negative = (str[0] == '-');
+        if (negative && str.size() == 1) {
+            return false;
+        }
+        size_t i = (negative ? 1 : 0);
+
+        long long number = 0;
+        for (; i < str.size(); ++i) {
+            if (str[i] < '0' || str[i] > '9') {
+                return false;
+            }
+            number = 10 * number + (str[i] - '0');
+        }
+
+        number = (negative ? -number : number);
+        if (number < min || number > max) {
+            return false;
+        }
+
+        out = number;
+        return true;
+    }
+
+    // a plain decimal or scientific number like 0.001 or 1e-6, in [min, max].
+    inline bool parse_real(const std::string& str, double min, double max, double& out) {
+        if (str.empty() || str.size() > 32 || str.find_first_not_of("0123456789.eE+-") != std::string::npos) {
+            return false;
+        }
+
+        char* end = nullptr;
+        double number = std::strtod(str.c_str(), &end);
+        if (end != str.c_str() + str.size() || !(number >= min && number <= max)) {
+            return false;
+        }
+
+        out = number;
+        return true;
+    }
+
+    inline bool parse_boolean(const std::string& str, bool& out) {
+        if (str == "true" || str == "yes" || str == "1") {
+            out = true;
+            return true;
+        }
+        if (str == "false" || str == "no" || str == "0") {
+            out = false;
+            return true;
+        }
+        return false;
+    }
+
+    template<typename Config>
+    class Schema {
+    public:
+        // returns an error message, or empty string on success.
+        using Assign = std::function<std::string(const std::string& value, Config& config)>;
+    private:
+        struct Field {
+            bool required;
+            Assign assign;
+        };
+
+        std::map<std::string, Field> fields;
+
+        static std::string invalid(const std::string& key, const std::string& why) {
+            return "config invalid: " + key + (why.empty() ? "" : ", " + why);
+        }
+    public:
+        Schema& integer(const std::string& key, int Config::*member, long long min, long long max, bool required = false) {
+            return custom(key, [key, member, min, max](const std::string& value, Config& config) -> std::string {
+                long long number = 0;
+                if (!parse_integer(value, min, max, number)) {
+                    return invalid(key, "expects an integer in " + std::to_string(min) + ".." + std::to_string(max));
+                }
+                config.*member = (int)number;
+                return "";
+            }, required);
+        }
+
+        Schema& real(const std::string& key, double Config::*member, double min, double max, bool required = false) {
+            return custom(key, [key, member, min, max](const std::string& value, Config& config) -> std::string {
+                if (!parse_real(value, min, max, config.*member)) {
+                    std::ostringstream range;
+                    range << min << ".." << max;
+                    return invalid(key, "expects a number in " + range.str());
+                }
+                return "";
+            }, required);
+        }
+
+        Schema& string(const std::string& key, std::string Config::*member, bool required = false) {
+            return custom(key, [member](const std::string& value, Config& config) -> std::string {
+                config.*member = value;
+                return "";
+            }, required);
+        }
+
+        Schema& boolean(const std::string& key, bool Config::*member, bool required = false) {
+            return custom(key, [key, member](const std::string& value, Config& config) -> std::string {
+                if (!parse_boolean(value, config.*member)) {
+                    return invalid(key, "expects true or false");
+                }
+                return "";
+            }, required);
+        }
+
+        Schema& custom(const std::string& key, Assign assign, bool required = false) {
+            fields[key] = Field{ required, assign };
+            return *this;
+        }
+
+        // one pass over the section, then the required keys it did not have.
+        std::string apply(const std::map<std::string, std::string>& section, Config& config) const {
+            for (const auto& entry : section) {
+                auto field = fields.find(entry.first);
+                if (field == fields.cend()) {
+                    return "config unknown: " + entry.first;
+                }
+
+                std::string error = field->second.assign(entry.second, config);
+                if (!error.empty()) {
+                    return error;
+                }
+            }
+
+            for (const auto& field : fields) {
+                if (field.second.required && section.find(field.first) == section.cend()) {
+                    return "config not found: " + field.first;
+                }
+            }
+
+            return "";
+        }
+    };
+}
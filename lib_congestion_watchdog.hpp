@@ -0,0 +1,404 @@
+#pragma once
+
+// @brief  local congestion watchdog. a scan which sends faster than this machine can carry
+//         loses syns and their answers on the way out or in, and a lost probe looks closed.
+//         the kernel counts those drops: ip discards and tcp memory pressure in /proc/net/snmp
+//         and /proc/net/netstat, the backlog in /proc/net/softnet_stat, the drops of every root
+//         qdisc and the ring overruns of every link through rtnetlink, and the memory of all
+//         tcp sockets against the pressure threshold of tcp_mem. they are sampled on a thread,
+//         and any drop halves the window and rate the engine reads from its live settings.
+//         the counters are of the whole machine, other traffic dropping throttles the scan too.
+#include <system_error>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/pkt_sched.h>
+#include <linux/gen_stats.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "lib_scan_engine.hpp"
+#include "lib_live_config.hpp"
+
+namespace congestion_watchdog {
+    namespace detail {
+        inline void throw_errno(int err, const std::string& what) {
+            std::error_code ec(err, std::system_category());
+            throw std::system_error{ ec, what };
+        }
+    }
+
+    // counters of local drops, each a total since boot.
+    struct DropCounters {
+        uint64_t ip_out_discards;       // /proc/net/snmp, Ip OutDiscards: no buffer on the way out.
+        uint64_t tcp_memory_pressure;   // /proc/net/netstat, TcpExt TCPMemoryPressures.
+        uint64_t tcp_abort_on_memory;   // TcpExt TCPAbortOnMemory.
+        uint64_t tcp_backlog_drops;     // TcpExt TCPBacklogDrop, answers to a busy socket.
+        uint64_t backlog_drops;         // /proc/net/softnet_stat, netdev_max_backlog overflows.
+        uint64_t qdisc_drops;           // root qdiscs of every link.
+        uint64_t link_drops;            // tx dropped, fifo and missed errors of every link.
+        bool tcp_mem_pressure;          // not a counter, tcp memory is above the tcp_mem pressure threshold now.
+
+        static const int count = 7;
+
+        // the names of the counters, in the order of `at`.
+        static const char* name(int i) {
+            static const char* const names[count] = { "ip out discards", "tcp memory pressure", "tcp aborts on memory",
+                                                      "tcp backlog drops", "netdev backlog drops", "qdisc drops", "link drops" };
+            return names[i];
+        }
+
+        uint64_t at(int i) const {
+            const uint64_t values[count] = { ip_out_discards, tcp_memory_pressure, tcp_abort_on_memory, tcp_backlog_drops,
+                                             backlog_drops, qdisc_drops, link_drops };
+            return values[i];
+        }
+    };
+
+    // raii netlink socket for rtnetlink dumps.
+    class RouteSocket {
+        int fd;
+    public:
+        RouteSocket() {
+            fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE);
+            if (fd < 0) {
+                detail::throw_errno(errno, "sys call socket failed on `NETLINK_ROUTE`");
+            }
+        }
+
+        RouteSocket(const RouteSocket&) = delete;
+        RouteSocket& operator=(const RouteSocket&) = delete;
+
+        ~RouteSocket() {
+            close(fd);
+        }
+
+        // dumps `type` with the family header `T`, calls func(header, attributes, attributes_length) per object.
+        template<typename T, typename Func>
+        void dump(uint16_t type, const T& header, Func func) {
+            struct {
+                struct nlmsghdr nlh;
+                T header;
+            } request;
+            std::memset(&request, 0, sizeof(request));
+
+            request.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(T));
+            request.nlh.nlmsg_type = type;
+            request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+            request.header = header;
+
+            if (send(fd, &request, request.nlh.nlmsg_len, 0) < 0) {
+                detail::throw_errno(errno, "sys call send failed on rtnetlink");
+            }
+
+            alignas(struct nlmsghdr) char buf[32 * 1024];
+            while (true) {
+                ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    detail::throw_errno(errno, "sys call recv failed on rtnetlink");
+                }
+
+                int left = (int)n;
+                for (struct nlmsghdr* nlh = (struct nlmsghdr*)buf; NLMSG_OK(nlh, left); nlh = NLMSG_NEXT(nlh, left)) {
+                    if (nlh->nlmsg_type == NLMSG_DONE) {
+                        return;
+                    }
+                    if (nlh->nlmsg_type == NLMSG_ERROR) {
+                        const struct nlmsgerr* err = (const struct nlmsgerr*)NLMSG_DATA(nlh);
+                        detail::throw_errno(-err->error, "rtnetlink dump failed");
+                    }
+
+                    const T* object = (const T*)NLMSG_DATA(nlh);
+                    const struct rtattr* attr = (const struct rtattr*)((const char*)object + NLMSG_ALIGN(sizeof(T)));
+                    func(*object, attr, (int)(nlh->nlmsg_len - NLMSG_LENGTH(NLMSG_ALIGN(sizeof(T)))));
+                }
+            }
+        }
+    };
+
+    // "Prefix: name name ..." lines each followed by "Prefix: value value ...", as in
+    // /proc/net/snmp and /proc/net/netstat. keys are "Prefix:name".
+    inline std::map<std::string, uint64_t> read_proc_table(const char* path) {
+        std::map<std::string, uint64_t> table;
+        std::ifstream in{ path };
+        std::string names;
+        std::string values;
+
+        while (std::getline(in, names) && std::getline(in, values)) {
+            std::istringstream name_stream{ names };
+            std::istringstream value_stream{ values };
+            std::string prefix;
+            std::string name;
+            std::string value;
+
+            name_stream >> prefix;
+            value_stream >> value;
+            while (name_stream >> name && value_stream >> value) {
+                table[prefix + name] = std::strtoull(value.c_str(), nullptr, 10);
+            }
+        }
+        return table;
+    }
+
+    // the second column of every cpu's line of /proc/net/softnet_stat, hex.
+    inline uint64_t read_softnet_drops() {
+        std::ifstream in{ "/proc/net/softnet_stat" };
+        std::string line;
+        uint64_t drops = 0;
+
+        while (std::getline(in, line)) {
+            std::istringstream columns{ line };
+            std::string processed;
+            std::string dropped;
+            if (columns >> processed >> dropped) {
+                drops += std::strtoull(dropped.c_str(), nullptr, 16);
+            }
+        }
+        return drops;
+    }
+
+    // true when the pages of all tcp sockets (sockstat `mem`) reach the middle value of tcp_mem.
+    inline bool read_tcp_mem_pressure() {
+        std::ifstream limits{ "/proc/sys/net/ipv4/tcp_mem" };
+        uint64_t low = 0;
+        uint64_t pressure = 0;
+        if (!(limits >> low >> pressure)) {
+            return false;
+        }
+
+        std::ifstream in{ "/proc/net/sockstat" };
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.compare(0, 4, "TCP:") != 0) {
+                continue;
+            }
+            std::istringstream fields{ line };
+            std::string field;
+            while (fields >> field) {
+                uint64_t pages = 0;
+                if (field == "mem" && fields >> pages) {
+                    return pages >= pressure;
+                }
+            }
+        }
+        return false;
+    }
+
+    // the drops of every root qdisc, the same numbers as `tc -s qdisc`.
+    inline uint64_t read_qdisc_drops(RouteSocket& route) {
+        uint64_t drops = 0;
+        struct tcmsg request;
+        std::memset(&request, 0, sizeof(request));
+        request.tcm_family = AF_UNSPEC;
+
+        route.dump(RTM_GETQDISC, request, [&drops](const struct tcmsg& tc, const struct rtattr* attr, int length) {
+            // a child's drops are in its root's too, mq sums its children.
+            if (tc.tcm_parent != TC_H_ROOT) {
+                return;
+            }
+
+            uint64_t legacy = 0;
+            bool found = false;
+            for (; RTA_OK(attr, length); attr = RTA_NEXT(attr, length)) {
+                if (attr->rta_type == TCA_STATS2) {
+                    int nested_length = (int)RTA_PAYLOAD(attr);
+                    for (const struct rtattr* nested = (const struct rtattr*)RTA_DATA(attr); RTA_OK(nested, nested_length);
+                         nested = RTA_NEXT(nested, nested_length)) {
+                        if (nested->rta_type == TCA_STATS_QUEUE && RTA_PAYLOAD(nested) >= sizeof(struct gnet_stats_queue)) {
+                            struct gnet_stats_queue queue;
+                            std::memcpy(&queue, RTA_DATA(nested), sizeof(queue));
+                            drops += queue.drops;
+                            found = true;
+                        }
+                    }
+                }
+                else if (attr->rta_type == TCA_STATS && RTA_PAYLOAD(attr) >= sizeof(struct tc_stats)) {
+                    struct tc_stats stats;
+                    std::memcpy(&stats, RTA_DATA(attr), sizeof(stats));
+                    legacy = stats.drops;
+                }
+            }
+            drops += (found ? 0 : legacy);
+        });
+        return drops;
+    }
+
+    // the drops of every link, the ring overruns of the nics among them. rx_dropped is left
+    // out, it counts frames of protocols nobody listens to as well.
+    inline uint64_t read_link_drops(RouteSocket& route) {
+        uint64_t drops = 0;
+        struct ifinfomsg request;
+        std::memset(&request, 0, sizeof(request));
+        request.ifi_family = AF_UNSPEC;
+
+        route.dump(RTM_GETLINK, request, [&drops](const struct ifinfomsg&, const struct rtattr* attr, int length) {
+            for (; RTA_OK(attr, length); attr = RTA_NEXT(attr, length)) {
+                if (attr->rta_type == IFLA_STATS64 && RTA_PAYLOAD(attr) >= sizeof(struct rtnl_link_stats64)) {
+                    struct rtnl_link_stats64 stats;
+                    std::memcpy(&stats, RTA_DATA(attr), sizeof(stats));
+                    drops += stats.tx_dropped + stats.tx_fifo_errors + stats.rx_fifo_errors + stats.rx_over_errors + stats.rx_missed_errors;
+                }
+            }
+        });
+        return drops;
+    }
+
+    inline DropCounters read_drop_counters(RouteSocket& route) {
+        DropCounters counters;
+        auto snmp = read_proc_table("/proc/net/snmp");
+        auto netstat = read_proc_table("/proc/net/netstat");
+
+        counters.ip_out_discards = snmp["Ip:OutDiscards"];
+        counters.tcp_memory_pressure = netstat["TcpExt:TCPMemoryPressures"];
+        counters.tcp_abort_on_memory = netstat["TcpExt:TCPAbortOnMemory"];
+        counters.tcp_backlog_drops = netstat["TcpExt:TCPBacklogDrop"];
+        counters.backlog_drops = read_softnet_drops();
+        counters.qdisc_drops = read_qdisc_drops(route);
+        counters.link_drops = read_link_drops(route);
+        counters.tcp_mem_pressure = read_tcp_mem_pressure();
+        return counters;
+    }
+
+    // what the watchdog saw over a scan.
+    struct WatchdogReport {
+        uint64_t drops[DropCounters::count];    // per counter of `DropCounters`, during the scan.
+        uint64_t pressure_samples;              // samples with tcp memory above the pressure threshold.
+        uint64_t throttles;
+        double lowest_share;                    // of window and rate.
+    };
+
+    // samples the drop counters every `interval_millisec`, and publishes the `base` settings to
+    // `live` with window and rate scaled by a share: halved after a sample with drops, a
+    // sixteenth more after every `recovery_samples` clean samples in a row.
+    class CongestionWatchdog {
+        live_config::RcuCell<scan_engine::LiveSettings>& live;
+        scan_engine::LiveSettings base;
+        std::mutex lock;        // base and share, a config reload publishes from its own thread.
+        double share;
+        WatchdogReport report_data;
+
+        RouteSocket route;
+        int stop_fd;
+        std::thread worker;
+
+        void publish_locked() {
+            scan_engine::LiveSettings settings = base;
+            settings.window = std::max(1, (int)(base.window * share));
+            if (base.rate > 0) {
+                settings.rate = std::max(1, (int)(base.rate * share));
+            }
+            live.publish(settings);
+        }
+
+        void run(int interval_millisec, int recovery_samples) {
+            DropCounters last = read_drop_counters(route);
+            int clean = 0;
+            struct pollfd pfd = { stop_fd, POLLIN, 0 };
+
+            while (true) {
+                int ret = poll(&pfd, 1, interval_millisec);
+                if (ret != 0 && !(ret < 0 && errno == EINTR)) {
+                    return;
+                }
+
+                DropCounters now;
+                try {
+                    now = read_drop_counters(route);
+                }
+                catch (const std::system_error&) {
+                    continue;
+                }
+
+                bool dropped = now.tcp_mem_pressure;
+                std::lock_guard<std::mutex> guard{ lock };
+                for (int i = 0; i < DropCounters::count; ++i) {
+                    // a counter which went back was reset with its link, not a drop.
+                    uint64_t delta = (now.at(i) > last.at(i) ? now.at(i) - last.at(i) : 0);
+                    report_data.drops[i] += delta;
+                    dropped = dropped || delta > 0;
+                }
+                report_data.pressure_samples += (now.tcp_mem_pressure ? 1 : 0);
+                last = now;
+
+                if (dropped) {
+                    clean = 0;
+                    share = std::max(share / 2, 1.0 / 64);
+                    report_data.throttles += 1;
+                    report_data.lowest_share = std::min(report_data.lowest_share, share);
+                    publish_locked();
+                }
+                else if (share < 1 && ++clean >= recovery_samples) {
+                    clean = 0;
+                    share = std::min(share + 1.0 / 16, 1.0);
+                    publish_locked();
+                }
+            }
+        }
+    public:
+        CongestionWatchdog(live_config::RcuCell<scan_engine::LiveSettings>& _live, const scan_engine::LiveSettings& _base,
+                           int interval_millisec = 250, int recovery_samples = 4)
+            : live(_live), base{ _base }, lock{}, share{ 1 }, report_data{}, route{}, stop_fd{ -1 }, worker{}
+        {
+            report_data.lowest_share = 1;
+
+            stop_fd = eventfd(0, EFD_CLOEXEC);
+            if (stop_fd < 0) {
+                detail::throw_errno(errno, "sys call eventfd failed");
+            }
+
+            // the first sample fails here, not silently on the thread.
+            read_drop_counters(route);
+            worker = std::thread{ [this, interval_millisec, recovery_samples] { run(interval_millisec, recovery_samples); } };
+        }
+
+        CongestionWatchdog(const CongestionWatchdog&) = delete;
+        CongestionWatchdog& operator=(const CongestionWatchdog&) = delete;
+
+        ~CongestionWatchdog() {
+            stop();
+            close(stop_fd);
+        }
+
+        void stop() {
+            if (worker.joinable()) {
+                uint64_t one = 1;
+                if (::write(stop_fd, &one, sizeof(one)) == sizeof(one)) {
+                    worker.join();
+                }
+                else {
+                    worker.detach();
+                }
+            }
+        }
+
+        // new settings of the scan, from a config reload, published at the current share.
+        void set_base(const scan_engine::LiveSettings& settings) {
+            std::lock_guard<std::mutex> guard{ lock };
+            base = settings;
+            publish_locked();
+        }
+
+        WatchdogReport report() {
+            std::lock_guard<std::mutex> guard{ lock };
+            return report_data;
+        }
+    };
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+// @brief  blocked bloom filter, drops repeated results of one (host, port) before they reach
+//         the outputs. every key touches one 64-byte block, so a lookup costs one cache miss,
+//         and the filter is sized from the expected key count and false positive rate, capped
+//         by a memory budget. a false positive drops a real first result, so keep the rate low.
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+namespace dedup_filter {
+    class BlockedBloomFilter {
+        struct alignas(64) Block {
+            uint64_t words[8];
+        };
+
+        std::vector<Block> blocks;
+        int hashes;
+        size_t keys;
+        bool capped;
+
+        static uint64_t mix(uint64_t x) {
+            x += 0x9E3779B97F4A7C15ull;
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+            return x ^ (x >> 31);
+        }
+
+        // calls func(word, mask) for each of the `hashes` bits of `key`, all in one block.
+        template<typename Func>
+        void probe(uint64_t key, Func func) {
+            uint64_t h = mix(key);
+            Block& block = blocks[(size_t)(((h >> 32) * (uint64_t)blocks.size()) >> 32)];
+
+            // 9 bits of position per hash, 7 from every further mix. double hashing inside a
+            // block this small gives correlated bits and a much worse rate at high k.
+            uint64_t bits = mix(h);
+            for (int i = 0; i < hashes; ++i) {
+                if (i > 0 && i % 7 == 0) {
+                    bits = mix(bits);
+                }
+                uint32_t bit = (uint32_t)(bits >> (9 * (i % 7))) & 511;
+                func(block.words[bit >> 6], 1ull << (bit & 63));
+            }
+        }
+    public:
+        // the rate of a filter of `hashes` bits per key at `keys_per_block` on average. blocks
+        // fill unevenly, so this sums the poisson spread of keys per block.
+        static double blocked_fp_rate(double keys_per_block, int hashes) {
+            double rate = 0;
+            double p = std::exp(-keys_per_block);
+            int last = (int)(keys_per_block + 10 * std::sqrt(keys_per_block) + 20);
+
+            for (int l = 0; l <= last; ++l) {
+                if (l > 0) {
+                    p *= keys_per_block / l;
+                }
+                double set = 1 - std::pow(1 - 1.0 / 512, (double)hashes * l);
+                rate += p * std::pow(set, hashes);
+            }
+            return rate;
+        }
+    public:
+        // room for `expected` keys at `fp_rate`, or what `max_bytes` holds when that is less.
+        BlockedBloomFilter(size_t expected, double fp_rate, size_t max_bytes)
+            : blocks{}, hashes{ 1 }, keys{ 0 }, capped{ false }
+        {
+            const double ln2 = std::log(2.0);
+            const double n = (double)(expected > 0 ? expected : 1);
+            const size_t max_blocks = (max_bytes / sizeof(Block) > 0 ? max_bytes / sizeof(Block) : 1);
+
+            // hashes and size of a plain bloom filter first, then grown for the uneven blocks.
+            double bits_per_key = -std::log(fp_rate) / (ln2 * ln2);
+            int k = (int)std::lround(bits_per_key * ln2);
+            hashes = (k < 1 ? 1 : (k > 16 ? 16 : k));
+
+            size_t count = (size_t)std::ceil(bits_per_key * n / 512);
+            while (count < max_blocks && blocked_fp_rate(n / (double)count, hashes) > fp_rate) {
+                count += count / 16 + 1;
+            }
+
+            capped = (count >= max_blocks && blocked_fp_rate(n / (double)max_blocks, hashes) > fp_rate);
+            count = (count > max_blocks ? max_blocks : count);
+            blocks.resize(count > 0 ? count : 1);
+
+            // the best count of hashes for the bits each key really gets.
+            if (capped) {
+                k = (int)std::lround((double)blocks.size() * 512 / n * ln2);
+                hashes = (k < 1 ? 1 : (k > 16 ? 16 : k));
+            }
+
+            for (auto& block : blocks) {
+                for (auto& word : block.words) {
+                    word = 0;
+                }
+            }
+        }
+
+        // true when `key` was probably seen before, sets it either way.
+        bool test_and_set(uint64_t key) {
+            bool seen = true;
+            probe(key, [&seen](uint64_t& word, uint64_t mask) {
+                seen = seen && (word & mask) != 0;
+                word |= mask;
+            });
+
+            keys += (seen ? 0 : 1);
+            return seen;
+        }
+
+        bool contains(uint64_t key) const {
+            bool seen = true;
+            const_cast<BlockedBloomFilter*>(this)->probe(key, [&seen](uint64_t& word, uint64_t mask) {
+                seen = seen && (word & mask) != 0;
+            });
+            return seen;
+        }
+
+        size_t bytes() const {
+            return blocks.size() * sizeof(Block);
+        }
+
+        // keys set for the first time, false positives not counted.
+        size_t inserted() const {
+            return keys;
+        }
+
+        // true when the budget held less than `expected` keys at `fp_rate` need.
+        bool budget_limited() const {
+            return capped;
+        }
+
+        int hash_count() const {
+            return hashes;
+        }
+
+        // the false positive rate once `n` keys are in.
+        double expected_fp_rate(size_t n) const {
+            return blocked_fp_rate((double)n / (double)blocks.size(), hashes);
+        }
+    };
+}
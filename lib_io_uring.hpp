@@ -0,0 +1,402 @@
+#pragma once
+
+// @brief  minimal raw io_uring wrapper, no liburing needed, only the kernel uapi header.
+//         linux 5.7 or newer, provided buffer rings are used from 5.19 on.
+#include <system_error>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace io_uring {
+    namespace detail {
+        inline void throw_errno(int err, const char* what) {
+            std::error_code ec(err, std::system_category());
+            throw std::system_error{ ec, what };
+        }
+
+        template<typename T>
+        T load_acquire(const T* p) {
+            return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+        }
+
+        template<typename T>
+        void store_release(T* p, T value) {
+            __atomic_store_n(p, value, __ATOMIC_RELEASE);
+        }
+    }
+
+    // raii wrapper for one ring.
+    class Ring {
+        int fd;
+        struct io_uring_params params;
+
+        void* sq_ptr;
+        size_t sq_size;
+        void* cq_ptr;
+        size_t cq_size;
+        struct io_uring_sqe* sqes;
+
+        unsigned* sq_head;
+        unsigned* sq_tail;
+        unsigned sq_mask;
+        unsigned sqe_tail;          // local, sqes handed out so far.
+        unsigned sqe_submitted;
+
+        unsigned* cq_head;
+        unsigned* cq_tail;
+        unsigned cq_mask;
+        struct io_uring_cqe* cqes;
+
+        template<typename T>
+        T* sq_field(unsigned offset) {
+            return (T*)((char*)sq_ptr + offset);
+        }
+
+        template<typename T>
+        T* cq_field(unsigned offset) {
+            return (T*)((char*)cq_ptr + offset);
+        }
+    public:
+        // sizes above what the kernel takes are clamped to its maximum, see `sq_entries` and `cq_entries`.
+        Ring(unsigned entries, unsigned cq_entries)
+            : fd{ -1 }, params{}, sq_ptr{ MAP_FAILED }, sq_size{ 0 }, cq_ptr{ MAP_FAILED }, cq_size{ 0 }, sqes{ (struct io_uring_sqe*)MAP_FAILED },
+              sq_head{ nullptr }, sq_tail{ nullptr }, sq_mask{ 0 }, sqe_tail{ 0 }, sqe_submitted{ 0 },
+              cq_head{ nullptr }, cq_tail{ nullptr }, cq_mask{ 0 }, cqes{ nullptr }
+        {
+            std::memset(&params, 0, sizeof(params));
+            params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+            params.cq_entries = cq_entries;
+
+            fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+            if (fd < 0) {
+                detail::throw_errno(errno, "sys call io_uring_setup failed");
+            }
+
+            sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+            bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single_mmap) {
+                sq_size = (sq_size > cq_size ? sq_size : cq_size);
+            }
+
+            sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            cq_ptr = single_mmap ? sq_ptr : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            sqes = (struct io_uring_sqe*)mmap(nullptr, params.sq_entries * sizeof(struct io_uring_sqe),
+                                              PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+            if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes == MAP_FAILED) {
+                int err = errno;
+                release();
+                detail::throw_errno(err, "sys call mmap failed on io_uring");
+            }
+
+            sq_head = sq_field<unsigned>(params.sq_off.head);
+            sq_tail = sq_field<unsigned>(params.sq_off.tail);
+            sq_mask = *sq_field<unsigned>(params.sq_off.ring_mask);
+            sqe_tail = *sq_tail;
+            sqe_submitted = sqe_tail;
+
+            // sqes are used in ring order, so the indirection array is the identity.
+            unsigned* sq_array = sq_field<unsigned>(params.sq_off.array);
+            for (unsigned i = 0; i < params.sq_entries; ++i) {
+                sq_array[i] = i;
+            }
+
+            cq_head = cq_field<unsigned>(params.cq_off.head);
+            cq_tail = cq_field<unsigned>(params.cq_off.tail);
+            cq_mask = *cq_field<unsigned>(params.cq_off.ring_mask);
+            cqes = cq_field<struct io_uring_cqe>(params.cq_off.cqes);
+        }
+
+        Ring(const Ring&) = delete;
+        Ring& operator=(const Ring&) = delete;
+
+        ~Ring() {
+            release();
+        }
+
+        void release() {
+            if (sqes != MAP_FAILED) {
+                munmap(sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+                sqes = (struct io_uring_sqe*)MAP_FAILED;
+            }
+            if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+                munmap(cq_ptr, cq_size);
+            }
+            if (sq_ptr != MAP_FAILED) {
+                munmap(sq_ptr, sq_size);
+            }
+            sq_ptr = cq_ptr = MAP_FAILED;
+
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+
+        int handle() const {
+            return fd;
+        }
+
+        unsigned sq_entries() const {
+            return params.sq_entries;
+        }
+
+        unsigned cq_entries() const {
+            return params.cq_entries;
+        }
+
+        // a zeroed sqe, or nullptr when the submission queue is full.
+        struct io_uring_sqe* get_sqe() {
+            if (sqe_tail - detail::load_acquire(sq_head) >= params.sq_entries) {
+                return nullptr;
+            }
+
+            struct io_uring_sqe* sqe = &sqes[sqe_tail & sq_mask];
+            std::memset(sqe, 0, sizeof(*sqe));
+            ++sqe_tail;
+            return sqe;
+        }
+
+        unsigned sq_space_left() const {
+            return params.sq_entries - (sqe_tail - detail::load_acquire(sq_head));
+        }
+
+        // submits the prepared sqes, and waits for at least `wait_nr` completions.
+        int submit_and_wait(unsigned wait_nr) {
+            unsigned to_submit = sqe_tail - sqe_submitted;
+            detail::store_release(sq_tail, sqe_tail);
+            sqe_submitted = sqe_tail;
+
+            while (true) {
+                int ret = (int)syscall(__NR_io_uring_enter, fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+                if (ret >= 0) {
+                    return ret;
+                }
+                if (errno != EINTR) {
+                    detail::throw_errno(errno, "sys call io_uring_enter failed");
+                }
+            }
+        }
+
+        // calls func(cqe) for every available completion, returns the count.
+        template<typename Func>
+        unsigned for_each_cqe(Func func) {
+            unsigned head = *cq_head;
+            unsigned tail = detail::load_acquire(cq_tail);
+            unsigned n = 0;
+
+            for (; head != tail; ++head, ++n) {
+                func(cqes[head & cq_mask]);
+            }
+
+            detail::store_release(cq_head, head);
+            return n;
+        }
+
+        int register_op(unsigned opcode, void* arg, unsigned nr_args) {
+            return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+        }
+
+        // true when the running kernel knows `opcode`.
+        bool supports(unsigned opcode) {
+            std::vector<char> buf(sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op), 0);
+            struct io_uring_probe* probe = (struct io_uring_probe*)buf.data();
+
+            if (register_op(IORING_REGISTER_PROBE, probe, 256) < 0) {
+                return false;
+            }
+            return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+        }
+
+        // an empty registered file table of `count` slots, filled by the ops which take a
+        // `file_index` and used with IOSQE_FIXED_FILE. the kernel caps `count` at RLIMIT_NOFILE.
+        bool register_sparse_files(unsigned count) {
+            struct io_uring_rsrc_register reg;
+            std::memset(&reg, 0, sizeof(reg));
+            reg.nr = count;
+            reg.flags = IORING_RSRC_REGISTER_SPARSE;
+
+            if (register_op(IORING_REGISTER_FILES2, &reg, sizeof(reg)) == 0) {
+                return true;
+            }
+
+            // before 5.19, -1 entries are the empty slots.
+            std::vector<int> fds(count, -1);
+            return register_op(IORING_REGISTER_FILES, fds.data(), count) == 0;
+        }
+    };
+
+    // a pool of equally sized buffers the kernel picks from only when data actually arrives,
+    // instead of one buffer parked on every socket. normally a provided buffer ring
+    // (IORING_REGISTER_PBUF_RING), kernels before 5.19 get the same pool through
+    // IORING_OP_PROVIDE_BUFFERS instead.
+    class BufferRing {
+        Ring& ring;
+        uint16_t group;
+        unsigned entries;
+        unsigned buffer_size;
+        struct io_uring_buf_ring* buf_ring;     // nullptr in the legacy mode.
+        size_t ring_bytes;
+        char* pool;
+        uint16_t tail;
+        std::vector<uint16_t> pending;          // legacy mode, recycled but not provided yet.
+
+        unsigned in_use;
+        unsigned peak_in_use;
+
+        void register_ring() {
+            void* mem = mmap(nullptr, ring_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) {
+                detail::throw_errno(errno, "sys call mmap failed on buffer ring");
+            }
+
+            struct io_uring_buf_reg reg;
+            std::memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = (uint64_t)(uintptr_t)mem;
+            reg.ring_entries = entries;
+            reg.bgid = group;
+
+            if (ring.register_op(IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+                munmap(mem, ring_bytes);
+                return;
+            }
+
+            buf_ring = (struct io_uring_buf_ring*)mem;
+            for (unsigned bid = 0; bid < entries; ++bid) {
+                add(bid);
+            }
+            commit();
+        }
+
+        void unregister_ring() {
+            struct io_uring_buf_reg reg;
+            std::memset(&reg, 0, sizeof(reg));
+            reg.bgid = group;
+            ring.register_op(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+
+            munmap(buf_ring, ring_bytes);
+            buf_ring = nullptr;
+        }
+
+        // legacy mode, hands `count` buffers from `bid` on to the kernel.
+        void provide(uint16_t bid, unsigned count) {
+            struct io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+            sqe->fd = (int)count;
+            sqe->addr = (uint64_t)(uintptr_t)(pool + (size_t)bid * buffer_size);
+            sqe->len = buffer_size;
+            sqe->off = bid;
+            sqe->buf_group = group;
+            sqe->user_data = provide_user_data;
+        }
+    public:
+        // completions of the buffer bookkeeping sqes carry this, callers skip them.
+        static const uint64_t provide_user_data = ~(uint64_t)0;
+
+        // `entries` must be a power of 2, the ring must be idle while this runs.
+        BufferRing(Ring& _ring, uint16_t _group, unsigned _entries, unsigned _buffer_size)
+            : ring(_ring), group{ _group }, entries{ _entries }, buffer_size{ _buffer_size }, buf_ring{ nullptr },
+              ring_bytes{ _entries * sizeof(struct io_uring_buf) }, pool{ nullptr }, tail{ 0 }, pending{}, in_use{ 0 }, peak_in_use{ 0 }
+        {
+            pool = new char[(size_t)entries * buffer_size];
+
+            register_ring();
+            if (!buf_ring) {
+                provide(0, entries);
+                ring.submit_and_wait(1);
+                ring.for_each_cqe([](const struct io_uring_cqe& cqe) {
+                    if (cqe.res < 0) {
+                        detail::throw_errno(-cqe.res, "io_uring `IORING_OP_PROVIDE_BUFFERS` failed");
+                    }
+                });
+            }
+        }
+
+        BufferRing(const BufferRing&) = delete;
+        BufferRing& operator=(const BufferRing&) = delete;
+
+        ~BufferRing() {
+            if (buf_ring) {
+                unregister_ring();
+            }
+            delete[] pool;
+        }
+
+        uint16_t group_id() const {
+            return group;
+        }
+
+        unsigned size() const {
+            return buffer_size;
+        }
+
+        unsigned count() const {
+            return entries;
+        }
+
+        unsigned peak() const {
+            return peak_in_use;
+        }
+
+        bool mapped() const {
+            return buf_ring != nullptr;
+        }
+
+        // the kernel filled buffer `bid` for a completion with IORING_CQE_F_BUFFER.
+        const char* take(uint16_t bid) {
+            ++in_use;
+            peak_in_use = (in_use > peak_in_use ? in_use : peak_in_use);
+            return pool + (size_t)bid * buffer_size;
+        }
+
+        // gives a buffer back, visible to the kernel after `commit`.
+        void recycle(uint16_t bid) {
+            --in_use;
+            if (buf_ring) {
+                add(bid);
+            }
+            else {
+                pending.emplace_back(bid);
+            }
+        }
+
+        void add(uint16_t bid) {
+            // not `bufs[]`, its flex array declaration gets padded to offset 8 in c++.
+            struct io_uring_buf* buf = (struct io_uring_buf*)buf_ring + (tail & (entries - 1));
+            buf->addr = (uint64_t)(uintptr_t)(pool + (size_t)bid * buffer_size);
+            buf->len = buffer_size;
+            buf->bid = bid;
+            ++tail;
+        }
+
+        // returns the count of sqes queued, in the legacy mode their completions
+        // carry `provide_user_data`. buffers which found no sqe wait for the next commit.
+        unsigned commit() {
+            if (buf_ring) {
+                detail::store_release(&buf_ring->tail, tail);
+                return 0;
+            }
+
+            unsigned queued = 0;
+            while (!pending.empty() && ring.sq_space_left() > 0) {
+                provide(pending.back(), 1);
+                pending.pop_back();
+                ++queued;
+            }
+            return queued;
+        }
+
+        bool uncommitted() const {
+            return !pending.empty();
+        }
+    };
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+// @brief  settings which change while a scan runs.
+//         `RcuCell<T>` holds an immutable T behind an atomic pointer. a writer publishes a
+//         new copy with one exchange; the scan thread reads the pointer without a lock and
+//         calls `quiescent()` between batches, where it holds no old pointer, which frees
+//         what earlier publishes retired. one reader thread, any number of writers.
+//         `FileWatcher` calls back when a file is rewritten, through inotify on its
+//         directory, so editors which save by rename are seen too.
+#include <system_error>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <cerrno>
+
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace live_config {
+    template<typename T>
+    class RcuCell {
+        struct Node {
+            T value;
+            Node* next;     // in the retired list.
+        };
+
+        std::atomic<Node*> current;
+        std::atomic<Node*> retired;
+        std::atomic<uint64_t> version;
+
+        static void free_list(Node* node) {
+            while (node) {
+                Node* next = node->next;
+                delete node;
+                node = next;
+            }
+        }
+    public:
+        RcuCell(const T& initial) : current{ new Node{ initial, nullptr } }, retired{ nullptr }, version{ 0 } {}
+
+        RcuCell(const RcuCell&) = delete;
+        RcuCell& operator=(const RcuCell&) = delete;
+
+        ~RcuCell() {
+            delete current.load();
+            free_list(retired.load());
+        }
+
+        // reader, valid until its next `quiescent()`.
+        const T& read() const {
+            return current.load(std::memory_order_acquire)->value;
+        }
+
+        // reader, call where no reference from `read()` is held any more.
+        void quiescent() {
+            free_list(retired.exchange(nullptr, std::memory_order_acquire));
+        }
+
+        // writer.
+        void publish(const T& value) {
+            Node* old = current.exchange(new Node{ value, nullptr }, std::memory_order_acq_rel);
+
+            Node* head = retired.load(std::memory_order_relaxed);
+            do {
+                old->next = head;
+            } while (!retired.compare_exchange_weak(head, old, std::memory_order_release, std::memory_order_relaxed));
+
+            version.fetch_add(1, std::memory_order_release);
+        }
+
+        // bumped by every publish, cheap for a reader to poll.
+        uint64_t published() const {
+            return version.load(std::memory_order_acquire);
+        }
+    };
+
+    // calls `on_change` on its own thread whenever `path` is written and closed, or replaced.
+    class FileWatcher {
+        int inotify_fd;
+        int stop_fd;
+        std::thread worker;
+
+        void run(const std::string& name, std::function<void()> on_change) {
+            alignas(struct inotify_event) char buf[4096];
+            struct pollfd fds[2] = { { inotify_fd, POLLIN, 0 }, { stop_fd, POLLIN, 0 } };
+
+            while (true) {
+                if (poll(fds, 2, -1) < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return;
+                }
+                if (fds[1].revents) {
+                    return;
+                }
+
+                ssize_t n = ::read(inotify_fd, buf, sizeof(buf));
+                bool changed = false;
+
+                for (ssize_t offset = 0; offset < n; ) {
+                    const struct inotify_event* event = (const struct inotify_event*)(buf + offset);
+                    if (event->len > 0 && name == event->name) {
+                        changed = true;
+                    }
+                    offset += sizeof(struct inotify_event) + event->len;
+                }
+
+                // several events of one save call back once.
+                if (changed) {
+                    on_change();
+                }
+            }
+        }
+    public:
+        FileWatcher(const std::string& path, std::function<void()> on_change)
+            : inotify_fd{ -1 }, stop_fd{ -1 }, worker{}
+        {
+            size_t slash = path.rfind('/');
+            std::string dir = (slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash)));
+            std::string name = (slash == std::string::npos ? path : path.substr(slash + 1));
+
+            inotify_fd = inotify_init1(IN_CLOEXEC);
+            stop_fd = eventfd(0, EFD_CLOEXEC);
+            if (inotify_fd < 0 || stop_fd < 0 || inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+                std::error_code ec(errno, std::system_category());
+                release();
+                throw std::system_error{ ec, "watch " + path + " failed" };
+            }
+
+            worker = std::thread{ [this, name, on_change] { run(name, on_change); } };
+        }
+
+        FileWatcher(const FileWatcher&) = delete;
+        FileWatcher& operator=(const FileWatcher&) = delete;
+
+        ~FileWatcher() {
+            if (worker.joinable()) {
+                uint64_t one = 1;
+                if (::write(stop_fd, &one, sizeof(one)) == sizeof(one)) {
+                    worker.join();
+                }
+                else {
+                    worker.detach();
+                }
+            }
+            release();
+        }
+
+        void release() {
+            if (inotify_fd >= 0) {
+                close(inotify_fd);
+                inotify_fd = -1;
+            }
+            if (stop_fd >= 0) {
+                close(stop_fd);
+                stop_fd = -1;
+            }
+        }
+    };
+}
@@ -0,0 +1,280 @@
+#pragma once
+
+// @brief  liveness monitor, a connection held open to every watched (host, port) instead of
+//         a rescan every minute. a peer which closes or resets is seen at once through
+//         EPOLLRDHUP / EPOLLERR, a peer which silently dies through tcp keepalive. a lost
+//         connection is tried again right away, a service which only closed idle connections
+//         stays up; when that fails it is reported down and retried with exponential backoff.
+#include <system_error>
+#include <functional>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "lib_scan_engine_epoll.hpp"
+
+namespace monitor {
+    struct MonitorConfig {
+        int connect_timeout_millisec;
+        int keepalive_idle_sec;         // idle time before the first keepalive probe.
+        int keepalive_interval_sec;     // between unanswered probes.
+        int keepalive_count;            // unanswered probes before the connection is dead.
+        int backoff_min_millisec;       // first retry after a failed reconnect, doubled up to the max.
+        int backoff_max_millisec;
+
+        MonitorConfig()
+            : connect_timeout_millisec{ 2000 }, keepalive_idle_sec{ 10 }, keepalive_interval_sec{ 2 }, keepalive_count{ 3 },
+              backoff_min_millisec{ 500 }, backoff_max_millisec{ 30000 }
+        {}
+    };
+
+    enum class Status { up, down };
+
+    struct MonitorEvent {
+        size_t target_index;
+        Status status;
+        const char* reason;     // static string.
+        int rtt_micros;         // of the connect, when up.
+    };
+
+    using EventCallback = std::function<void(const MonitorEvent&)>;
+
+    struct Target {
+        std::string ip;
+        int port;
+    };
+
+    class ConnectionMonitor {
+        enum class Stage { idle, connecting, connected };
+
+        struct Watch {
+            Target target;
+            struct sockaddr_in address;
+            scan_engine::Socket sock;
+            Stage stage;
+            bool reported_up;
+            bool grace;             // the last connection was up, this connect is the quick retry.
+            int backoff_millisec;
+            std::chrono::steady_clock::time_point deadline;     // of the connect, or of the next attempt.
+            std::chrono::steady_clock::time_point start;
+        };
+
+        MonitorConfig config;
+        std::vector<Watch> watches;
+        scan_engine::Epoll epoll;
+        uint64_t reconnects;
+
+        void set_keepalive(int fd) {
+            int on = 1;
+            setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &config.keepalive_idle_sec, sizeof(int));
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &config.keepalive_interval_sec, sizeof(int));
+            setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &config.keepalive_count, sizeof(int));
+        }
+
+        static const char* reason_of_error(int error) {
+            switch (error) {
+            case ECONNREFUSED:
+                return "refused";
+            case ETIMEDOUT:
+                return "keepalive timed out";
+            case ECONNRESET:
+                return "reset";
+            case EHOSTUNREACH:
+            case ENETUNREACH:
+                return "unreachable";
+            default:
+                return "socket error";
+            }
+        }
+
+        void start_connect(Watch& watch, const EventCallback& on_event, size_t index) {
+            auto now = std::chrono::steady_clock::now();
+            watch.sock = scan_engine::Socket{ AF_INET, SOCK_STREAM, 0 };
+            watch.sock.set_nonblock();
+            set_keepalive(watch.sock.handle());
+
+            watch.stage = Stage::connecting;
+            watch.start = now;
+            watch.deadline = now + std::chrono::milliseconds(config.connect_timeout_millisec);
+
+            int ret = connect(watch.sock.handle(), (struct sockaddr*)&watch.address, sizeof(watch.address));
+            if (ret < 0 && errno != EINPROGRESS) {
+                lost(watch, reason_of_error(errno), on_event, index);
+                return;
+            }
+
+            struct epoll_event ev;
+            ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLERR | EPOLLHUP;
+            ev.data.u64 = index;
+            epoll.add_fd(&ev, watch.sock.handle());
+        }
+
+        void lost(Watch& watch, const char* reason, const EventCallback& on_event, size_t index) {
+            watch.sock.close();
+            auto now = std::chrono::steady_clock::now();
+
+            // a connection which was up gets one quick retry before it counts as down, no sooner
+            // than the minimum backoff after the last connect, for services which close at once.
+            if (watch.stage == Stage::connected) {
+                watch.grace = true;
+                watch.stage = Stage::idle;
+                watch.deadline = std::max(now, watch.start + std::chrono::milliseconds(config.backoff_min_millisec));
+                return;
+            }
+
+            if (watch.reported_up || watch.backoff_millisec == 0) {
+                on_event(MonitorEvent{ index, Status::down, reason, 0 });
+                watch.reported_up = false;
+            }
+
+            watch.grace = false;
+            watch.backoff_millisec = (watch.backoff_millisec == 0 ? config.backoff_min_millisec
+                                                                  : std::min(watch.backoff_millisec * 2, config.backoff_max_millisec));
+            watch.stage = Stage::idle;
+            watch.deadline = now + std::chrono::milliseconds(watch.backoff_millisec);
+        }
+
+        void connected(Watch& watch, const EventCallback& on_event, size_t index) {
+            auto now = std::chrono::steady_clock::now();
+            int rtt = (int)std::chrono::duration_cast<std::chrono::microseconds>(now - watch.start).count();
+
+            // from now on only the end of the connection is of interest.
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP;
+            ev.data.u64 = index;
+            epoll.mod_fd(&ev, watch.sock.handle());
+
+            watch.stage = Stage::connected;
+            watch.backoff_millisec = 0;
+            if (watch.grace) {
+                ++reconnects;
+                watch.grace = false;
+            }
+            if (!watch.reported_up) {
+                on_event(MonitorEvent{ index, Status::up, "connected", rtt });
+                watch.reported_up = true;
+            }
+        }
+
+        void handle(Watch& watch, uint32_t events, const EventCallback& on_event, size_t index) {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            getsockopt(watch.sock.handle(), SOL_SOCKET, SO_ERROR, &error, &len);
+
+            if (watch.stage == Stage::connecting) {
+                if (error == 0 && (events & EPOLLOUT) && !(events & (EPOLLERR | EPOLLHUP))) {
+                    connected(watch, on_event, index);
+                }
+                else {
+                    lost(watch, reason_of_error(error), on_event, index);
+                }
+                return;
+            }
+
+            if (events & EPOLLERR) {
+                lost(watch, reason_of_error(error), on_event, index);
+                return;
+            }
+
+            // whatever the service sends is dropped, its eof is the loss.
+            if (events & EPOLLIN) {
+                char buf[1024];
+                ssize_t n = recv(watch.sock.handle(), buf, sizeof(buf), 0);
+                if (n > 0 || (n < 0 && (errno == EAGAIN || errno == EINTR))) {
+                    return;
+                }
+                if (n < 0) {
+                    lost(watch, reason_of_error(errno), on_event, index);
+                    return;
+                }
+            }
+
+            if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+                lost(watch, "closed by peer", on_event, index);
+            }
+        }
+    public:
+        ConnectionMonitor(const std::vector<Target>& targets, const MonitorConfig& _config)
+            : config{ _config }, watches(targets.size()), epoll{}, reconnects{ 0 }
+        {
+            auto now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < targets.size(); ++i) {
+                Watch& watch = watches[i];
+                watch.target = targets[i];
+                watch.stage = Stage::idle;
+                watch.reported_up = false;
+                watch.grace = false;
+                watch.backoff_millisec = 0;
+                watch.deadline = now;
+
+                std::memset(&watch.address, 0, sizeof(watch.address));
+                watch.address.sin_family = AF_INET;
+                watch.address.sin_port = htons(targets[i].port);
+                if (inet_pton(AF_INET, targets[i].ip.c_str(), &watch.address.sin_addr) != 1) {
+                    throw std::system_error{ std::make_error_code(std::errc::invalid_argument), "bad monitor address " + targets[i].ip };
+                }
+            }
+        }
+
+        // watches until `stop` is set, every change of a target is one event.
+        void run(const std::atomic<bool>& stop, const EventCallback& on_event) {
+            std::vector<struct epoll_event> events(std::max<size_t>(watches.size(), 1));
+
+            while (!stop.load(std::memory_order_relaxed)) {
+                auto now = std::chrono::steady_clock::now();
+                auto next = now + std::chrono::milliseconds(200);     // the stop flag is checked as often.
+
+                for (size_t i = 0; i < watches.size(); ++i) {
+                    Watch& watch = watches[i];
+                    if (watch.stage == Stage::connected) {
+                        continue;
+                    }
+                    if (watch.deadline <= now) {
+                        if (watch.stage == Stage::connecting) {
+                            lost(watch, "connect timed out", on_event, i);
+                        }
+                        else {
+                            start_connect(watch, on_event, i);
+                        }
+                    }
+                    next = std::min(next, watch.deadline);
+                }
+
+                int wait_millisec = (int)std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+                int nfds = epoll_wait(epoll.handle(), events.data(), events.size(), std::max(wait_millisec, 0));
+                if (nfds < 0 && errno != EINTR) {
+                    std::error_code ec(errno, std::system_category());
+                    throw std::system_error{ ec, "sys call epoll_wait failed" };
+                }
+
+                for (int i = 0; i < nfds; ++i) {
+                    size_t index = (size_t)events[i].data.u64;
+                    handle(watches[index], events[i].events, on_event, index);
+                }
+            }
+        }
+
+        const Target& target(size_t index) const {
+            return watches[index].target;
+        }
+
+        // connections lost and made again at once, which never counted as down.
+        uint64_t quick_reconnects() const {
+            return reconnects;
+        }
+    };
+}
@@ -0,0 +1,381 @@
+#pragma once
+
+// @brief  file output sink, the scan loop only appends to an in-memory frame,
+//         full frames are compressed and written by a dedicated thread. at most
+//         `max_pending` full frames wait for it, then the scan loop waits for the disk.
+//         with zstd (build with -DPORT_SCANNER_WITH_ZSTD -lzstd), the file follows the
+//         zstd seekable format: independent frames plus a seek table in a trailing
+//         skippable frame, so `zstd -d` reads it as usual and `SeekableZstdReader`
+//         decompresses only the frames covering a requested offset.
+#include <stdexcept>
+#include <exception>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#ifdef PORT_SCANNER_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace output_sink {
+    class SinkException : public std::runtime_error {
+    public:
+        SinkException(const std::string& msg)
+            : std::runtime_error{ "output sink error: " + msg }
+        {}
+    };
+
+    const uint32_t skippable_magic = 0x184D2A5E;
+    const uint32_t seekable_magic = 0x8F92EAB1;
+
+    // level 0 writes plain text, other levels are zstd levels.
+    class OutputSink {
+        struct SeekEntry {
+            uint32_t compressed_size;
+            uint32_t decompressed_size;
+        };
+
+        FILE* file;
+        int level;
+        size_t frame_size;
+        size_t max_pending;
+
+        std::string frame;      // owned by the scan thread.
+
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::condition_variable drained;    // a frame left `pending`, or the writer stopped.
+        std::deque<std::string> pending;
+        bool stopping;
+        std::exception_ptr error;   // the first failure of the writer thread.
+
+        std::vector<SeekEntry> seek_table;      // owned by the writer thread.
+        std::thread writer;
+
+        void write_file(const void* bytes, size_t n) {
+            if (fwrite(bytes, 1, n, file) != n) {
+                throw SinkException{ "fwrite failed" };
+            }
+        }
+
+        void write_u32(uint32_t value) {
+            uint8_t bytes[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+            write_file(bytes, 4);
+        }
+
+        void write_frame(const std::string& data, std::vector<char>& scratch, void* cctx) {
+            if (level == 0) {
+                write_file(data.data(), data.size());
+                return;
+            }
+
+#ifdef PORT_SCANNER_WITH_ZSTD
+            scratch.resize(ZSTD_compressBound(data.size()));
+            size_t n = ZSTD_compressCCtx((ZSTD_CCtx*)cctx, scratch.data(), scratch.size(), data.data(), data.size(), level);
+            if (ZSTD_isError(n)) {
+                throw SinkException{ ZSTD_getErrorName(n) };
+            }
+
+            write_file(scratch.data(), n);
+            seek_table.emplace_back(SeekEntry{ (uint32_t)n, (uint32_t)data.size() });
+#else
+            (void)scratch;
+            (void)cctx;
+#endif
+        }
+
+        void write_seek_table() {
+            write_u32(skippable_magic);
+            write_u32((uint32_t)(seek_table.size() * 8 + 9));
+
+            for (const auto& entry : seek_table) {
+                write_u32(entry.compressed_size);
+                write_u32(entry.decompressed_size);
+            }
+
+            uint8_t descriptor = 0;     // no checksums.
+            write_u32((uint32_t)seek_table.size());
+            write_file(&descriptor, 1);
+            write_u32(seekable_magic);
+        }
+
+        void writer_loop() {
+            void* cctx = nullptr;
+#ifdef PORT_SCANNER_WITH_ZSTD
+            cctx = ZSTD_createCCtx();
+#endif
+            std::vector<char> scratch;
+
+            try {
+                while (true) {
+                    std::string data;
+                    {
+                        std::unique_lock<std::mutex> lock{ mtx };
+                        cv.wait(lock, [this] { return stopping || !pending.empty(); });
+
+                        if (pending.empty()) {
+                            break;
+                        }
+
+                        data.swap(pending.front());
+                        pending.pop_front();
+                        drained.notify_one();
+                    }
+
+                    write_frame(data, scratch, cctx);
+                }
+
+                if (level != 0) {
+                    write_seek_table();
+                }
+            }
+            catch (const SinkException&) {
+                std::lock_guard<std::mutex> lock{ mtx };
+                error = std::current_exception();
+                drained.notify_one();
+            }
+
+#ifdef PORT_SCANNER_WITH_ZSTD
+            ZSTD_freeCCtx((ZSTD_CCtx*)cctx);
+#endif
+        }
+
+        void submit_frame() {
+            if (frame.empty()) {
+                return;
+            }
+
+            std::string full;
+            full.reserve(frame_size);
+            full.swap(frame);
+
+            std::unique_lock<std::mutex> lock{ mtx };
+            drained.wait(lock, [this] { return pending.size() < max_pending || error; });
+
+            // the writer stopped at its first error, what is left would never reach the file.
+            if (error) {
+                std::rethrow_exception(error);
+            }
+
+            pending.emplace_back(std::move(full));
+            cv.notify_one();
+        }
+    public:
+        OutputSink(const std::string& filePath, int _level, size_t _frame_size = 1 << 20, size_t _max_pending = 8)
+            : file{ nullptr }, level{ _level }, frame_size{ _frame_size }, max_pending{ _max_pending }, frame{}, mtx{}, cv{},
+              drained{}, pending{}, stopping{ false }, error{}, seek_table{}, writer{}
+        {
+#ifndef PORT_SCANNER_WITH_ZSTD
+            if (level != 0) {
+                throw SinkException{ "built without zstd, rebuild with -DPORT_SCANNER_WITH_ZSTD -lzstd" };
+            }
+#endif
+            file = fopen(filePath.c_str(), "wb");
+            if (!file) {
+                throw SinkException{ "open for writing failed: " + filePath };
+            }
+
+            frame.reserve(frame_size);
+            writer = std::thread{ &OutputSink::writer_loop, this };
+        }
+
+        OutputSink(const OutputSink&) = delete;
+        OutputSink& operator=(const OutputSink&) = delete;
+
+        ~OutputSink() {
+            try {
+                close();
+            }
+            catch (...) {}
+        }
+
+        // waits only while `max_pending` frames are queued, throws the error the writer stopped at.
+        void write(const char* bytes, size_t n) {
+            while (n > 0) {
+                size_t chunk = frame_size - frame.size();
+                chunk = (n < chunk ? n : chunk);
+
+                frame.append(bytes, chunk);
+                bytes += chunk;
+                n -= chunk;
+
+                if (frame.size() >= frame_size) {
+                    submit_frame();
+                }
+            }
+        }
+
+        void write(const std::string& str) {
+            write(str.data(), str.size());
+        }
+
+        void close() {
+            if (!file) {
+                return;
+            }
+
+            submit_frame();
+            {
+                std::lock_guard<std::mutex> lock{ mtx };
+                stopping = true;
+                cv.notify_one();
+            }
+
+            writer.join();
+            bool flushed = (fclose(file) == 0);
+            file = nullptr;
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+
+            if (!flushed) {
+                throw SinkException{ "fclose failed" };
+            }
+        }
+    };
+
+#ifdef PORT_SCANNER_WITH_ZSTD
+    // random access into a file written by a zstd `OutputSink`.
+    class SeekableZstdReader {
+        struct Frame {
+            uint64_t compressed_offset;
+            uint64_t decompressed_offset;
+            uint32_t compressed_size;
+            uint32_t decompressed_size;
+        };
+
+        FILE* file;
+        std::vector<Frame> frames;
+        ZSTD_DCtx* dctx;
+
+        static uint32_t read_u32(const uint8_t* bytes) {
+            return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+        }
+
+        void read_at(uint64_t offset, void* buf, size_t n) {
+            if (fseeko(file, (off_t)offset, SEEK_SET) != 0 || fread(buf, 1, n, file) != n) {
+                throw SinkException{ "read failed" };
+            }
+        }
+
+        void load_seek_table() {
+            if (fseeko(file, 0, SEEK_END) != 0) {
+                throw SinkException{ "seek failed" };
+            }
+
+            uint64_t file_size = (uint64_t)ftello(file);
+            if (file_size < 17) {
+                throw SinkException{ "not a seekable zstd file" };
+            }
+
+            uint8_t footer[9];
+            read_at(file_size - 9, footer, 9);
+
+            uint32_t count = read_u32(footer);
+            bool has_checksum = (footer[4] & 0x80) != 0;
+            size_t entry_size = (has_checksum ? 12 : 8);
+            uint64_t table_size = 8 + (uint64_t)count * entry_size + 9;
+
+            if (read_u32(footer + 5) != seekable_magic || table_size > file_size) {
+                throw SinkException{ "not a seekable zstd file" };
+            }
+
+            std::vector<uint8_t> table(count * entry_size);
+            read_at(file_size - table_size + 8, table.data(), table.size());
+
+            uint64_t compressed_offset = 0;
+            uint64_t decompressed_offset = 0;
+            for (uint32_t i = 0; i < count; ++i) {
+                Frame frame;
+                frame.compressed_offset = compressed_offset;
+                frame.decompressed_offset = decompressed_offset;
+                frame.compressed_size = read_u32(table.data() + i * entry_size);
+                frame.decompressed_size = read_u32(table.data() + i * entry_size + 4);
+                frames.emplace_back(frame);
+
+                compressed_offset += frame.compressed_size;
+                decompressed_offset += frame.decompressed_size;
+            }
+        }
+    public:
+        SeekableZstdReader(const std::string& filePath)
+            : file{ fopen(filePath.c_str(), "rb") }, frames{}, dctx{ nullptr }
+        {
+            if (!file) {
+                throw SinkException{ "open for reading failed: " + filePath };
+            }
+
+            try {
+                load_seek_table();
+            }
+            catch (...) {
+                fclose(file);
+                throw;
+            }
+
+            dctx = ZSTD_createDCtx();
+        }
+
+        SeekableZstdReader(const SeekableZstdReader&) = delete;
+        SeekableZstdReader& operator=(const SeekableZstdReader&) = delete;
+
+        ~SeekableZstdReader() {
+            ZSTD_freeDCtx(dctx);
+            fclose(file);
+        }
+
+        uint64_t size() const {
+            return frames.empty() ? 0 : frames.back().decompressed_offset + frames.back().decompressed_size;
+        }
+
+        // reads up to `n` decompressed bytes at `offset`, returns the count read.
+        size_t read(uint64_t offset, char* buf, size_t n) {
+            size_t done = 0;
+            std::vector<char> compressed;
+            std::vector<char> decompressed;
+
+            // binary search the first frame which covers `offset`.
+            size_t lo = 0;
+            size_t hi = frames.size();
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (frames[mid].decompressed_offset + frames[mid].decompressed_size <= offset) {
+                    lo = mid + 1;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+
+            for (size_t i = lo; i < frames.size() && done < n; ++i) {
+                const Frame& frame = frames[i];
+
+                compressed.resize(frame.compressed_size);
+                decompressed.resize(frame.decompressed_size);
+                read_at(frame.compressed_offset, compressed.data(), compressed.size());
+
+                size_t ret = ZSTD_decompressDCtx(dctx, decompressed.data(), decompressed.size(), compressed.data(), compressed.size());
+                if (ZSTD_isError(ret)) {
+                    throw SinkException{ ZSTD_getErrorName(ret) };
+                }
+
+                uint64_t skip = (offset + done) - frame.decompressed_offset;
+                size_t chunk = (size_t)(frame.decompressed_size - skip);
+                chunk = (n - done < chunk ? n - done : chunk);
+
+                std::memcpy(buf + done, decompressed.data() + skip, chunk);
+                done += chunk;
+            }
+
+            return done;
+        }
+    };
+#endif
+}
@@ -0,0 +1,632 @@
+#pragma once
+
+// @brief  inverted index from port to the set of hosts which have it opened.
+//         host sets are compressed bitmaps over host ids: each 65536-id chunk is
+//         kept as a sorted array while sparse, and as a plain bitmap once dense.
+#include <stdexcept>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdint>
+#include <cctype>
+
+namespace port_index {
+    class IndexFileException : public std::runtime_error {
+    public:
+        IndexFileException(const std::string& msg)
+            : std::runtime_error{ "index file error: " + msg }
+        {}
+    };
+
+    class QueryParseException : public std::runtime_error {
+    public:
+        QueryParseException(const std::string& msg)
+            : std::runtime_error{ "query parse error: " + msg }
+        {}
+    };
+
+    // the index holds no answer for a port the scan never probed.
+    class UnscannedPortException : public std::runtime_error {
+    public:
+        UnscannedPortException(int port)
+            : std::runtime_error{ "port " + std::to_string(port) + " was not scanned, its state is unknown" }
+        {}
+    };
+
+    namespace detail {
+        template<typename T>
+        void write_pod(std::ostream& out, const T& value) {
+            out.write((const char*)&value, sizeof(value));
+        }
+
+        template<typename T>
+        void read_pod(std::istream& in, T& value) {
+            if (!in.read((char*)&value, sizeof(value))) {
+                throw IndexFileException{ "unexpected end of file" };
+            }
+        }
+
+        template<typename T>
+        void write_vector(std::ostream& out, const std::vector<T>& v) {
+            write_pod(out, (uint32_t)v.size());
+            out.write((const char*)v.data(), v.size() * sizeof(T));
+        }
+
+        template<typename T>
+        void read_vector(std::istream& in, std::vector<T>& v, size_t max_size) {
+            uint32_t size = 0;
+            read_pod(in, size);
+            if (size > max_size) {
+                throw IndexFileException{ "corrupted bitmap container" };
+            }
+
+            v.resize(size);
+            if (!in.read((char*)v.data(), size * sizeof(T))) {
+                throw IndexFileException{ "unexpected end of file" };
+            }
+        }
+    }
+
+    // compressed set of 32 bits host ids.
+    class HostBitmap {
+        static const size_t array_limit = 4096;     // above this, a bitmap is smaller.
+        static const size_t bitmap_words = 1024;    // 65536 bits.
+
+        struct Container {
+            uint16_t key;
+            std::vector<uint16_t> array;    // sorted, used while the chunk is sparse.
+            std::vector<uint64_t> bits;     // used once the chunk is dense.
+
+            bool is_bitmap() const {
+                return !bits.empty();
+            }
+
+            size_t cardinality() const {
+                if (!is_bitmap()) {
+                    return array.size();
+                }
+
+                size_t n = 0;
+                for (uint64_t w : bits) {
+                    n += __builtin_popcountll(w);
+                }
+                return n;
+            }
+
+            std::vector<uint64_t> to_bits() const {
+                if (is_bitmap()) {
+                    return bits;
+                }
+
+                std::vector<uint64_t> result((size_t)bitmap_words, 0);
+                for (uint16_t low : array) {
+                    result[low >> 6] |= (uint64_t)1 << (low & 63);
+                }
+                return result;
+            }
+
+            // pick the smaller representation.
+            void normalize(std::vector<uint64_t>& words) {
+                size_t n = 0;
+                for (uint64_t w : words) {
+                    n += __builtin_popcountll(w);
+                }
+
+                array.clear();
+                bits.clear();
+
+                if (n > array_limit) {
+                    bits.swap(words);
+                    return;
+                }
+
+                array.reserve(n);
+                for (size_t i = 0; i < words.size(); ++i) {
+                    uint64_t w = words[i];
+                    while (w) {
+                        array.emplace_back((uint16_t)(i * 64 + __builtin_ctzll(w)));
+                        w &= w - 1;
+                    }
+                }
+            }
+        };
+
+        std::vector<Container> containers;  // sorted by key, never empty containers.
+
+        Container* find_container(uint16_t key, bool create) {
+            auto it = std::lower_bound(containers.begin(), containers.end(), key,
+                [](const Container& c, uint16_t k) { return c.key < k; });
+
+            if (it != containers.end() && it->key == key) {
+                return &*it;
+            }
+
+            if (!create) {
+                return nullptr;
+            }
+
+            Container c;
+            c.key = key;
+            return &*containers.insert(it, std::move(c));
+        }
+
+        const Container* find_container(uint16_t key) const {
+            auto it = std::lower_bound(containers.begin(), containers.end(), key,
+                [](const Container& c, uint16_t k) { return c.key < k; });
+
+            if (it != containers.end() && it->key == key) {
+                return &*it;
+            }
+            return nullptr;
+        }
+
+        enum class Op { op_and, op_or, op_andnot };
+
+        static HostBitmap combine(const HostBitmap& a, const HostBitmap& b, Op op) {
+            HostBitmap result;
+            size_t i = 0;
+            size_t j = 0;
+
+            while (i < a.containers.size() || j < b.containers.size()) {
+                const Container* ca = (i < a.containers.size() ? &a.containers[i] : nullptr);
+                const Container* cb = (j < b.containers.size() ? &b.containers[j] : nullptr);
+
+                if (ca && (!cb || ca->key < cb->key)) {
+                    if (op != Op::op_and) {
+                        result.containers.emplace_back(*ca);
+                    }
+                    ++i;
+                    continue;
+                }
+
+                if (cb && (!ca || cb->key < ca->key)) {
+                    if (op == Op::op_or) {
+                        result.containers.emplace_back(*cb);
+                    }
+                    ++j;
+                    continue;
+                }
+
+                // same key on both sides.
+                std::vector<uint64_t> wa = ca->to_bits();
+                std::vector<uint64_t> wb = cb->to_bits();
+
+                for (size_t k = 0; k < bitmap_words; ++k) {
+                    switch (op) {
+                        case Op::op_and:    wa[k] &= wb[k];  break;
+                        case Op::op_or:     wa[k] |= wb[k];  break;
+                        case Op::op_andnot: wa[k] &= ~wb[k]; break;
+                    }
+                }
+
+                Container c;
+                c.key = ca->key;
+                c.normalize(wa);
+                if (!c.array.empty() || c.is_bitmap()) {
+                    result.containers.emplace_back(std::move(c));
+                }
+
+                ++i;
+                ++j;
+            }
+
+            return result;
+        }
+    public:
+        HostBitmap() {}
+
+        // all ids in [0, n).
+        static HostBitmap range(uint32_t n) {
+            HostBitmap result;
+            for (uint32_t id = 0; id < n; ++id) {
+                result.add(id);
+            }
+            return result;
+        }
+
+        void add(uint32_t id) {
+            Container* c = find_container((uint16_t)(id >> 16), true);
+            uint16_t low = (uint16_t)(id & 0xFFFF);
+
+            if (c->is_bitmap()) {
+                c->bits[low >> 6] |= (uint64_t)1 << (low & 63);
+                return;
+            }
+
+            auto it = std::lower_bound(c->array.begin(), c->array.end(), low);
+            if (it != c->array.end() && *it == low) {
+                return;
+            }
+
+            c->array.insert(it, low);
+            if (c->array.size() > array_limit) {
+                std::vector<uint64_t> words = c->to_bits();
+                c->normalize(words);
+            }
+        }
+
+        bool contains(uint32_t id) const {
+            const Container* c = find_container((uint16_t)(id >> 16));
+            if (!c) {
+                return false;
+            }
+
+            uint16_t low = (uint16_t)(id & 0xFFFF);
+            if (c->is_bitmap()) {
+                return (c->bits[low >> 6] >> (low & 63)) & 1;
+            }
+            return std::binary_search(c->array.begin(), c->array.end(), low);
+        }
+
+        bool empty() const {
+            return containers.empty();
+        }
+
+        size_t cardinality() const {
+            size_t n = 0;
+            for (const auto& c : containers) {
+                n += c.cardinality();
+            }
+            return n;
+        }
+
+        template<typename Func>
+        void for_each(Func func) const {
+            for (const auto& c : containers) {
+                uint32_t high = (uint32_t)c.key << 16;
+
+                if (!c.is_bitmap()) {
+                    for (uint16_t low : c.array) {
+                        func(high | low);
+                    }
+                    continue;
+                }
+
+                for (size_t i = 0; i < c.bits.size(); ++i) {
+                    uint64_t w = c.bits[i];
+                    while (w) {
+                        func(high | (uint32_t)(i * 64 + __builtin_ctzll(w)));
+                        w &= w - 1;
+                    }
+                }
+            }
+        }
+
+        HostBitmap operator&(const HostBitmap& other) const {
+            return combine(*this, other, Op::op_and);
+        }
+
+        HostBitmap operator|(const HostBitmap& other) const {
+            return combine(*this, other, Op::op_or);
+        }
+
+        HostBitmap operator-(const HostBitmap& other) const {
+            return combine(*this, other, Op::op_andnot);
+        }
+
+        void save(std::ostream& out) const {
+            detail::write_pod(out, (uint32_t)containers.size());
+            for (const auto& c : containers) {
+                detail::write_pod(out, c.key);
+                detail::write_pod(out, (uint8_t)(c.is_bitmap() ? 1 : 0));
+
+                if (c.is_bitmap()) {
+                    detail::write_vector(out, c.bits);
+                }
+                else {
+                    detail::write_vector(out, c.array);
+                }
+            }
+        }
+
+        void load(std::istream& in) {
+            uint32_t count = 0;
+            detail::read_pod(in, count);
+            if (count > 65536) {
+                throw IndexFileException{ "corrupted bitmap" };
+            }
+
+            containers.clear();
+            containers.resize(count);
+
+            for (auto& c : containers) {
+                uint8_t is_bitmap = 0;
+                detail::read_pod(in, c.key);
+                detail::read_pod(in, is_bitmap);
+
+                if (is_bitmap) {
+                    detail::read_vector(in, c.bits, bitmap_words);
+                    if (c.bits.size() != bitmap_words) {
+                        throw IndexFileException{ "corrupted bitmap container" };
+                    }
+                }
+                else {
+                    detail::read_vector(in, c.array, array_limit);
+                }
+            }
+        }
+    };
+
+    // port -> hosts which have that port opened.
+    class PortIndex {
+        static const uint32_t file_magic = 0x58495350;     // "PSIX".
+        static const uint32_t file_version = 2;
+
+        std::vector<std::string> hosts;
+        std::map<std::string, uint32_t> host_ids;
+        std::vector<HostBitmap> opened;     // indexed by port.
+        std::vector<bool> scanned;          // indexed by port, only these have a known state.
+    public:
+        PortIndex() : hosts{}, host_ids{}, opened(65536), scanned(65536, false) {}
+
+        uint32_t add_host(const std::string& host) {
+            auto it = host_ids.find(host);
+            if (it != host_ids.end()) {
+                return it->second;
+            }
+
+            uint32_t id = (uint32_t)hosts.size();
+            hosts.emplace_back(host);
+            host_ids.emplace(host, id);
+            return id;
+        }
+
+        void record_scanned(int port) {
+            scanned[port] = true;
+        }
+
+        bool was_scanned(int port) const {
+            return scanned[port];
+        }
+
+        // called for each streamed result, the index stays queryable during the scan.
+        void record_opened(uint32_t host_id, int port) {
+            opened[port].add(host_id);
+        }
+
+        size_t host_count() const {
+            return hosts.size();
+        }
+
+        const std::string& host_name(uint32_t id) const {
+            return hosts[id];
+        }
+
+        const HostBitmap& opened_hosts(int port) const {
+            return opened[port];
+        }
+
+        // a host counts as closed for a port when it is indexed but never seen opened,
+        // which only holds for the ports the scan probed.
+        HostBitmap closed_hosts(int port) const {
+            if (!scanned[port]) {
+                throw UnscannedPortException{ port };
+            }
+            return HostBitmap::range((uint32_t)hosts.size()) - opened[port];
+        }
+
+        HostBitmap all_hosts() const {
+            return HostBitmap::range((uint32_t)hosts.size());
+        }
+
+        void save(const std::string& filePath) const {
+            std::ofstream out{ filePath, std::ios::binary };
+            if (!out.is_open()) {
+                throw IndexFileException{ "open for writing failed: " + filePath };
+            }
+
+            detail::write_pod(out, (uint32_t)file_magic);
+            detail::write_pod(out, (uint32_t)file_version);
+            detail::write_pod(out, (uint32_t)hosts.size());
+
+            for (const auto& host : hosts) {
+                detail::write_pod(out, (uint32_t)host.size());
+                out.write(host.data(), host.size());
+            }
+
+            std::vector<uint16_t> scanned_ports;
+            for (int port = 0; port < (int)scanned.size(); ++port) {
+                if (scanned[port]) {
+                    scanned_ports.emplace_back((uint16_t)port);
+                }
+            }
+            detail::write_vector(out, scanned_ports);
+
+            for (int port = 0; port < (int)opened.size(); ++port) {
+                if (!opened[port].empty()) {
+                    detail::write_pod(out, (uint32_t)port);
+                    opened[port].save(out);
+                }
+            }
+
+            if (!out) {
+                throw IndexFileException{ "write failed: " + filePath };
+            }
+        }
+
+        void load(const std::string& filePath) {
+            std::ifstream in{ filePath, std::ios::binary };
+            if (!in.is_open()) {
+                throw IndexFileException{ "open for reading failed: " + filePath };
+            }
+
+            uint32_t magic = 0;
+            uint32_t version = 0;
+            uint32_t host_count = 0;
+            detail::read_pod(in, magic);
+            detail::read_pod(in, version);
+
+            if (magic != file_magic) {
+                throw IndexFileException{ "not an index file: " + filePath };
+            }
+
+            // version 1 has no scanned port set, its closed answers cannot be trusted.
+            if (version != file_version) {
+                throw IndexFileException{ "unsupported index version " + std::to_string(version) + ", scan again: " + filePath };
+            }
+
+            hosts.clear();
+            host_ids.clear();
+            opened.assign(65536, HostBitmap{});
+            scanned.assign(65536, false);
+
+            detail::read_pod(in, host_count);
+            for (uint32_t i = 0; i < host_count; ++i) {
+                uint32_t size = 0;
+                detail::read_pod(in, size);
+
+                std::string host(size, '\0');
+                if (!in.read(&host[0], size)) {
+                    throw IndexFileException{ "unexpected end of file" };
+                }
+                add_host(host);
+            }
+
+            std::vector<uint16_t> scanned_ports;
+            detail::read_vector(in, scanned_ports, 65536);
+            for (uint16_t port : scanned_ports) {
+                scanned[port] = true;
+            }
+
+            uint32_t port = 0;
+            while (in.read((char*)&port, sizeof(port))) {
+                if (port > 65535) {
+                    throw IndexFileException{ "corrupted port entry" };
+                }
+                opened[port].load(in);
+            }
+        }
+
+    };
+
+    // evaluates set expressions over the index, like "22 open and (80 closed or not 443)".
+    // a bare port means "open", operators: and/&, or/|, not/!, parentheses.
+    class Query {
+        const PortIndex& index;
+        std::vector<std::string> tokens;
+        size_t pos;
+
+        static std::vector<std::string> tokenize(const std::string& expr) {
+            std::vector<std::string> result;
+            size_t i = 0;
+
+            while (i < expr.length()) {
+                if (isspace(expr[i])) {
+                    ++i;
+                }
+                else if (expr[i] == '(' || expr[i] == ')' || expr[i] == '!') {
+                    result.emplace_back(1, expr[i]);
+                    ++i;
+                }
+                else if (expr[i] == '&' || expr[i] == '|') {
+                    char op = expr[i];
+                    while (i < expr.length() && expr[i] == op) {
+                        ++i;
+                    }
+                    result.emplace_back(op == '&' ? "and" : "or");
+                }
+                else {
+                    size_t start = i;
+                    while (i < expr.length() && isalnum(expr[i])) {
+                        ++i;
+                    }
+
+                    if (start == i) {
+                        throw QueryParseException{ std::string{ "unexpected character '" } + expr[i] + "'" };
+                    }
+
+                    std::string word = expr.substr(start, i - start);
+                    std::transform(word.begin(), word.end(), word.begin(), ::tolower);
+                    result.emplace_back(word);
+                }
+            }
+
+            return result;
+        }
+
+        bool accept(const char* token) {
+            if (pos < tokens.size() && tokens[pos] == token) {
+                ++pos;
+                return true;
+            }
+            return false;
+        }
+
+        HostBitmap parse_or() {
+            HostBitmap result = parse_and();
+            while (accept("or")) {
+                result = result | parse_and();
+            }
+            return result;
+        }
+
+        HostBitmap parse_and() {
+            HostBitmap result = parse_not();
+            while (accept("and")) {
+                result = result & parse_not();
+            }
+            return result;
+        }
+
+        HostBitmap parse_not() {
+            if (accept("not") || accept("!")) {
+                return index.all_hosts() - parse_not();
+            }
+            return parse_primary();
+        }
+
+        HostBitmap parse_primary() {
+            if (accept("(")) {
+                HostBitmap result = parse_or();
+                if (!accept(")")) {
+                    throw QueryParseException{ "missing ')'" };
+                }
+                return result;
+            }
+
+            if (pos >= tokens.size()) {
+                throw QueryParseException{ "unexpected end of expression" };
+            }
+
+            const std::string& token = tokens[pos++];
+            int port = 0;
+            for (char c : token) {
+                if (!isdigit(c) || port > 65535) {
+                    throw QueryParseException{ "expected a port, got '" + token + "'" };
+                }
+                port = 10 * port + (c - '0');
+            }
+
+            if (port > 65535) {
+                throw QueryParseException{ "port out of range: " + token };
+            }
+
+            // "not 443" over a port never probed would match every host.
+            if (!index.was_scanned(port)) {
+                throw UnscannedPortException{ port };
+            }
+
+            if (accept("closed")) {
+                return index.closed_hosts(port);
+            }
+
+            accept("open");
+            return index.opened_hosts(port);
+        }
+    public:
+        Query(const PortIndex& _index) : index(_index), tokens{}, pos{ 0 } {}
+
+        HostBitmap evaluate(const std::string& expr) {
+            tokens = tokenize(expr);
+            pos = 0;
+
+            HostBitmap result = parse_or();
+            if (pos != tokens.size()) {
+                throw QueryParseException{ "unexpected token '" + tokens[pos] + "'" };
+            }
+            return result;
+        }
+    };
+}
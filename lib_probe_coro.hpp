@@ -0,0 +1,521 @@
+#pragma once
+
+// @brief  c++20 coroutine probes on top of an epoll loop, linux only, build with -std=c++20.
+//         a probe is a plain coroutine which co_awaits connect / read / write with a timeout,
+//         so multi-step probes (connect, read greeting, send request, read reply) read top
+//         to bottom instead of as a state machine. coroutine frames come from a slab pool,
+//         and waiting needs no allocation: the awaitable lives in the suspended frame and
+//         is linked into an intrusive timer heap.
+#if __cplusplus >= 202002L
+
+#include <coroutine>
+#include <system_error>
+#include <exception>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "lib_scan_engine.hpp"
+#include "lib_scan_engine_epoll.hpp"
+
+namespace probe_coro {
+    // slab allocator for coroutine frames, one free list per 64 bytes size class.
+    // blocks are never returned to the system while the pool lives, so a steady
+    // stream of probes allocates nothing after warm up.
+    class FramePool {
+        static const size_t granularity = 64;
+        static const size_t max_pooled = 4096;
+        static const size_t blocks_per_slab = 256;
+
+        struct FreeBlock {
+            FreeBlock* next;
+        };
+
+        std::vector<FreeBlock*> free_lists;
+        std::vector<char*> slabs;
+
+        static size_t size_class(size_t n) {
+            return (n + granularity - 1) / granularity;
+        }
+
+        void refill(size_t cls) {
+            size_t block_size = cls * granularity;
+            char* slab = static_cast<char*>(::operator new(block_size * blocks_per_slab));
+            slabs.emplace_back(slab);
+
+            for (size_t i = 0; i < blocks_per_slab; ++i) {
+                FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + i * block_size);
+                block->next = free_lists[cls];
+                free_lists[cls] = block;
+            }
+        }
+    public:
+        FramePool() : free_lists(max_pooled / granularity + 1, nullptr), slabs{} {}
+
+        FramePool(const FramePool&) = delete;
+        FramePool& operator=(const FramePool&) = delete;
+
+        ~FramePool() {
+            for (char* slab : slabs) {
+                ::operator delete(slab);
+            }
+        }
+
+        static FramePool& local() {
+            static thread_local FramePool pool;
+            return pool;
+        }
+
+        void* allocate(size_t n) {
+            if (n > max_pooled) {
+                return ::operator new(n);
+            }
+
+            size_t cls = size_class(n);
+            if (!free_lists[cls]) {
+                refill(cls);
+            }
+
+            FreeBlock* block = free_lists[cls];
+            free_lists[cls] = block->next;
+            return block;
+        }
+
+        void deallocate(void* p, size_t n) {
+            if (n > max_pooled) {
+                ::operator delete(p);
+                return;
+            }
+
+            size_t cls = size_class(n);
+            FreeBlock* block = static_cast<FreeBlock*>(p);
+            block->next = free_lists[cls];
+            free_lists[cls] = block;
+        }
+    };
+
+    class CoroLoop;
+
+    // base of every awaitable, a suspended coroutine waiting for an fd or its deadline.
+    struct Waiter {
+        CoroLoop* loop;
+        int fd;
+        uint32_t events;
+        int64_t deadline;       // steady clock, milliseconds.
+        size_t heap_index;
+        int result;             // 0, or a negative errno, -ETIMEDOUT on timeout.
+        std::coroutine_handle<> handle;
+    };
+
+    class CoroLoop {
+        scan_engine::Epoll epoll;
+        std::vector<Waiter*> timers;    // intrusive min heap on deadline.
+        std::vector<struct epoll_event> events;
+        std::exception_ptr failure;     // the first exception which escaped a probe.
+
+        bool earlier(size_t a, size_t b) const {
+            return timers[a]->deadline < timers[b]->deadline;
+        }
+
+        void swap_timers(size_t a, size_t b) {
+            std::swap(timers[a], timers[b]);
+            timers[a]->heap_index = a;
+            timers[b]->heap_index = b;
+        }
+
+        void sift_up(size_t i) {
+            while (i > 0 && earlier(i, (i - 1) / 2)) {
+                swap_timers(i, (i - 1) / 2);
+                i = (i - 1) / 2;
+            }
+        }
+
+        void sift_down(size_t i) {
+            while (true) {
+                size_t smallest = i;
+                size_t left = 2 * i + 1;
+                size_t right = 2 * i + 2;
+
+                if (left < timers.size() && earlier(left, smallest)) {
+                    smallest = left;
+                }
+                if (right < timers.size() && earlier(right, smallest)) {
+                    smallest = right;
+                }
+                if (smallest == i) {
+                    return;
+                }
+
+                swap_timers(i, smallest);
+                i = smallest;
+            }
+        }
+
+        void remove_timer(Waiter* w) {
+            size_t i = w->heap_index;
+            swap_timers(i, timers.size() - 1);
+            timers.pop_back();
+
+            if (i < timers.size()) {
+                sift_up(i);
+                sift_down(i);
+            }
+        }
+
+        void complete(Waiter* w, int result) {
+            remove_timer(w);
+            epoll.del_fd(w->fd);
+            w->result = result;
+            w->handle.resume();
+        }
+
+        void rethrow_failure() {
+            if (failure) {
+                std::exception_ptr e = failure;
+                failure = nullptr;
+                std::rethrow_exception(e);
+            }
+        }
+    public:
+        static int64_t now_millisec() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        CoroLoop() : epoll{}, timers{}, events(1024), failure{} {}
+
+        CoroLoop(const CoroLoop&) = delete;
+        CoroLoop& operator=(const CoroLoop&) = delete;
+
+        // probes still waiting when a failure unwinds the scan are destroyed, closing their sockets.
+        ~CoroLoop() {
+            std::vector<Waiter*> waiting;
+            waiting.swap(timers);
+            for (Waiter* w : waiting) {
+                w->handle.destroy();
+            }
+        }
+
+        // a probe threw, e.g. EMFILE from its socket, the next `run_once` rethrows it.
+        void fail(std::exception_ptr e) {
+            if (!failure) {
+                failure = e;
+            }
+        }
+
+        void suspend(Waiter* w) {
+            struct epoll_event ev;
+            ev.events = w->events;
+            ev.data.ptr = w;
+            epoll.add_fd(&ev, w->fd);
+
+            w->heap_index = timers.size();
+            timers.emplace_back(w);
+            sift_up(w->heap_index);
+        }
+
+        bool idle() const {
+            return timers.empty();
+        }
+
+        // waits for one round of events, then resumes every ready or expired coroutine.
+        void run_once() {
+            rethrow_failure();
+            if (timers.empty()) {
+                return;
+            }
+
+            int64_t wait = timers[0]->deadline - now_millisec();
+            int nfds = epoll_wait(epoll.handle(), events.data(), (int)events.size(), (int)(wait > 0 ? wait : 0));
+
+            for (int i = 0; i < nfds; ++i) {
+                complete(static_cast<Waiter*>(events[i].data.ptr), 0);
+            }
+
+            int64_t now = now_millisec();
+            while (!timers.empty() && timers[0]->deadline <= now) {
+                complete(timers[0], -ETIMEDOUT);
+            }
+            rethrow_failure();
+        }
+
+        void run() {
+            while (!idle()) {
+                run_once();
+            }
+            rethrow_failure();
+        }
+    };
+
+    // fire and forget probe coroutine, starts running when called. its first parameter is
+    // the loop, which gets any exception the probe lets escape.
+    struct ProbeTask {
+        struct promise_type {
+            CoroLoop* loop;
+
+            template<typename... Args>
+            promise_type(CoroLoop& _loop, Args&&...) noexcept : loop{ &_loop } {}
+
+            ProbeTask get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { loop->fail(std::current_exception()); }
+
+            static void* operator new(size_t n) {
+                return FramePool::local().allocate(n);
+            }
+
+            static void operator delete(void* p, size_t n) {
+                FramePool::local().deallocate(p, n);
+            }
+        };
+    };
+
+    // co_await loop.connect(fd, address, timeout) -> 0 or a negative errno.
+    struct ConnectAwaitable : Waiter {
+        const struct sockaddr_in* address;
+
+        bool await_ready() {
+            int ret = ::connect(fd, (const struct sockaddr*)address, sizeof(*address));
+            if (ret == 0) {
+                result = 0;
+                return true;
+            }
+
+            result = -errno;
+            return errno != EINPROGRESS;
+        }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            loop->suspend(this);
+        }
+
+        int await_resume() {
+            if (result != 0) {
+                return result;
+            }
+
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+                return -errno;
+            }
+            return -error;
+        }
+    };
+
+    // co_await loop.read(fd, buf, len, timeout) -> bytes read, 0 on eof, or a negative errno.
+    struct ReadAwaitable : Waiter {
+        char* buf;
+        size_t len;
+        ssize_t transferred;
+
+        bool await_ready() {
+            transferred = ::recv(fd, buf, len, 0);
+            return transferred >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            loop->suspend(this);
+        }
+
+        ssize_t await_resume() {
+            if (handle && result != 0) {
+                return result;
+            }
+
+            if (handle) {
+                transferred = ::recv(fd, buf, len, 0);
+            }
+            return transferred >= 0 ? transferred : -errno;
+        }
+    };
+
+    // co_await loop.write(fd, buf, len, timeout) -> bytes written or a negative errno.
+    struct WriteAwaitable : Waiter {
+        const char* buf;
+        size_t len;
+        ssize_t transferred;
+
+        bool await_ready() {
+            transferred = ::send(fd, buf, len, MSG_NOSIGNAL);
+            return transferred >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            loop->suspend(this);
+        }
+
+        ssize_t await_resume() {
+            if (handle && result != 0) {
+                return result;
+            }
+
+            if (handle) {
+                transferred = ::send(fd, buf, len, MSG_NOSIGNAL);
+            }
+            return transferred >= 0 ? transferred : -errno;
+        }
+    };
+
+    inline ConnectAwaitable connect(CoroLoop& loop, int fd, const struct sockaddr_in& address, int timeout_millisec) {
+        ConnectAwaitable a{};
+        a.loop = &loop;
+        a.fd = fd;
+        a.events = EPOLLOUT | EPOLLERR | EPOLLHUP;
+        a.deadline = CoroLoop::now_millisec() + timeout_millisec;
+        a.address = &address;
+        return a;
+    }
+
+    inline ReadAwaitable read(CoroLoop& loop, int fd, char* buf, size_t len, int timeout_millisec) {
+        ReadAwaitable a{};
+        a.loop = &loop;
+        a.fd = fd;
+        a.events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP;
+        a.deadline = CoroLoop::now_millisec() + timeout_millisec;
+        a.buf = buf;
+        a.len = len;
+        return a;
+    }
+
+    inline WriteAwaitable write(CoroLoop& loop, int fd, const char* buf, size_t len, int timeout_millisec) {
+        WriteAwaitable a{};
+        a.loop = &loop;
+        a.fd = fd;
+        a.events = EPOLLOUT | EPOLLERR | EPOLLHUP;
+        a.deadline = CoroLoop::now_millisec() + timeout_millisec;
+        a.buf = buf;
+        a.len = len;
+        return a;
+    }
+
+    inline bool make_address(const std::string& ip, int port, struct sockaddr_in& address) {
+        address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        return inet_pton(AF_INET, ip.c_str(), &address.sin_addr) == 1;
+    }
+
+    // connect, wait for a greeting, if the service says nothing send `request` and read the reply.
+    // `on_banner(ret, rtt_micros, banner)` runs once unless the probe throws: `ret` is 0 or the
+    // connect's negative errno, the rtt is the connect's, the banner is empty when none came.
+    template<typename Callback>
+    ProbeTask banner_probe(CoroLoop& loop, std::string ip, int port, std::string request, int timeout_millisec, Callback on_banner) {
+        struct sockaddr_in address;
+        if (!make_address(ip, port, address)) {
+            on_banner(-EINVAL, 0, std::string{});
+            co_return;
+        }
+
+        scan_engine::Socket sock{ AF_INET, SOCK_STREAM, 0 };
+        sock.set_nonblock();
+
+        auto start = std::chrono::steady_clock::now();
+        int ret = co_await connect(loop, sock.handle(), address, timeout_millisec);
+        int rtt_micros = (int)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        if (ret != 0) {
+            on_banner(ret, rtt_micros, std::string{});
+            co_return;
+        }
+
+        char buf[512];
+        ssize_t n = co_await read(loop, sock.handle(), buf, sizeof(buf), timeout_millisec);
+
+        if (n <= 0 && !request.empty()) {
+            if (co_await write(loop, sock.handle(), request.data(), request.size(), timeout_millisec) > 0) {
+                n = co_await read(loop, sock.handle(), buf, sizeof(buf), timeout_millisec);
+            }
+        }
+
+        on_banner(0, rtt_micros, std::string(buf, n > 0 ? (size_t)n : 0));
+    }
+
+    // the "coro" engine, one connect probe coroutine per (host, port), `window` at a time,
+    // a `banner_probe` instead when banners are asked for.
+    class CoroEngine : public scan_engine::ScanEngine {
+        static void report(const scan_engine::ScanConfig& config, const scan_engine::ResultCallback& on_result, size_t host, int port,
+                           int ret, int rtt_micros, const std::string& banner) {
+            scan_engine::ConnectState state = (ret == 0 ? scan_engine::ConnectState::opened
+                                               : (ret == -ECONNREFUSED ? scan_engine::ConnectState::refused
+                                                  : (ret == -ETIMEDOUT ? scan_engine::ConnectState::timed_out : scan_engine::ConnectState::failed)));
+            if (ret == 0 || (config.report_closed && state != scan_engine::ConnectState::failed)) {
+                on_result(scan_engine::ScanResult{ host, port, ret == 0, rtt_micros, banner.empty() ? nullptr : banner.data(), banner.size(),
+                                                   scan_engine::ConnectDiagnostics{}, state });
+            }
+        }
+
+        static ProbeTask connect_probe(CoroLoop& loop, const scan_engine::ScanConfig& config, size_t host, int port,
+                                       const scan_engine::ResultCallback& on_result, int& in_flight) {
+            struct sockaddr_in address;
+
+            if (make_address(config.ips[host], port, address)) {
+                scan_engine::Socket sock{ AF_INET, SOCK_STREAM, 0 };
+                sock.set_nonblock();
+
+                auto start = std::chrono::steady_clock::now();
+                int ret = co_await connect(loop, sock.handle(), address, config.timeout_millisec);
+                auto rtt = std::chrono::steady_clock::now() - start;
+                int rtt_micros = (int)std::chrono::duration_cast<std::chrono::microseconds>(rtt).count();
+                report(config, on_result, host, port, ret, rtt_micros, std::string{});
+            }
+
+            --in_flight;
+        }
+    public:
+        const char* name() const override {
+            return "coro";
+        }
+
+        void scan(const scan_engine::ScanConfig& config, const scan_engine::ResultCallback& on_result) override {
+            CoroLoop loop;
+            int in_flight = 0;
+            size_t total = config.ips.size() * config.ports.size();
+            size_t next = 0;
+
+            while (next < total || in_flight > 0) {
+                while (in_flight < config.window && next < total) {
+                    size_t host = next / config.ports.size();
+                    int port = config.ports[next % config.ports.size()];
+                    ++next;
+
+                    if (config.skipped(host, port)) {
+                        continue;
+                    }
+
+                    ++in_flight;
+                    if (!config.grab_banners) {
+                        connect_probe(loop, config, host, port, on_result, in_flight);
+                        continue;
+                    }
+
+                    char request[512];
+                    size_t n = (config.request ? config.request(host, port, request, sizeof(request)) : 0);
+                    banner_probe(loop, config.ips[host], port, std::string(request, std::min(n, sizeof(request))), config.timeout_millisec,
+                        [&config, &on_result, &in_flight, host, port](int ret, int rtt_micros, const std::string& banner) {
+                            report(config, on_result, host, port, ret, rtt_micros, banner);
+                            --in_flight;
+                        });
+                }
+
+                loop.run_once();
+            }
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,181 @@
+#pragma once
+
+// @brief  protocol probe modules, run on the connections the scan engine opened.
+//         a module is any type with
+//             static const char* name();
+//             size_t payload(const std::string& ip, int port, char* buf, size_t cap) const;
+//             bool classify(const char* data, size_t len, std::string& label) const;
+//         `ProbeRunner<Module>` calls them directly, so built-in modules cost no virtual
+//         call per answer. out-of-tree modules are shared objects implementing
+//         port_scanner_probe_module.h, wrapped by `DynamicModule` (build with -ldl).
+#include <stdexcept>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include <dlfcn.h>
+
+#include "port_scanner_probe_module.h"
+
+namespace probe_module {
+    class ProbeModuleException : public std::runtime_error {
+    public:
+        ProbeModuleException(const std::string& msg)
+            : std::runtime_error{ "probe module error: " + msg }
+        {}
+    };
+
+    // an opened port and what it answered to the payload.
+    struct ProbeTarget {
+        size_t host_index;
+        int port;
+        std::string response;
+        int rtt_micros;
+    };
+
+    struct ProbeResult {
+        size_t host_index;
+        int port;
+        bool matched;
+        std::string label;      // set by the module when matched.
+        std::string response;
+        int rtt_micros;         // of the connect.
+    };
+
+    // sends nothing, any greeting counts.
+    struct BannerModule {
+        static const char* name() {
+            return "banner";
+        }
+
+        size_t payload(const std::string&, int, char*, size_t) const {
+            return 0;
+        }
+
+        bool classify(const char*, size_t len, std::string& label) const {
+            if (len > 0) {
+                label = "banner";
+                return true;
+            }
+            return false;
+        }
+    };
+
+    struct HttpModule {
+        static const char* name() {
+            return "http";
+        }
+
+        size_t payload(const std::string& ip, int, char* buf, size_t cap) const {
+            std::string request = "HEAD / HTTP/1.0\r\nHost: " + ip + "\r\n\r\n";
+            size_t n = (request.size() < cap ? request.size() : cap);
+            std::memcpy(buf, request.data(), n);
+            return n;
+        }
+
+        bool classify(const char* data, size_t len, std::string& label) const {
+            if (len >= 5 && std::memcmp(data, "HTTP/", 5) == 0) {
+                label = "http";
+                return true;
+            }
+            return false;
+        }
+    };
+
+    struct RedisModule {
+        static const char* name() {
+            return "redis";
+        }
+
+        size_t payload(const std::string&, int, char* buf, size_t cap) const {
+            static const char ping[] = "PING\r\n";
+            size_t n = (sizeof(ping) - 1 < cap ? sizeof(ping) - 1 : cap);
+            std::memcpy(buf, ping, n);
+            return n;
+        }
+
+        bool classify(const char* data, size_t len, std::string& label) const {
+            if (len >= 5 && std::memcmp(data, "+PONG", 5) == 0) {
+                label = "redis";
+                return true;
+            }
+            if (len >= 7 && std::memcmp(data, "-NOAUTH", 7) == 0) {
+                label = "redis (auth required)";
+                return true;
+            }
+            return false;
+        }
+    };
+
+    // a module loaded from a shared object.
+    class DynamicModule {
+        std::shared_ptr<void> library;
+        const ps_probe_module* module;
+    public:
+        DynamicModule(const std::string& path) : library{}, module{ nullptr } {
+            void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+            if (!handle) {
+                throw ProbeModuleException{ dlerror() };
+            }
+
+            library.reset(handle, [](void* h) { dlclose(h); });
+
+            auto entry = (ps_probe_module_entry_fn)dlsym(handle, "ps_probe_module_entry");
+            if (!entry) {
+                throw ProbeModuleException{ path + " does not export ps_probe_module_entry" };
+            }
+
+            module = entry();
+            if (!module || module->abi_version != PS_PROBE_MODULE_ABI_VERSION || !module->payload || !module->classify) {
+                throw ProbeModuleException{ path + " has an incompatible module abi" };
+            }
+        }
+
+        const char* module_name() const {
+            return module->name;
+        }
+
+        size_t payload(const std::string& ip, int port, char* buf, size_t cap) const {
+            size_t n = module->payload(ip.c_str(), port, buf, cap);
+            return (n < cap ? n : cap);
+        }
+
+        bool classify(const char* data, size_t len, std::string& label) const {
+            char buf[128] = { 0 };
+            if (module->classify(data, len, buf, sizeof(buf) - 1)) {
+                label = buf;
+                return true;
+            }
+            return false;
+        }
+    };
+
+    // runs `Module` on the connections of the scan: the engine sends `request` on every
+    // opened port and reads the answer into the banner of its result, `run` classifies
+    // the answers afterwards.
+    template<typename Module>
+    class ProbeRunner {
+        Module module;
+    public:
+        ProbeRunner(Module _module = Module{}) : module(_module) {}
+
+        // for `ScanConfig::request`, holds a copy of the module and refers to `ips`.
+        std::function<size_t(size_t, int, char*, size_t)> request(const std::vector<std::string>& ips) const {
+            Module bound = module;
+            return [bound, &ips](size_t host, int port, char* buf, size_t cap) {
+                return bound.payload(ips[host], port, buf, cap);
+            };
+        }
+
+        template<typename Callback>
+        void run(const std::vector<ProbeTarget>& targets, Callback on_result) const {
+            for (const auto& target : targets) {
+                std::string label;
+                bool matched = module.classify(target.response.data(), target.response.size(), label);
+                on_result(ProbeResult{ target.host_index, target.port, matched, label, target.response, target.rtt_micros });
+            }
+        }
+    };
+}
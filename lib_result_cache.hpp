@@ -0,0 +1,255 @@
+#pragma once
+
+// @brief  on-disk cache of the last state seen per (host, port), so a rescan within minutes
+//         can skip what was confirmed closed. the file is an open addressing hash table,
+//         mapped as it is: opening it costs an mmap, not a parse, and lookups and updates
+//         are plain loads and stores into the mapping. it grows by rehashing into a new
+//         file renamed over the old one. one scan at a time, held with flock.
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace result_cache {
+    class CacheFileException : public std::runtime_error {
+    public:
+        CacheFileException(const std::string& msg)
+            : std::runtime_error{ "cache file error: " + msg }
+        {}
+    };
+
+    enum class PortState : uint8_t { empty = 0, closed = 1, opened = 2 };
+
+    struct CacheEntry {
+        uint32_t ipv4;          // host byte order.
+        uint16_t port;
+        PortState state;
+        uint8_t reserved;
+        int64_t seen_secs;      // unix time of the probe.
+    };
+
+    struct CacheHeader {
+        char magic[8];          // "PSCACHE1".
+        uint64_t capacity;      // slots, power of 2.
+        uint64_t count;         // used slots.
+        uint64_t reserved;
+    };
+
+    namespace detail {
+        inline uint64_t slot_hash(uint32_t ipv4, uint16_t port) {
+            uint64_t x = (uint64_t)ipv4 << 16 | port;
+            x = (x ^ (x >> 33)) * 0xFF51AFD7ED558CCDull;
+            x = (x ^ (x >> 33)) * 0xC4CEB9FE1A85EC53ull;
+            return x ^ (x >> 33);
+        }
+
+        inline size_t file_size(uint64_t capacity) {
+            return sizeof(CacheHeader) + (size_t)capacity * sizeof(CacheEntry);
+        }
+    }
+
+    // raii read-write mapping of one cache file.
+    class CacheFile {
+        int fd;
+        void* addr;
+        size_t length;
+
+        void unmap() {
+            if (addr) {
+                munmap(addr, length);
+                addr = nullptr;
+            }
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+    public:
+        CacheFile() : fd{ -1 }, addr{ nullptr }, length{ 0 } {}
+
+        // locks and maps `path`, created with `capacity` empty slots when it is empty or missing.
+        // the lock comes first, so of two scans only one ever sees the file empty.
+        void open(const std::string& path, uint64_t capacity, bool create_new) {
+            unmap();
+
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                throw CacheFileException{ "open " + path + " failed, " + std::strerror(errno) };
+            }
+            if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+                throw CacheFileException{ path + " is used by another scan" };
+            }
+            if (create_new && ftruncate(fd, 0) < 0) {
+                throw CacheFileException{ "truncate " + path + " failed, " + std::strerror(errno) };
+            }
+
+            struct stat st;
+            if (fstat(fd, &st) < 0) {
+                throw CacheFileException{ "stat " + path + " failed, " + std::strerror(errno) };
+            }
+
+            bool fresh = (st.st_size == 0);
+            if (fresh) {
+                // sparse, untouched slots read as empty.
+                if (ftruncate(fd, (off_t)detail::file_size(capacity)) < 0) {
+                    throw CacheFileException{ "resize " + path + " failed, " + std::strerror(errno) };
+                }
+                length = detail::file_size(capacity);
+            }
+            else {
+                length = (size_t)st.st_size;
+                if (length < sizeof(CacheHeader)) {
+                    throw CacheFileException{ "not a cache file: " + path };
+                }
+            }
+
+            addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED) {
+                addr = nullptr;
+                throw CacheFileException{ "mmap " + path + " failed, " + std::strerror(errno) };
+            }
+
+            CacheHeader* h = header();
+            if (fresh) {
+                std::memcpy(h->magic, "PSCACHE1", 8);
+                h->capacity = capacity;
+                h->count = 0;
+            }
+            else if (std::memcmp(h->magic, "PSCACHE1", 8) != 0 || (h->capacity & (h->capacity - 1)) != 0
+                     || detail::file_size(h->capacity) != length) {
+                throw CacheFileException{ "not a cache file: " + path };
+            }
+        }
+
+        CacheFile(const CacheFile&) = delete;
+        CacheFile& operator=(const CacheFile&) = delete;
+
+        ~CacheFile() {
+            unmap();
+        }
+
+        int handle() const {
+            return fd;
+        }
+
+        CacheHeader* header() const {
+            return (CacheHeader*)addr;
+        }
+
+        CacheEntry* entries() const {
+            return (CacheEntry*)((char*)addr + sizeof(CacheHeader));
+        }
+
+        void swap(CacheFile& other) {
+            std::swap(fd, other.fd);
+            std::swap(addr, other.addr);
+            std::swap(length, other.length);
+        }
+    };
+
+    class ResultCache {
+        std::string path;
+        CacheFile file;
+
+        static uint64_t capacity_for(uint64_t entries) {
+            // at most 70% full, linear probing stays short.
+            uint64_t capacity = 1024;
+            while (capacity * 7 / 10 < entries) {
+                capacity <<= 1;
+            }
+            return capacity;
+        }
+
+        // the slot of (ipv4, port), or the empty slot where it would go.
+        CacheEntry& find(uint32_t ipv4, uint16_t port) const {
+            uint64_t mask = file.header()->capacity - 1;
+            CacheEntry* slots = file.entries();
+
+            for (uint64_t i = detail::slot_hash(ipv4, port) & mask; ; i = (i + 1) & mask) {
+                CacheEntry& entry = slots[i];
+                if (entry.state == PortState::empty || (entry.ipv4 == ipv4 && entry.port == port)) {
+                    return entry;
+                }
+            }
+        }
+
+        // rehashes into a file of `capacity` slots next to the old one, then renames it over.
+        void grow(uint64_t capacity) {
+            std::string tmp_path = path + ".tmp";
+            CacheFile bigger;
+            bigger.open(tmp_path, capacity, true);
+
+            uint64_t mask = capacity - 1;
+            const CacheEntry* old_slots = file.entries();
+            for (uint64_t i = 0; i < file.header()->capacity; ++i) {
+                if (old_slots[i].state == PortState::empty) {
+                    continue;
+                }
+                uint64_t j = detail::slot_hash(old_slots[i].ipv4, old_slots[i].port) & mask;
+                while (bigger.entries()[j].state != PortState::empty) {
+                    j = (j + 1) & mask;
+                }
+                bigger.entries()[j] = old_slots[i];
+            }
+            bigger.header()->count = file.header()->count;
+
+            if (rename(tmp_path.c_str(), path.c_str()) < 0) {
+                throw CacheFileException{ "replace " + path + " failed, " + std::strerror(errno) };
+            }
+            file.swap(bigger);
+        }
+    public:
+        // opens or creates the cache at `_path`, with room for `more` entries to come.
+        ResultCache(const std::string& _path, uint64_t more) : path{ _path }, file{} {
+            file.open(path, capacity_for(more), false);
+
+            uint64_t needed = capacity_for(file.header()->count + more);
+            if (needed > file.header()->capacity) {
+                grow(needed);
+            }
+        }
+
+        ResultCache(const ResultCache&) = delete;
+        ResultCache& operator=(const ResultCache&) = delete;
+
+        // the entry of (ipv4, port), false when there is none.
+        bool lookup(uint32_t ipv4, uint16_t port, CacheEntry& out) const {
+            const CacheEntry& entry = find(ipv4, port);
+            if (entry.state == PortState::empty) {
+                return false;
+            }
+            out = entry;
+            return true;
+        }
+
+        // sets the state of (ipv4, port), grows the file past the room reserved at open.
+        void store(uint32_t ipv4, uint16_t port, PortState state, int64_t seen_secs) {
+            if (capacity_for(file.header()->count + 1) > file.header()->capacity) {
+                grow(file.header()->capacity * 2);
+            }
+
+            CacheEntry& entry = find(ipv4, port);
+            if (entry.state == PortState::empty) {
+                ++file.header()->count;
+            }
+            entry = CacheEntry{ ipv4, port, state, 0, seen_secs };
+        }
+
+        uint64_t size() const {
+            return file.header()->count;
+        }
+
+        uint64_t capacity() const {
+            return file.header()->capacity;
+        }
+    };
+}
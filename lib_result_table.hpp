@@ -0,0 +1,157 @@
+#pragma once
+
+// @brief  result aggregation shared by several worker threads, without a lock on the hot path.
+//         `ConcurrentPortsTable` is the opened bit per (host, port), set with one atomic
+//         fetch_or on a 64-bit word, which also tells the caller whether it was the first
+//         to report that port. `StagedResults` carries richer records: every thread fills
+//         its own chunk, full chunks are pushed onto a lock-free list the consumer drains.
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace result_table {
+    class ConcurrentPortsTable {
+        static const size_t words_per_host = 65536 / 64;
+
+        size_t hosts;
+        std::unique_ptr<std::atomic<uint64_t>[]> words;
+    public:
+        ConcurrentPortsTable(size_t _hosts = 0) : hosts{ 0 }, words{} {
+            reset(_hosts);
+        }
+
+        // not thread safe, call before the workers start.
+        void reset(size_t _hosts) {
+            hosts = _hosts;
+            words.reset(new std::atomic<uint64_t>[hosts * words_per_host]);
+
+            for (size_t i = 0; i < hosts * words_per_host; ++i) {
+                words[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        size_t host_count() const {
+            return hosts;
+        }
+
+        // true when this call is the one which set the bit.
+        bool set(size_t host, int port) {
+            uint64_t bit = (uint64_t)1 << (port & 63);
+            uint64_t old = words[host * words_per_host + (port >> 6)].fetch_or(bit, std::memory_order_relaxed);
+            return (old & bit) == 0;
+        }
+
+        bool test(size_t host, int port) const {
+            uint64_t bit = (uint64_t)1 << (port & 63);
+            return (words[host * words_per_host + (port >> 6)].load(std::memory_order_relaxed) & bit) != 0;
+        }
+
+        size_t count(size_t host) const {
+            size_t n = 0;
+            for (size_t i = 0; i < words_per_host; ++i) {
+                n += __builtin_popcountll(words[host * words_per_host + i].load(std::memory_order_relaxed));
+            }
+            return n;
+        }
+    };
+
+    // `Record` should be trivially copyable, records of one thread keep their order.
+    template<typename Record, size_t chunk_records = 1024>
+    class StagedResults {
+        struct Chunk {
+            Chunk* next;
+            size_t size;
+            Record records[chunk_records];
+        };
+
+        std::atomic<Chunk*> full;
+
+        void push(Chunk* chunk) {
+            Chunk* head = full.load(std::memory_order_relaxed);
+            do {
+                chunk->next = head;
+            } while (!full.compare_exchange_weak(head, chunk, std::memory_order_release, std::memory_order_relaxed));
+        }
+    public:
+        // a thread's own staging buffer, never shared, flushed when full and on destruction.
+        class Stage {
+            StagedResults* owner;
+            Chunk* chunk;
+        public:
+            explicit Stage(StagedResults& _owner) : owner{ &_owner }, chunk{ nullptr } {}
+
+            Stage(Stage&& other) : owner{ other.owner }, chunk{ other.chunk } {
+                other.chunk = nullptr;
+            }
+
+            Stage(const Stage&) = delete;
+            Stage& operator=(const Stage&) = delete;
+
+            ~Stage() {
+                flush();
+            }
+
+            void append(const Record& record) {
+                if (!chunk) {
+                    chunk = new Chunk;
+                    chunk->size = 0;
+                }
+
+                chunk->records[chunk->size++] = record;
+                if (chunk->size == chunk_records) {
+                    flush();
+                }
+            }
+
+            void flush() {
+                if (chunk) {
+                    owner->push(chunk);
+                    chunk = nullptr;
+                }
+            }
+        };
+
+        StagedResults() : full{ nullptr } {}
+
+        StagedResults(const StagedResults&) = delete;
+        StagedResults& operator=(const StagedResults&) = delete;
+
+        ~StagedResults() {
+            drain([](const Record&) {});
+        }
+
+        Stage stage() {
+            return Stage{ *this };
+        }
+
+        // calls func(record) for every flushed record, from one consumer thread at a time.
+        template<typename Func>
+        size_t drain(Func func) {
+            Chunk* list = full.exchange(nullptr, std::memory_order_acquire);
+
+            // the stack is newest first, reverse it so each thread's chunks come in order.
+            Chunk* ordered = nullptr;
+            while (list) {
+                Chunk* next = list->next;
+                list->next = ordered;
+                ordered = list;
+                list = next;
+            }
+
+            size_t n = 0;
+            while (ordered) {
+                for (size_t i = 0; i < ordered->size; ++i) {
+                    func(ordered->records[i]);
+                }
+                n += ordered->size;
+
+                Chunk* next = ordered->next;
+                delete ordered;
+                ordered = next;
+            }
+            return n;
+        }
+    };
+}
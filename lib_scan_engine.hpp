@@ -0,0 +1,107 @@
+#pragma once
+
+// @brief  the scanning library interface, shared by every engine.
+//         an engine takes one `ScanConfig` and streams results through a callback,
+//         so services can embed scanning in-process. engines are created by name
+//         at runtime with `scan_engine::make_engine` from lib_scanner.hpp.
+#include <stdexcept>
+#include <functional>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "lib_live_config.hpp"
+
+namespace scan_engine {
+    class EngineUnavailableException : public std::runtime_error {
+    public:
+        EngineUnavailableException(const std::string& name, const std::string& available)
+            : std::runtime_error{ "scan engine not available in this build: " + name + ", available: " + available }
+        {}
+    };
+
+    // what may change while a scan runs, engines read it between batches.
+    struct LiveSettings {
+        int timeout_millisec;
+        int window;
+        int rate;               // connects per second, 0 is unlimited.
+        std::vector<std::pair<uint32_t, uint32_t>> excluded;   // sorted disjoint address ranges, host byte order.
+
+        bool is_excluded(uint32_t address) const {
+            auto it = std::upper_bound(excluded.begin(), excluded.end(), std::make_pair(address, 0xFFFFFFFFu));
+            return it != excluded.begin() && (it - 1)->second >= address;
+        }
+    };
+
+    struct ScanConfig {
+        std::vector<std::string> ips;
+        std::vector<int> ports;
+        int timeout_millisec;
+        int window;             // max in-flight connects.
+        int host_window;        // max in-flight connects to one host inside `window`, 0 is `window`, epoll engine only.
+        int rate;               // connects per second, 0 is unlimited, epoll, io_uring and raw engines only.
+        bool syn_defense;       // throttle hosts which start dropping syns under load, epoll engine only.
+        bool grab_banners;      // read what opened ports send first, engines without support ignore it.
+        // optional, with `grab_banners` the bytes to send on an opened connection before its banner is read.
+        std::function<size_t(size_t host, int port, char* buf, size_t cap)> request;
+        live_config::RcuCell<LiveSettings>* live;   // optional, overrides the settings above mid-scan, epoll engine only.
+        std::function<bool(size_t host, int port)> skip;    // optional, true for a (host, port) not to probe.
+        bool report_closed;     // also stream refused probes, and timed out ones where the engine tells them apart.
+
+        ScanConfig()
+            : ips{}, ports{}, timeout_millisec{ 2000 }, window{ 256 }, host_window{ 0 }, rate{ 0 }, syn_defense{ false }, grab_banners{ false },
+              request{}, live{ nullptr }, skip{}, report_closed{ false }
+        {}
+
+        // engines ask before they probe a (host, port), some more than once, so `skip` must not count.
+        bool skipped(size_t host, int port) const {
+            return skip && skip(host, port);
+        }
+    };
+
+    // how one connect ended, refused is a rst from the host. a timed out or failed connect
+    // says nothing of the port: the syn, the answer or the host may be lost or filtered.
+    enum class ConnectState { pending, opened, refused, failed, timed_out };
+
+    // what the kernel knew of a connect when it finished, read from TCP_INFO. all zero from
+    // engines which do not read it.
+    struct ConnectDiagnostics {
+        uint32_t kernel_rtt_micros;     // smoothed rtt of the kernel, 0 when it took no sample.
+        uint8_t syn_retransmits;        // syns sent again before the answer, a lost syn or syn-ack.
+        uint8_t tcp_state;              // TCP_ESTABLISHED, TCP_CLOSE, TCP_SYN_SENT and so on.
+        bool valid;
+    };
+
+    struct ScanResult {
+        size_t host_index;      // index into `ScanConfig::ips`.
+        int port;
+        bool opened;
+        int rtt_micros;         // measured in user space, from connect to its completion.
+        const char* banner;     // only valid during the callback, nullptr when none.
+        size_t banner_length;
+        ConnectDiagnostics diagnostics;     // epoll engine, and io_uring without direct descriptors.
+        ConnectState state;     // opened, or with `ScanConfig::report_closed` refused or timed_out.
+
+        // the kernel's estimate when there is one, it has no wakeup latency in it.
+        int best_rtt_micros() const {
+            return (diagnostics.kernel_rtt_micros > 0 ? (int)diagnostics.kernel_rtt_micros : rtt_micros);
+        }
+    };
+
+    // called one at a time, once per opened (host, port), and per closed one when asked for. on the
+    // scanning thread, or on the asio engine's workers when its `concurrency_hint` is above 1.
+    using ResultCallback = std::function<void(const ScanResult&)>;
+
+    class ScanEngine {
+    public:
+        virtual ~ScanEngine() {}
+
+        virtual const char* name() const = 0;
+
+        // blocks until every (host, port) of `config` is done.
+        virtual void scan(const ScanConfig& config, const ResultCallback& on_result) = 0;
+    };
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+// @brief  the asio engine, built with non-boost asio, works on windows and linux.
+//         every port is tried 3 times at once, to increase the scan quality,
+//         especially for bad network environment.
+//         on linux, asio picks its reactor at compile time: epoll by default, io_uring with
+//         -DASIO_HAS_IO_URING -DASIO_DISABLE_EPOLL -luring (asio 1.21 or newer).
+#include <system_error>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <mutex>
+
+#include <asio.hpp>
+#include "lib_scan_engine.hpp"
+#include "lib_result_table.hpp"
+
+namespace scan_engine {
+    class AsioEngine : public ScanEngine {
+        int threads;
+        asio::io_context ioc;
+        result_table::ConcurrentPortsTable table;   // reports each opened port only once, from any thread.
+        result_table::ConcurrentPortsTable refused; // the same for refused ports, every pass may see the rst.
+        std::mutex callback_mutex;                  // on_result runs on one thread at a time.
+
+        void port_scan(const std::string& ip, size_t host, int port, int timeout_millisec, bool report_closed, const ResultCallback& on_result) {
+            auto socket = std::make_shared<asio::ip::tcp::socket>(ioc);
+            asio::ip::tcp::endpoint endpoint(asio::ip::make_address(ip), port);
+            auto start = std::chrono::steady_clock::now();
+
+            socket->async_connect(endpoint,
+                [this, host, port, socket, start, report_closed, &on_result](const std::error_code& ec) {
+                    auto rtt = std::chrono::steady_clock::now() - start;
+                    int rtt_micros = (int)std::chrono::duration_cast<std::chrono::microseconds>(rtt).count();
+                    if (!ec && table.set(host, port)) {
+                        std::lock_guard<std::mutex> lock{ callback_mutex };
+                        on_result(ScanResult{ host, port, true, rtt_micros, nullptr, 0, ConnectDiagnostics{}, ConnectState::opened });
+                    }
+                    else if (ec == std::errc::connection_refused && report_closed && refused.set(host, port)) {
+                        std::lock_guard<std::mutex> lock{ callback_mutex };
+                        on_result(ScanResult{ host, port, false, rtt_micros, nullptr, 0, ConnectDiagnostics{}, ConnectState::refused });
+                    }
+                });
+
+            auto timer = std::make_shared<asio::steady_timer>(ioc);
+            timer->expires_after(std::chrono::milliseconds(timeout_millisec));
+            timer->async_wait([socket, timer](const std::error_code& ec) {
+                if (!ec) {
+                    if (socket->is_open()) {
+                        socket->cancel();
+                    }
+                }
+            });
+        }
+
+        void scan_all(const ScanConfig& config, const ResultCallback& on_result) {
+            for (size_t host = 0; host < config.ips.size(); ++host) {
+                for (int port : config.ports) {
+                    if (!table.test(host, port) && !config.skipped(host, port)) {
+                        port_scan(config.ips[host], host, port, config.timeout_millisec, config.report_closed, on_result);
+                    }
+                }
+            }
+        }
+    public:
+        // the scan runs on `concurrency_hint` threads, on_result is called from all of them, one
+        // call at a time. hint 1 keeps it on the calling thread and lets asio skip most of its
+        // scheduler locking.
+        AsioEngine(int concurrency_hint = 1) : threads{ concurrency_hint }, ioc{ concurrency_hint }, table{}, refused{}, callback_mutex{} {}
+
+        const char* name() const override {
+            return "asio";
+        }
+
+        static const char* backend() {
+#if defined(ASIO_HAS_IO_URING_AS_DEFAULT)
+            return "io_uring";
+#elif defined(ASIO_HAS_EPOLL)
+            return "epoll";
+#elif defined(ASIO_HAS_IOCP)
+            return "iocp";
+#elif defined(ASIO_HAS_KQUEUE)
+            return "kqueue";
+#else
+            return "select";
+#endif
+        }
+
+        void scan(const ScanConfig& config, const ResultCallback& on_result) override {
+            table.reset(config.ips.size());
+            refused.reset(config.report_closed ? config.ips.size() : 0);
+
+            scan_all(config, on_result);
+            scan_all(config, on_result);
+            scan_all(config, on_result);
+
+            std::vector<std::thread> workers;
+            for (int i = 1; i < threads; ++i) {
+                workers.emplace_back([this] { ioc.run(); });
+            }
+
+            ioc.run();
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            ioc.restart();
+        }
+    };
+}
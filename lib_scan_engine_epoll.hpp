@@ -0,0 +1,927 @@
+#pragma once
+
+// @brief  the epoll engine, linux only and without any 3rd party.
+//         connects are issued non-blocking, up to `window` in flight over all hosts, and
+//         collected with epoll. a finished connect frees its place for the next (host, port)
+//         at once. with `ScanConfig::live` set, every round reads the live settings first, so
+//         a new window, timeout, rate or exclusion applies to the connects after it. connects
+//         to one host are capped by `host_window`, and a host which starts dropping under the load
+//         is throttled and its timed out ports probed again. every finished connect reads
+//         TCP_INFO, answers which needed a syn sent again are loss on the path, and back the
+//         window and rate of the host off. with `grab_banners` an opened connection sends the
+//         `request` of the config and stays in the window until its first bytes came back.
+#include <system_error>
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "lib_scan_engine.hpp"
+
+namespace scan_engine {
+    // raii wrapper for socket.
+    class Socket {
+        int fd;
+    public:
+        Socket() : fd{ -1 } {}
+
+        Socket(int domain, int type, int protocol) {
+            fd = socket(domain, type, protocol);
+            if (fd < 0) {
+                std::error_code ec(errno, std::system_category());
+                throw std::system_error{ ec, "sys call socket failed" };
+            }
+        }
+
+        Socket(int _fd) : fd{ _fd } {}
+
+        Socket(const Socket&) = delete;
+        Socket& operator=(const Socket&) = delete;
+
+        Socket(Socket&& other)
+            : fd{ other.fd }
+        {
+            other.fd = -1;
+        }
+
+        Socket& operator=(Socket&& other) {
+            if (this != &other) {
+                fd = other.fd;
+                other.fd = -1;
+            }
+
+            return *this;
+        }
+
+        ~Socket() {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+
+        void close() {
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+
+        void set_nonblock() {
+            int flag = fcntl(fd, F_GETFL, 0);
+            fcntl(fd, F_SETFL, flag | O_NONBLOCK);
+        }
+
+        int handle() {
+            return fd;
+        }
+    };
+
+    // raii wrapper for epoll.
+    class Epoll {
+        int fd;
+    public:
+        Epoll() {
+            fd = epoll_create1(0);
+            if (fd < 0) {
+                std::error_code ec(errno, std::system_category());
+                throw std::system_error{ ec, "sys call epoll_create1 failed" };
+            }
+        }
+
+        Epoll(const Epoll&) = delete;
+        Epoll& operator=(const Epoll&) = delete;
+
+        Epoll(Epoll&& other)
+            : fd{ other.fd }
+        {
+            other.fd = -1;
+        }
+
+        Epoll& operator=(Epoll&& other) {
+            if (this != &other) {
+                fd = other.fd;
+                other.fd = -1;
+            }
+
+            return *this;
+        }
+
+        ~Epoll() {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        int handle() {
+            return fd;
+        }
+
+        void add_fd(struct epoll_event* ev, int descriptor) {
+            if (epoll_ctl(fd, EPOLL_CTL_ADD, descriptor, ev) < 0) {
+                std::error_code ec(errno, std::system_category());
+                throw std::system_error{ ec, "sys call epoll_ctl failed on `EPOLL_CTL_ADD`" };
+            }
+        }
+
+        void del_fd(int descriptor) {
+            if (epoll_ctl(fd, EPOLL_CTL_DEL, descriptor, nullptr) < 0) {
+                std::error_code ec(errno, std::system_category());
+                throw std::system_error{ ec, "sys call epoll_ctl failed on `EPOLL_CTL_DEL`" };
+            }
+        }
+
+        void mod_fd(struct epoll_event* ev, int descriptor) {
+            if (epoll_ctl(fd, EPOLL_CTL_MOD, descriptor, ev) < 0) {
+                std::error_code ec(errno, std::system_category());
+                throw std::system_error{ ec, "sys call epoll_ctl failed on `EPOLL_CTL_MOD`" };
+            }
+        }
+    };
+
+    // an opened port, with the round trip time of its connect.
+    struct OpenedPort {
+        int port;
+        int rtt_micros;
+    };
+
+    // how one connect of a batch ended.
+    struct ConnectOutcome {
+        int port;
+        ConnectState state;
+        int rtt_micros;
+        ConnectDiagnostics diagnostics;
+    };
+
+    // TCP_INFO of `fd`, not valid when the kernel refuses it.
+    inline ConnectDiagnostics tcp_diagnostics(int fd) {
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        std::memset(&info, 0, sizeof(info));
+
+        if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+            return ConnectDiagnostics{ 0, 0, 0, false };
+        }
+
+        // total_retrans keeps the syns sent again after the connect finished, retransmits is
+        // reset by the syn-ack. a port which timed out counts them too, those are no loss.
+        uint32_t retransmits = std::max<uint32_t>(info.tcpi_total_retrans, info.tcpi_retransmits);
+        return ConnectDiagnostics{ info.tcpi_rtt, (uint8_t)std::min<uint32_t>(retransmits, 255), info.tcpi_state, true };
+    }
+
+    // connector, it will do the things.
+    class BatchConnector {
+        struct ConnectRecord {
+            int port;
+            Socket sock;
+            ConnectState state;
+            int rtt_micros;
+            ConnectDiagnostics diagnostics;
+            std::chrono::steady_clock::time_point start;
+        };
+
+        std::vector<ConnectRecord> records;
+        Epoll epoll;
+        int len;
+        int pending;
+
+        int socket_error(int fd) {
+            int error = -1;
+            socklen_t len = sizeof(error);
+
+            int ret = getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+            return (ret == 0 ? error : errno);
+        }
+
+        static ConnectState state_of_error(int error) {
+            return (error == 0 ? ConnectState::opened : (error == ECONNREFUSED ? ConnectState::refused : ConnectState::failed));
+        }
+
+        // until every connect finished or `timeout_millisec` passed, a slow answer is not a closed port.
+        void wait(int timeout_millisec) {
+            std::vector<struct epoll_event> events(records.size());
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_millisec);
+
+            while (pending > 0) {
+                auto now = std::chrono::steady_clock::now();
+                int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+
+                int nfds = epoll_wait(epoll.handle(), events.data(), events.size(), (left > 0 ? left : 0));
+                if (nfds < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (nfds <= 0) {
+                    break;
+                }
+
+                now = std::chrono::steady_clock::now();
+                for (int i = 0; i < nfds; ++i) {
+                    ConnectRecord* record = (ConnectRecord*)events[i].data.ptr;
+                    if (record->state != ConnectState::pending) {
+                        continue;
+                    }
+
+                    record->state = state_of_error(socket_error(record->sock.handle()));
+                    record->rtt_micros = (int)std::chrono::duration_cast<std::chrono::microseconds>(now - record->start).count();
+                    record->diagnostics = tcp_diagnostics(record->sock.handle());
+
+                    // closing also takes it out of the epoll set.
+                    record->sock.close();
+                    --pending;
+                }
+            }
+
+            for (int i = 0; i < len; ++i) {
+                if (records[i].state == ConnectState::pending) {
+                    records[i].state = ConnectState::timed_out;
+                    records[i].diagnostics = tcp_diagnostics(records[i].sock.handle());
+                }
+            }
+        }
+    public:
+        BatchConnector(int capacity)
+            : records(capacity), epoll{}, len{ 0 }, pending{ 0 }
+        {}
+
+        void submit(const std::string& ip, int port) {
+            // this connector could only hold `capacity` elements.
+            if (len == (int)records.size()) {
+                return;
+            }
+
+            auto& record = records[len];
+
+            record.state = ConnectState::pending;
+            record.port = port;
+            record.rtt_micros = 0;
+            record.diagnostics = ConnectDiagnostics{ 0, 0, 0, false };
+            record.start = std::chrono::steady_clock::now();
+
+            struct sockaddr_in address;
+            std::memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            if (inet_pton(AF_INET, ip.c_str(), &address.sin_addr) != 1) {
+                record.state = ConnectState::failed;
+                ++len;
+                return;
+            }
+
+            record.sock = Socket{ AF_INET, SOCK_STREAM, 0 };
+            record.sock.set_nonblock();
+
+            int ret = connect(record.sock.handle(), (struct sockaddr*)&address, sizeof(address));
+            if (ret < 0) {
+                if (errno == EINPROGRESS) {
+                    struct epoll_event ev;
+                    ev.events = EPOLLOUT | EPOLLERR | EPOLLHUP;
+                    ev.data.ptr = (void*)(records.data() + len);
+
+                    epoll.add_fd(&ev, record.sock.handle());
+                    ++pending;
+                }
+                else {
+                    record.state = state_of_error(errno);
+                    record.sock.close();
+                }
+            }
+            else if (ret == 0) {   // hardly to happen.
+                record.state = ConnectState::opened;
+                record.sock.close();
+            }
+
+            ++len;
+        }
+
+        void collect_opened_ports(std::vector<OpenedPort>& opened_ports, int timeout_millisec) {
+            wait(timeout_millisec);
+
+            for (int i = 0; i < len; ++i) {
+                if (records[i].state == ConnectState::opened) {
+                    opened_ports.emplace_back(OpenedPort{ records[i].port, records[i].rtt_micros });
+                }
+            }
+        }
+
+        void collect_outcomes(std::vector<ConnectOutcome>& outcomes, int timeout_millisec) {
+            wait(timeout_millisec);
+
+            for (int i = 0; i < len; ++i) {
+                outcomes.emplace_back(ConnectOutcome{ records[i].port, records[i].state, records[i].rtt_micros, records[i].diagnostics });
+            }
+        }
+    };
+
+    // watches the batches sent to one host for signs of syn flood defenses: the host answered
+    // closed ports with rsts, then a batch mostly times out, or its round trips jump far above
+    // what they were. syn cookies, conntrack limits and rate limited firewalls all look so.
+    class SynDefenseDetector {
+        int refused;            // rsts seen from the host so far.
+        double baseline_rtt;    // ewma of answered connects, micros, 0 before the first.
+    public:
+        SynDefenseDetector() : refused{ 0 }, baseline_rtt{ 0 } {}
+
+        // true when this batch looks like the host started dropping.
+        bool observe(const std::vector<ConnectOutcome>& outcomes) {
+            const int min_refused = 8;
+
+            int timed_out = 0;
+            int answered = 0;
+            double rtt_sum = 0;
+            for (const auto& outcome : outcomes) {
+                if (outcome.state == ConnectState::timed_out) {
+                    ++timed_out;
+                }
+                else if (outcome.state == ConnectState::opened || outcome.state == ConnectState::refused) {
+                    ++answered;
+                    rtt_sum += outcome.rtt_micros;
+                }
+            }
+
+            bool trusted = (refused >= min_refused);
+            bool timeout_burst = trusted && timed_out >= 4 && timed_out * 2 >= (int)outcomes.size();
+            double batch_rtt = (answered > 0 ? rtt_sum / answered : 0);
+            bool rtt_spike = trusted && answered >= 4 && baseline_rtt > 0 && batch_rtt > 4 * baseline_rtt + 1000;
+
+            for (const auto& outcome : outcomes) {
+                refused += (outcome.state == ConnectState::refused ? 1 : 0);
+            }
+            if (!rtt_spike && answered > 0) {
+                baseline_rtt = (baseline_rtt == 0 ? batch_rtt : 0.8 * baseline_rtt + 0.2 * batch_rtt);
+            }
+
+            return timeout_burst || rtt_spike;
+        }
+
+        int refused_count() const {
+            return refused;
+        }
+    };
+
+    // the share of its window and rate one host gets, halved after a batch where answers needed
+    // a syn sent again, since the first syn or its syn-ack was lost on the way, and grown back
+    // a sixteenth per clean batch. the kernel sends a syn again after a second, so this sees
+    // loss only with a longer timeout; timed out ports are filtered as often as lost, not used.
+    class SynLossControl {
+        double kept;
+        int backoffs;
+        int late_answers;
+    public:
+        SynLossControl() : kept{ 1 }, backoffs{ 0 }, late_answers{ 0 } {}
+
+        void observe(const std::vector<ConnectOutcome>& outcomes) {
+            int answered = 0;
+            int late = 0;
+            for (const auto& outcome : outcomes) {
+                if (outcome.state == ConnectState::opened || outcome.state == ConnectState::refused) {
+                    ++answered;
+                    late += (outcome.diagnostics.syn_retransmits > 0 ? 1 : 0);
+                }
+            }
+            late_answers += late;
+
+            // a single late answer in a big batch is a stray drop, not a congested path.
+            if (late > 0 && late * 20 >= answered) {
+                kept = std::max(kept / 2, 1.0 / 64);
+                ++backoffs;
+            }
+            else if (answered > 0) {
+                kept = std::min(kept + 1.0 / 16, 1.0);
+            }
+        }
+
+        double share() const {
+            return kept;
+        }
+
+        int backoff_count() const {
+            return backoffs;
+        }
+
+        int late_answer_count() const {
+            return late_answers;
+        }
+    };
+
+    // streams opened ports of each finished batch of `window` connects to `on_opened`.
+    template<typename Callback>
+    void port_scan(const std::string& ip, const std::vector<int>& ports, int timeout_millisec, int window, Callback on_opened) {
+        std::vector<OpenedPort> opened_ports;
+
+        int i = 0;
+        int counter = 0;
+        while (i < (int)ports.size()) {
+            BatchConnector connector{ window };
+
+            while (counter < window && i + counter < (int)ports.size()) {
+                connector.submit(ip, ports[i + counter]);
+                ++counter;
+            }
+
+            connector.collect_opened_ports(opened_ports, timeout_millisec);
+
+            for (const auto& opened : opened_ports) {
+                on_opened(opened);
+            }
+
+            opened_ports.clear();
+            i += counter;
+            counter = 0;
+        }
+    }
+
+    template<int N>
+    std::vector<int> port_scan(const std::string& ip, const std::vector<int>& ports, int timeout_millisec) {
+        std::vector<int> opened_ports;
+
+        port_scan(ip, ports, timeout_millisec, N, [&opened_ports](const OpenedPort& opened) {
+            opened_ports.emplace_back(opened.port);
+        });
+
+        return opened_ports;
+    }
+
+    template<int N>
+    std::vector<int> port_scan_range(const std::string& ip, int port_start, int port_end, int timeout_millisec) {
+        std::vector<int> ports;
+
+        for (int port = port_start; port <= port_end; ++port) {
+            ports.emplace_back(port);
+        }
+
+        return port_scan<N>(ip, ports, timeout_millisec);
+    }
+
+    template<int N>
+    std::vector<int> port_scan_commonly_used(const std::string& ip, int timeout_millisec) {
+        std::vector<int> ports;
+
+        ports.emplace_back(21);    // ftp.
+        ports.emplace_back(22);    // ssh.
+        ports.emplace_back(23);    // telnet.
+        ports.emplace_back(25);    // smtp.
+        ports.emplace_back(53);    // dns.
+        ports.emplace_back(80);    // http.
+        ports.emplace_back(110);   // pop3.
+        ports.emplace_back(443);   // https.
+        ports.emplace_back(1433);  // sql server.
+        ports.emplace_back(3306);  // mysql.
+        ports.emplace_back(5432);  // pgsql.
+        ports.emplace_back(6379);  // redis.
+        ports.emplace_back(8000);
+        ports.emplace_back(8080);
+
+        return port_scan<N>(ip, ports, timeout_millisec);
+    }
+
+    // what the syn defense detection did to one host.
+    struct ThrottledHost {
+        size_t host_index;
+        int refused_before;     // rsts seen before it triggered the first time.
+        int window;             // in-flight connects it ended at.
+        int requeued;           // timed out ports probed again.
+    };
+
+    // what the syn loss control saw over a scan.
+    struct SynLossStats {
+        uint64_t late_answers;      // opened or refused only after a syn was sent again.
+        uint64_t backoffs;          // batches after which a host's share was halved.
+        size_t hosts_backed_off;
+    };
+
+    class EpollEngine : public ScanEngine {
+        struct QueuedPort {
+            int port;
+            bool retry;
+        };
+
+        // a host with ports left to probe or connects in flight. its finished connects are
+        // handed to the detectors in groups as large as its share of the window, the same
+        // as the batches of one host were before.
+        struct HostState {
+            size_t host;
+            uint32_t address;       // host byte order.
+            std::vector<QueuedPort> ports;
+            size_t next;
+            int in_flight;
+            std::vector<ConnectOutcome> outcomes;
+            std::vector<bool> outcome_retried;
+            SynDefenseDetector detector;
+            SynLossControl loss_control;
+            ThrottledHost throttle;
+            std::chrono::steady_clock::time_point next_departure;
+            std::chrono::steady_clock::time_point paused_until;     // after a throttle, the other hosts go on.
+        };
+
+        // one connect in flight, its slot index is the epoll data.
+        struct Connect {
+            Socket sock;
+            HostState* host;
+            int port;
+            bool retry;             // a timed out port probed again, never queued a third time.
+            bool reading;           // opened, waiting for its banner.
+            uint32_t generation;    // tells a stale timer of the slot from its current connect.
+            std::chrono::steady_clock::time_point start;
+            int rtt_micros;         // of the connect, a banner read must not stretch it.
+            ConnectDiagnostics diagnostics;
+        };
+
+        static const size_t banner_limit = 512;
+
+        struct Timer {
+            std::chrono::steady_clock::time_point deadline;
+            size_t slot;
+            uint32_t generation;
+
+            bool operator>(const Timer& other) const {
+                return deadline > other.deadline;
+            }
+        };
+
+        std::vector<ThrottledHost> throttled;
+        SynLossStats loss;
+
+        // the ports of `host` which are not skipped.
+        static void ports_of(const ScanConfig& config, size_t host, std::vector<QueuedPort>& ports) {
+            ports.clear();
+            for (int port : config.ports) {
+                if (!config.skipped(host, port)) {
+                    ports.emplace_back(QueuedPort{ port, false });
+                }
+            }
+        }
+
+        static int socket_error(int fd) {
+            int error = -1;
+            socklen_t len = sizeof(error);
+
+            int ret = getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+            return (ret == 0 ? error : errno);
+        }
+
+        static ConnectState state_of_error(int error) {
+            return (error == 0 ? ConnectState::opened : (error == ECONNREFUSED ? ConnectState::refused : ConnectState::failed));
+        }
+
+        // the in-flight connects one host may hold: the window, capped by `host_window` and a
+        // syn defense throttle, scaled by the share the loss on its path left it.
+        static int host_cap(const ScanConfig& config, const LiveSettings& settings, const HostState& h) {
+            int cap = settings.window;
+            if (config.host_window > 0) {
+                cap = std::min(cap, config.host_window);
+            }
+            if (h.throttle.window > 0) {
+                cap = std::min(cap, h.throttle.window);
+            }
+            return std::max(1, (int)(cap * h.loss_control.share()));
+        }
+
+        static void record(HostState& h, int port, bool retry, ConnectState state, int rtt_micros, ConnectDiagnostics diagnostics,
+                           const char* banner, size_t banner_length, const ScanConfig& config, const ResultCallback& on_result) {
+            h.outcomes.emplace_back(ConnectOutcome{ port, state, rtt_micros, diagnostics });
+            h.outcome_retried.push_back(retry);
+
+            bool closed = (state == ConnectState::refused || state == ConnectState::timed_out);
+            if (state == ConnectState::opened || (closed && config.report_closed)) {
+                on_result(ScanResult{ h.host, port, state == ConnectState::opened, rtt_micros, banner, banner_length, diagnostics, state });
+            }
+        }
+
+        // feeds a full group of outcomes, or the rest once the host has nothing else going,
+        // to the detectors. a host which looks like it defends itself gets half its cap, and
+        // its timed out ports go again once, after a pause.
+        void observe(HostState& h, const ScanConfig& config, const LiveSettings& settings) {
+            int cap = host_cap(config, settings, h);
+            bool drained = (h.next >= h.ports.size() && h.in_flight == 0);
+            if (h.outcomes.empty() || ((int)h.outcomes.size() < cap && !drained)) {
+                return;
+            }
+
+            h.loss_control.observe(h.outcomes);
+
+            if (config.syn_defense && h.detector.observe(h.outcomes)) {
+                if (h.throttle.window == 0) {
+                    h.throttle.refused_before = h.detector.refused_count();
+                }
+                h.throttle.window = std::max(1, cap / 2);
+
+                for (size_t k = 0; k < h.outcomes.size(); ++k) {
+                    if (h.outcomes[k].state == ConnectState::timed_out && !h.outcome_retried[k]) {
+                        h.ports.emplace_back(QueuedPort{ h.outcomes[k].port, true });
+                        ++h.throttle.requeued;
+                    }
+                }
+
+                // lets the syn backlog or the limiter of the host drain, without holding up the others.
+                h.paused_until = std::chrono::steady_clock::now() + std::chrono::milliseconds(settings.timeout_millisec);
+            }
+
+            h.outcomes.clear();
+            h.outcome_retried.clear();
+        }
+
+        void retire(const HostState& h) {
+            if (h.throttle.window > 0) {
+                throttled.emplace_back(h.throttle);
+            }
+
+            loss.late_answers += h.loss_control.late_answer_count();
+            loss.backoffs += h.loss_control.backoff_count();
+            loss.hosts_backed_off += (h.loss_control.backoff_count() > 0 ? 1 : 0);
+        }
+    public:
+        EpollEngine() : throttled{}, loss{ 0, 0, 0 } {}
+
+        const char* name() const override {
+            return "epoll";
+        }
+
+        // (host, port) pairs are drawn from one window shared by every host: a host is taken
+        // in when the hosts before it have no port left to send or sit at their cap, so one
+        // host may fill the whole window, and a port per host spreads it over many hosts.
+        // the settings are read again every round when they are live. with `rate` the
+        // connects depart a fixed gap apart, and a host whose share was cut keeps its own gap.
+        void scan(const ScanConfig& config, const ResultCallback& on_result) override {
+            throttled.clear();
+            loss = SynLossStats{ 0, 0, 0 };
+
+            typedef std::chrono::steady_clock clock;
+
+            Epoll epoll;
+            std::vector<Connect> slots;
+            std::vector<size_t> free_slots;
+            std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+            std::vector<std::unique_ptr<HostState>> active;
+            std::vector<struct epoll_event> events(1024);
+
+            LiveSettings fixed{ config.timeout_millisec, config.window, config.rate, {} };
+            size_t next_host = 0;
+            int in_flight = 0;
+            auto next_departure = clock::now();
+
+            // the rtt and TCP_INFO are taken when the connect finishes, a banner comes later.
+            auto connected = [&](Connect& c, clock::time_point now) {
+                c.rtt_micros = (int)std::chrono::duration_cast<std::chrono::microseconds>(now - c.start).count();
+                c.diagnostics = tcp_diagnostics(c.sock.handle());
+            };
+
+            auto finish_slot = [&](size_t slot, ConnectState state, clock::time_point now, const LiveSettings& settings,
+                                   const char* banner, size_t banner_length) {
+                Connect& c = slots[slot];
+                if (!c.reading) {
+                    connected(c, now);
+                }
+
+                // closing also takes it out of the epoll set.
+                c.sock.close();
+                c.reading = false;
+                ++c.generation;
+                free_slots.emplace_back(slot);
+                --in_flight;
+                --c.host->in_flight;
+
+                record(*c.host, c.port, c.retry, state, c.rtt_micros, c.diagnostics, banner, banner_length, config, on_result);
+                observe(*c.host, config, settings);
+            };
+
+            // an opened connection sends the request, if any, and keeps its slot until the
+            // first bytes, the close of the host or another timeout.
+            auto read_banner = [&](size_t slot, clock::time_point now, int timeout_millisec) {
+                Connect& c = slots[slot];
+                connected(c, now);
+                c.reading = true;
+
+                char request[banner_limit];
+                size_t n = (config.request ? config.request(c.host->host, c.port, request, sizeof(request)) : 0);
+                if (n > 0) {
+                    // a failed send shows up as the error or hang up of the read.
+                    ::send(c.sock.handle(), request, std::min(n, sizeof(request)), MSG_NOSIGNAL);
+                }
+
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLRDHUP;
+                ev.data.u64 = slot;
+                epoll.mod_fd(&ev, c.sock.handle());
+
+                ++c.generation;
+                timers.push(Timer{ now + std::chrono::milliseconds(timeout_millisec), slot, c.generation });
+            };
+
+            // connects the next queued port of `h`, an error at once is recorded right away.
+            auto submit = [&](HostState& h, clock::time_point now, int timeout_millisec) {
+                QueuedPort queued = h.ports[h.next++];
+
+                struct sockaddr_in address;
+                std::memset(&address, 0, sizeof(address));
+                address.sin_family = AF_INET;
+                address.sin_port = htons(queued.port);
+                address.sin_addr.s_addr = htonl(h.address);
+
+                Socket sock{ AF_INET, SOCK_STREAM, 0 };
+                sock.set_nonblock();
+
+                int ret = connect(sock.handle(), (struct sockaddr*)&address, sizeof(address));
+                if (ret == 0 || errno != EINPROGRESS) {
+                    ConnectState state = (ret == 0 ? ConnectState::opened : state_of_error(errno));
+                    record(h, queued.port, queued.retry, state, 0, ConnectDiagnostics{ 0, 0, 0, false }, nullptr, 0, config, on_result);
+                    return;
+                }
+
+                if (free_slots.empty()) {
+                    free_slots.emplace_back(slots.size());
+                    slots.emplace_back(Connect{ Socket{}, nullptr, 0, false, false, 0, now, 0, ConnectDiagnostics{ 0, 0, 0, false } });
+                }
+                size_t slot = free_slots.back();
+                free_slots.pop_back();
+
+                Connect& c = slots[slot];
+                c.sock = std::move(sock);
+                c.host = &h;
+                c.port = queued.port;
+                c.retry = queued.retry;
+                c.start = now;
+
+                struct epoll_event ev;
+                ev.events = EPOLLOUT | EPOLLERR | EPOLLHUP;
+                ev.data.u64 = slot;
+                epoll.add_fd(&ev, c.sock.handle());
+
+                timers.push(Timer{ now + std::chrono::milliseconds(timeout_millisec), slot, c.generation });
+                ++in_flight;
+                ++h.in_flight;
+            };
+
+            while (next_host < config.ips.size() || !active.empty()) {
+                // the round before holds nothing of the old settings.
+                if (config.live) {
+                    config.live->quiescent();
+                }
+                const LiveSettings& settings = (config.live ? config.live->read() : fixed);
+
+                auto now = clock::now();
+                auto wake = now + std::chrono::milliseconds(100);     // live settings are read again by then.
+                auto gap = std::chrono::nanoseconds(settings.rate > 0 ? 1000000000ll / settings.rate : 0);
+                auto catch_up = std::chrono::milliseconds(2);
+
+                // one connect per host and pass, new hosts only while the active ones cannot send.
+                auto blocked_until = clock::time_point::max();      // when a host held back by the clock may send.
+                bool paced = (settings.rate > 0 && now < next_departure);
+                bool progress = true;
+                while (in_flight < settings.window && progress && !paced) {
+                    progress = false;
+
+                    for (size_t k = 0; k < active.size() && in_flight < settings.window; ++k) {
+                        HostState& h = *active[k];
+                        if (settings.is_excluded(h.address)) {
+                            h.next = h.ports.size();
+                            continue;
+                        }
+                        if (h.next >= h.ports.size() || h.in_flight >= host_cap(config, settings, h)) {
+                            continue;
+                        }
+                        if (now < h.paused_until) {
+                            blocked_until = std::min(blocked_until, h.paused_until);
+                            continue;
+                        }
+
+                        if (settings.rate > 0) {
+                            if (now < h.next_departure) {
+                                blocked_until = std::min(blocked_until, h.next_departure);
+                                continue;
+                            }
+                            if (now < next_departure) {
+                                paced = true;
+                                break;
+                            }
+
+                            // epoll waits in whole milliseconds, a round sends what fell due since the last,
+                            // but a stall is not made up for with a burst.
+                            int rate = std::max(1, (int)(settings.rate * h.loss_control.share()));
+                            h.next_departure = std::max(h.next_departure, now - catch_up) + std::chrono::nanoseconds(1000000000ll / rate);
+                            next_departure = std::max(next_departure, now - catch_up) + gap;
+                        }
+
+                        submit(h, now, settings.timeout_millisec);
+                        progress = true;
+                    }
+
+                    if (!progress && !paced && next_host < config.ips.size()) {
+                        std::unique_ptr<HostState> h{ new HostState{} };
+                        h->host = next_host++;
+
+                        // not an ipv4 address, nothing to connect to.
+                        struct in_addr addr;
+                        if (inet_pton(AF_INET, config.ips[h->host].c_str(), &addr) != 1) {
+                            progress = true;
+                            continue;
+                        }
+
+                        h->address = ntohl(addr.s_addr);
+                        h->throttle = ThrottledHost{ h->host, 0, 0, 0 };
+                        h->next_departure = now;
+                        h->paused_until = now;
+                        ports_of(config, h->host, h->ports);
+                        if (!h->ports.empty()) {
+                            active.emplace_back(std::move(h));
+                        }
+                        progress = true;
+                    }
+                }
+
+                if (paced) {
+                    blocked_until = std::min(blocked_until, next_departure);
+                }
+                wake = std::min(wake, blocked_until);
+                if (!timers.empty()) {
+                    wake = std::min(wake, timers.top().deadline);
+                }
+
+                // hosts with nothing left to send or wait for are done.
+                for (size_t k = 0; k < active.size(); ) {
+                    HostState& h = *active[k];
+                    observe(h, config, settings);
+                    if (h.next < h.ports.size() || h.in_flight > 0) {
+                        ++k;
+                        continue;
+                    }
+
+                    retire(h);
+                    active.erase(active.begin() + k);
+                }
+
+                // nothing to wait for but the clock.
+                if (in_flight == 0) {
+                    if (blocked_until != clock::time_point::max()) {
+                        std::this_thread::sleep_until(blocked_until);
+                    }
+                    continue;
+                }
+
+                auto left = std::chrono::duration_cast<std::chrono::microseconds>(wake - clock::now()).count();
+                int wait = (int)(left > 0 ? (left + 999) / 1000 : 0);
+                int nfds = epoll_wait(epoll.handle(), events.data(), (int)events.size(), wait);
+                if (nfds < 0 && errno != EINTR) {
+                    std::error_code ec(errno, std::system_category());
+                    throw std::system_error{ ec, "sys call epoll_wait failed" };
+                }
+
+                now = clock::now();
+                for (int i = 0; i < nfds; ++i) {
+                    size_t slot = (size_t)events[i].data.u64;
+                    Connect& c = slots[slot];
+
+                    if (c.reading) {
+                        char banner[banner_limit];
+                        ssize_t n = ::recv(c.sock.handle(), banner, sizeof(banner), 0);
+                        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                            continue;
+                        }
+                        finish_slot(slot, ConnectState::opened, now, settings, (n > 0 ? banner : nullptr), (n > 0 ? (size_t)n : 0));
+                        continue;
+                    }
+
+                    ConnectState state = state_of_error(socket_error(c.sock.handle()));
+                    if (state == ConnectState::opened && config.grab_banners) {
+                        read_banner(slot, now, settings.timeout_millisec);
+                        continue;
+                    }
+                    finish_slot(slot, state, now, settings, nullptr, 0);
+                }
+
+                // a slow answer is not a closed port, only the deadline makes it timed out.
+                // an opened port which stayed silent is reported without a banner.
+                while (!timers.empty() && timers.top().deadline <= now) {
+                    Timer timer = timers.top();
+                    timers.pop();
+                    Connect& c = slots[timer.slot];
+                    if (c.generation == timer.generation && c.sock.handle() >= 0) {
+                        finish_slot(timer.slot, (c.reading ? ConnectState::opened : ConnectState::timed_out), now, settings, nullptr, 0);
+                    }
+                }
+            }
+        }
+
+        // hosts of the last scan the syn defense detection throttled.
+        const std::vector<ThrottledHost>& throttled_hosts() const {
+            return throttled;
+        }
+
+        const SynLossStats& syn_loss_stats() const {
+            return loss;
+        }
+    };
+}
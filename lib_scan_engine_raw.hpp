@@ -0,0 +1,314 @@
+#pragma once
+
+// @brief  the raw engine, half-open syn scanning, linux only, needs CAP_NET_RAW.
+//         syns are written to a raw tcp socket, the kernel puts the ip header on, and the
+//         answers are read back from the same socket: a syn-ack is opened, a rst refused,
+//         no answer within the timeout timed out. no connection is ever made, so a probe
+//         costs no socket and no fd. the kernel answers each syn-ack with a rst, since no
+//         socket listens on the source port, which closes the half-open connection again.
+//         the sequence number of a syn is a keyed hash of its target, an answer has to
+//         acknowledge it to count.
+#include <stdexcept>
+#include <system_error>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <time.h>
+
+#include "lib_scan_engine.hpp"
+#include "lib_scan_engine_epoll.hpp"
+
+namespace scan_engine {
+    class RawSocketPermissionException : public std::runtime_error {
+    public:
+        RawSocketPermissionException()
+            : std::runtime_error{ "the raw engine needs CAP_NET_RAW, run as root or `setcap cap_net_raw+ep` the binary" }
+        {}
+    };
+
+    namespace detail {
+        inline uint64_t mix64(uint64_t x) {
+            x += 0x9E3779B97F4A7C15ull;
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+            return x ^ (x >> 31);
+        }
+
+        // one's complement sum over the pseudo header and the segment, addresses in network order.
+        inline uint16_t tcp_checksum(uint32_t source, uint32_t dest, const uint8_t* segment, size_t len) {
+            uint32_t sum = 0;
+            sum += (ntohl(source) >> 16) + (ntohl(source) & 0xFFFF);
+            sum += (ntohl(dest) >> 16) + (ntohl(dest) & 0xFFFF);
+            sum += IPPROTO_TCP;
+            sum += (uint32_t)len;
+
+            for (size_t i = 0; i + 1 < len; i += 2) {
+                sum += ((uint32_t)segment[i] << 8) | segment[i + 1];
+            }
+            if (len & 1) {
+                sum += (uint32_t)segment[len - 1] << 8;
+            }
+
+            while (sum >> 16) {
+                sum = (sum & 0xFFFF) + (sum >> 16);
+            }
+            return htons((uint16_t)~sum);
+        }
+    }
+
+    class RawSynEngine : public ScanEngine {
+        struct Probe {
+            size_t host;
+            std::chrono::steady_clock::time_point sent;
+        };
+
+        struct Sent {
+            uint64_t key;
+            std::chrono::steady_clock::time_point sent;
+        };
+
+        Socket raw;
+
+        // (address, port) of a target, address in network order.
+        static uint64_t key_of(uint32_t address, uint16_t port) {
+            return ((uint64_t)address << 16) | port;
+        }
+
+        static int micros_between(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+            return (int)std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+        }
+
+        // the address the kernel routes from towards `dest`, 0 when there is no route.
+        static uint32_t source_address(int udp_fd, uint32_t dest) {
+            struct sockaddr_in address;
+            std::memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_port = htons(9);
+            address.sin_addr.s_addr = dest;
+
+            if (connect(udp_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+                return 0;
+            }
+
+            socklen_t len = sizeof(address);
+            int ret = getsockname(udp_fd, (struct sockaddr*)&address, &len);
+
+            // a connected socket keeps its source, dissolving the association lets the next route pick again.
+            struct sockaddr unspec;
+            std::memset(&unspec, 0, sizeof(unspec));
+            unspec.sa_family = AF_UNSPEC;
+            connect(udp_fd, &unspec, sizeof(unspec));
+
+            return (ret == 0 ? address.sin_addr.s_addr : 0);
+        }
+
+        // false when the socket buffer is full, the syn goes again after the next wait.
+        bool send_syn(uint32_t source, uint32_t dest, uint16_t source_port, uint16_t port, uint32_t seq, int& error) {
+            uint8_t segment[24];
+            std::memset(segment, 0, sizeof(segment));
+
+            struct tcphdr* tcp = (struct tcphdr*)segment;
+            tcp->source = htons(source_port);
+            tcp->dest = htons(port);
+            tcp->seq = htonl(seq);
+            tcp->doff = sizeof(segment) / 4;
+            tcp->syn = 1;
+            tcp->window = htons(64240);
+
+            // mss 1460, a syn without options is dropped by some stacks.
+            segment[20] = 2;
+            segment[21] = 4;
+            segment[22] = 1460 >> 8;
+            segment[23] = 1460 & 0xFF;
+
+            tcp->check = detail::tcp_checksum(source, dest, segment, sizeof(segment));
+
+            struct sockaddr_in address;
+            std::memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = dest;
+
+            error = 0;
+            if (sendto(raw.handle(), segment, sizeof(segment), 0, (struct sockaddr*)&address, sizeof(address)) < 0) {
+                error = errno;
+                return error != ENOBUFS && error != EAGAIN;
+            }
+            return true;
+        }
+    public:
+        // opens the raw socket right away, so a missing capability shows up at creation.
+        RawSynEngine() : raw{} {
+            int fd = socket(AF_INET, SOCK_RAW | SOCK_NONBLOCK, IPPROTO_TCP);
+            if (fd < 0) {
+                if (errno == EPERM || errno == EACCES) {
+                    throw RawSocketPermissionException{};
+                }
+                std::error_code ec(errno, std::system_category());
+                throw std::system_error{ ec, "sys call socket failed on SOCK_RAW" };
+            }
+            raw = Socket{ fd };
+
+            // every tcp segment this machine receives is copied here, answers must not drown.
+            int buffer = 8 * 1024 * 1024;
+            setsockopt(raw.handle(), SOL_SOCKET, SO_RCVBUFFORCE, &buffer, sizeof(buffer));
+        }
+
+        const char* name() const override {
+            return "raw";
+        }
+
+        void scan(const ScanConfig& config, const ResultCallback& on_result) override {
+            // a bound tcp socket keeps the source port from being handed to a real connection.
+            Socket reserve{ AF_INET, SOCK_STREAM, 0 };
+            struct sockaddr_in local;
+            std::memset(&local, 0, sizeof(local));
+            local.sin_family = AF_INET;
+            socklen_t local_len = sizeof(local);
+            if (bind(reserve.handle(), (struct sockaddr*)&local, sizeof(local)) < 0 ||
+                getsockname(reserve.handle(), (struct sockaddr*)&local, &local_len) < 0) {
+                std::error_code ec(errno, std::system_category());
+                throw std::system_error{ ec, "sys call bind failed on the source port" };
+            }
+            uint16_t source_port = ntohs(local.sin_port);
+
+            Socket udp{ AF_INET, SOCK_DGRAM, 0 };
+            std::vector<uint32_t> destinations(config.ips.size(), 0);
+            std::vector<uint32_t> sources(config.ips.size(), 0);
+            for (size_t host = 0; host < config.ips.size(); ++host) {
+                struct in_addr addr;
+                if (inet_pton(AF_INET, config.ips[host].c_str(), &addr) == 1) {
+                    destinations[host] = addr.s_addr;
+                    sources[host] = source_address(udp.handle(), addr.s_addr);
+                }
+            }
+            udp.close();
+
+            uint64_t secret = detail::mix64(((uint64_t)std::random_device{}() << 32) | std::random_device{}());
+            auto cookie = [secret, source_port](uint32_t address, uint16_t port) {
+                return (uint32_t)detail::mix64(secret ^ key_of(address, port) ^ ((uint64_t)source_port << 48));
+            };
+
+            std::unordered_map<uint64_t, Probe> outstanding;
+            std::deque<Sent> sent_order;        // timeouts are all the same, so this is by deadline.
+            auto timeout = std::chrono::milliseconds(config.timeout_millisec);
+            auto gap = std::chrono::nanoseconds(config.rate > 0 ? 1000000000ll / config.rate : 0);
+            auto next_departure = std::chrono::steady_clock::now();
+
+            size_t total = config.ips.size() * config.ports.size();
+            size_t next = 0;
+            uint8_t packet[256];
+
+            while (next < total || !outstanding.empty()) {
+                auto now = std::chrono::steady_clock::now();
+
+                while (next < total && (int)outstanding.size() < config.window && now >= next_departure) {
+                    size_t host = next / config.ports.size();
+                    int port = config.ports[next % config.ports.size()];
+                    uint32_t dest = destinations[host];
+
+                    if (dest == 0 || sources[host] == 0 || config.skipped(host, port)) {
+                        ++next;
+                        continue;
+                    }
+
+                    int error = 0;
+                    if (!send_syn(sources[host], dest, source_port, (uint16_t)port, cookie(dest, (uint16_t)port), error)) {
+                        next_departure = now + std::chrono::milliseconds(1);
+                        break;
+                    }
+                    ++next;
+
+                    // unreachable and the like, a failed probe says nothing of the port.
+                    if (error != 0) {
+                        continue;
+                    }
+
+                    uint64_t key = key_of(dest, (uint16_t)port);
+                    outstanding[key] = Probe{ host, now };
+                    sent_order.emplace_back(Sent{ key, now });
+
+                    // departures are a fixed gap apart, but never in the past.
+                    if (config.rate > 0) {
+                        next_departure = std::max(next_departure, now) + gap;
+                    }
+                }
+
+                // wait for an answer, the next deadline, or the next departure.
+                auto wake = (sent_order.empty() ? now + timeout : sent_order.front().sent + timeout);
+                if (next < total && (int)outstanding.size() < config.window) {
+                    wake = std::min(wake, next_departure);
+                }
+                auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(wake - now).count();
+                wait = (wait > 0 ? wait : 0);
+
+                struct timespec ts;
+                ts.tv_sec = (time_t)(wait / 1000000000);
+                ts.tv_nsec = (long)(wait % 1000000000);
+                struct pollfd pfd = { raw.handle(), POLLIN, 0 };
+                if (ppoll(&pfd, 1, &ts, nullptr) < 0 && errno != EINTR) {
+                    std::error_code ec(errno, std::system_category());
+                    throw std::system_error{ ec, "sys call ppoll failed" };
+                }
+
+                while (true) {
+                    ssize_t n = recv(raw.handle(), packet, sizeof(packet), 0);
+                    if (n < 0) {
+                        break;
+                    }
+
+                    const struct iphdr* ip = (const struct iphdr*)packet;
+                    if (n < (ssize_t)sizeof(struct iphdr) || ip->version != 4 || ip->protocol != IPPROTO_TCP ||
+                        n < (ssize_t)(ip->ihl * 4 + sizeof(struct tcphdr))) {
+                        continue;
+                    }
+
+                    const struct tcphdr* tcp = (const struct tcphdr*)(packet + ip->ihl * 4);
+                    if (ntohs(tcp->dest) != source_port || !tcp->ack || !(tcp->rst || tcp->syn)) {
+                        continue;
+                    }
+
+                    uint16_t port = ntohs(tcp->source);
+                    auto it = outstanding.find(key_of(ip->saddr, port));
+                    if (it == outstanding.end() || ntohl(tcp->ack_seq) != cookie(ip->saddr, port) + 1) {
+                        continue;
+                    }
+
+                    bool opened = tcp->syn;
+                    if (opened || config.report_closed) {
+                        int rtt_micros = micros_between(it->second.sent, std::chrono::steady_clock::now());
+                        on_result(ScanResult{ it->second.host, (int)port, opened, rtt_micros, nullptr, 0, ConnectDiagnostics{},
+                                              (opened ? ConnectState::opened : ConnectState::refused) });
+                    }
+                    outstanding.erase(it);
+                }
+
+                now = std::chrono::steady_clock::now();
+                while (!sent_order.empty() && sent_order.front().sent + timeout <= now) {
+                    auto it = outstanding.find(sent_order.front().key);
+                    if (it != outstanding.end() && it->second.sent == sent_order.front().sent) {
+                        if (config.report_closed) {
+                            on_result(ScanResult{ it->second.host, (int)(it->first & 0xFFFF), false, micros_between(it->second.sent, now),
+                                                  nullptr, 0, ConnectDiagnostics{}, ConnectState::timed_out });
+                        }
+                        outstanding.erase(it);
+                    }
+                    sent_order.pop_front();
+                }
+            }
+        }
+    };
+}
@@ -0,0 +1,460 @@
+#pragma once
+
+// @brief  the io_uring engine, linux 5.7 or newer, build with -DPORT_SCANNER_WITH_IO_URING.
+//         connects are IORING_OP_CONNECT with a linked timeout. banner reads select their
+//         buffer from a provided buffer ring at completion time, so a silent socket holds
+//         no buffer and the whole window shares one bounded pool. the `request` of the config
+//         goes out as an IORING_OP_SEND linked before the first read.
+//         from 5.19 on sockets are created by IORING_OP_SOCKET straight into a registered
+//         file table of `window` slots, they never enter the process fd table.
+//         with `ScanConfig::rate` every connect is linked behind an absolute IORING_OP_TIMEOUT
+//         at its departure time, so the whole window is submitted at once and the kernel's
+//         hrtimers space the syns, not sleeps in this thread. linux 6.0 or newer.
+//         rtts run from the io_uring_enter which submitted the connect to the one which reaped
+//         it. without direct descriptors every finished connect also reads TCP_INFO, and the
+//         kernel's rtt takes the place of that one. in a registered file table there is no
+//         TCP_INFO, there the rtt also holds the rest of its batch and the wakeup of this thread,
+//         on loopback some hundred microseconds.
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "lib_scan_engine.hpp"
+#include "lib_scan_engine_epoll.hpp"
+#include "lib_io_uring.hpp"
+
+namespace scan_engine {
+    struct IoUringStats {
+        bool direct_descriptors;        // sockets lived in the registered file table.
+        bool buffer_ring;               // false when the kernel only took IORING_OP_PROVIDE_BUFFERS.
+        unsigned buffers;               // pool size.
+        unsigned buffer_size;
+        unsigned peak_buffers_per_batch;    // most buffers one batch of completions filled, the pool
+                                            // runs short when it nears `buffers`.
+        uint64_t reads_with_data;       // completions which consumed a buffer.
+        uint64_t reads_without_data;    // closed or timed out before sending anything.
+        uint64_t buffer_exhausted;      // -ENOBUFS, the read was retried once buffers came back.
+        uint64_t bytes;
+    };
+
+    class IoUringEngine : public ScanEngine {
+        enum Op : uint64_t {
+            op_connect = 1,
+            op_recv = 2,
+            op_timeout = 3,
+            op_socket = 4,
+            op_close = 5,
+            op_pace = 6,
+            op_send = 7
+        };
+
+        enum class Stage { free, connecting, reading, closing };
+
+        // with direct descriptors the slot index is also the registered file index.
+        struct Slot {
+            Stage stage;
+            int fd;                     // -1 with direct descriptors.
+            size_t host;
+            int port;
+            struct sockaddr_in address;
+            struct __kernel_timespec departure;     // CLOCK_MONOTONIC, of a paced connect.
+            std::chrono::steady_clock::time_point start;    // submitted, or the departure of a paced connect.
+            int connect_micros;         // the rtt, a banner read must not stretch it.
+            ConnectDiagnostics diagnostics;
+            std::string request;        // sent before the first read, kept until its cqe.
+            bool request_pending;
+        };
+
+        static const uint16_t buffer_group = 1;
+
+        // connects per io_uring_enter. the kernel issues a batch in order before it returns, so
+        // the last connect of a batch waits for the rest, and a smaller batch keeps that short.
+        static const size_t submit_batch = 16;
+
+        unsigned buffer_count;
+        unsigned buffer_size;
+        IoUringStats last_stats;
+
+        static uint64_t user_data(size_t slot, Op op) {
+            return ((uint64_t)slot << 8) | op;
+        }
+
+        static int elapsed_micros(const Slot& slot, std::chrono::steady_clock::time_point reaped) {
+            return (int)std::chrono::duration_cast<std::chrono::microseconds>(reaped - slot.start).count();
+        }
+
+        static void prep_timeout(io_uring::Ring& ring, size_t index, struct __kernel_timespec* ts) {
+            struct io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_LINK_TIMEOUT;
+            sqe->addr = (uint64_t)(uintptr_t)ts;
+            sqe->len = 1;
+            sqe->user_data = user_data(index, op_timeout);
+        }
+
+        // the fd field and flags of an op on the slot socket.
+        static void target(struct io_uring_sqe* sqe, const Slot& slot, size_t index) {
+            if (slot.fd < 0) {
+                sqe->fd = (int)index;
+                sqe->flags |= IOSQE_FIXED_FILE;
+            }
+            else {
+                sqe->fd = slot.fd;
+            }
+        }
+
+        // holds the ops linked behind it until `slot.departure`. an expired timeout is an error
+        // which cancels the link, unless IORING_TIMEOUT_ETIME_SUCCESS says otherwise.
+        static void prep_pace(io_uring::Ring& ring, Slot& slot, size_t index) {
+            struct io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->addr = (uint64_t)(uintptr_t)&slot.departure;
+            sqe->len = 1;
+            sqe->timeout_flags = IORING_TIMEOUT_ABS | IORING_TIMEOUT_ETIME_SUCCESS;
+            sqe->user_data = user_data(index, op_pace);
+        }
+
+        // the socket goes to registered file `index`, the connect linked behind it.
+        static void prep_socket(io_uring::Ring& ring, size_t index) {
+            struct io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_SOCKET;
+            sqe->fd = AF_INET;
+            sqe->off = SOCK_STREAM;
+            sqe->file_index = (uint32_t)index + 1;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = user_data(index, op_socket);
+        }
+
+        static void prep_connect(io_uring::Ring& ring, Slot& slot, size_t index, struct __kernel_timespec* ts) {
+            struct io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_CONNECT;
+            sqe->flags = IOSQE_IO_LINK;
+            target(sqe, slot, index);
+            sqe->addr = (uint64_t)(uintptr_t)&slot.address;
+            sqe->off = sizeof(slot.address);
+            sqe->user_data = user_data(index, op_connect);
+            prep_timeout(ring, index, ts);
+        }
+
+        static void prep_close(io_uring::Ring& ring, size_t index) {
+            struct io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->file_index = (uint32_t)index + 1;
+            sqe->user_data = user_data(index, op_close);
+        }
+
+        // the read linked behind it is canceled when the send fails or comes up short.
+        static void prep_send(io_uring::Ring& ring, Slot& slot, size_t index) {
+            struct io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_SEND;
+            sqe->flags = IOSQE_IO_LINK;
+            target(sqe, slot, index);
+            sqe->addr = (uint64_t)(uintptr_t)slot.request.data();
+            sqe->len = (uint32_t)slot.request.size();
+            sqe->msg_flags = MSG_NOSIGNAL;
+            sqe->user_data = user_data(index, op_send);
+        }
+
+        static void prep_recv(io_uring::Ring& ring, const io_uring::BufferRing& buffers, Slot& slot, size_t index, struct __kernel_timespec* ts) {
+            struct io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_RECV;
+            sqe->flags = IOSQE_IO_LINK | IOSQE_BUFFER_SELECT;
+            target(sqe, slot, index);
+            sqe->len = buffers.size();
+            sqe->buf_group = buffers.group_id();
+            sqe->user_data = user_data(index, op_recv);
+            prep_timeout(ring, index, ts);
+        }
+
+        // the registered file table is capped at the soft RLIMIT_NOFILE when it is registered,
+        // so the limit is lifted as far as the hard one allows for that call only.
+        static bool register_files(io_uring::Ring& ring, unsigned count) {
+            struct rlimit saved;
+            bool raised = false;
+            if (getrlimit(RLIMIT_NOFILE, &saved) == 0 && saved.rlim_cur < count) {
+                struct rlimit limit = saved;
+                limit.rlim_cur = (limit.rlim_max < count ? limit.rlim_max : count);
+                raised = (setrlimit(RLIMIT_NOFILE, &limit) == 0);
+            }
+
+            bool registered = ring.register_sparse_files(count);
+            if (raised) {
+                setrlimit(RLIMIT_NOFILE, &saved);
+            }
+            return registered;
+        }
+    public:
+        // `buffer_count` must be a power of 2.
+        IoUringEngine(unsigned _buffer_count = 1024, unsigned _buffer_size = 512)
+            : buffer_count{ _buffer_count }, buffer_size{ _buffer_size }, last_stats{}
+        {}
+
+        const char* name() const override {
+            return "io_uring";
+        }
+
+        const IoUringStats& stats() const {
+            return last_stats;
+        }
+
+        void scan(const ScanConfig& config, const ResultCallback& on_result) override {
+            // every slot has at most a pacing timeout, a socket, an op and its linked timeout in flight,
+            // or a send, a read and its timeout.
+            // a big window asks for more than the kernel's maximum ring, which it clamps, then
+            // the sqes are submitted in chunks and no more are in flight than the cq holds.
+            const unsigned per_connect = (config.rate > 0 ? 4 : 3);
+            unsigned entries = 1;
+            while (entries < per_connect * (unsigned)config.window) {
+                entries <<= 1;
+            }
+
+            io_uring::Ring ring{ entries, 2 * entries };
+            const size_t max_in_flight = ring.cq_entries();
+            io_uring::BufferRing buffers{ ring, buffer_group, buffer_count, buffer_size };
+
+            last_stats = IoUringStats{};
+            last_stats.buffer_ring = buffers.mapped();
+            last_stats.buffers = buffer_count;
+            last_stats.buffer_size = buffer_size;
+
+            struct __kernel_timespec timeout;
+            timeout.tv_sec = config.timeout_millisec / 1000;
+            timeout.tv_nsec = (long long)(config.timeout_millisec % 1000) * 1000000;
+
+            bool direct = ring.supports(IORING_OP_SOCKET) && register_files(ring, config.window);
+            last_stats.direct_descriptors = direct;
+
+            std::vector<Slot> slots(config.window);
+            std::vector<size_t> free_slots;
+            for (size_t i = slots.size(); i > 0; --i) {
+                slots[i - 1].stage = Stage::free;
+                slots[i - 1].fd = -1;
+                free_slots.emplace_back(i - 1);
+            }
+
+            std::deque<size_t> retry_reads;
+            std::vector<uint16_t> taken;    // buffer ids filled in the current batch of cqes.
+            std::vector<size_t> submitted;  // unpaced connects prepared in this round.
+            std::deque<size_t> closing;     // direct descriptors close through the ring too.
+            size_t total = config.ips.size() * config.ports.size();
+            size_t next = 0;
+            size_t in_flight = 0;           // sqes without their cqe yet.
+
+            // departures are a fixed gap apart, but never in the past: a scan which ran out of
+            // slots goes on at the rate, it does not burst to catch up.
+            const auto gap = std::chrono::nanoseconds(config.rate > 0 ? 1000000000LL / config.rate : 0);
+            auto next_departure = std::chrono::steady_clock::now();
+
+            // room for `n` more sqes, in the submission queue and in the completion queue.
+            auto room = [&](unsigned n) {
+                return ring.sq_space_left() >= n && in_flight + n <= max_in_flight;
+            };
+
+            auto finish = [&](size_t index) {
+                Slot& slot = slots[index];
+                if (slot.fd >= 0) {
+                    ::close(slot.fd);
+                    slot.fd = -1;
+                }
+
+                if (direct) {
+                    slot.stage = Stage::closing;
+                    closing.emplace_back(index);
+                }
+                else {
+                    slot.stage = Stage::free;
+                    free_slots.emplace_back(index);
+                }
+            };
+
+            while (next < total || in_flight > 0 || !retry_reads.empty() || !closing.empty()) {
+                while (!closing.empty() && room(1)) {
+                    prep_close(ring, closing.front());
+                    closing.pop_front();
+                    in_flight += 1;
+                }
+
+                // first reads, and reads which found the pool empty go again, now that buffers were recycled.
+                while (!retry_reads.empty() && room(3)) {
+                    Slot& slot = slots[retry_reads.front()];
+                    if (slot.request_pending) {
+                        prep_send(ring, slot, retry_reads.front());
+                        slot.request_pending = false;
+                        in_flight += 1;
+                    }
+                    prep_recv(ring, buffers, slot, retry_reads.front(), &timeout);
+                    retry_reads.pop_front();
+                    in_flight += 2;
+                }
+
+                submitted.clear();
+                size_t prepared = 0;
+                while (next < total && !free_slots.empty() && room(per_connect) && prepared < submit_batch) {
+                    size_t index = free_slots.back();
+                    Slot& slot = slots[index];
+
+                    slot.host = next / config.ports.size();
+                    slot.port = config.ports[next % config.ports.size()];
+                    ++next;
+
+                    if (config.skipped(slot.host, slot.port)) {
+                        continue;
+                    }
+
+                    std::memset(&slot.address, 0, sizeof(slot.address));
+                    slot.address.sin_family = AF_INET;
+                    slot.address.sin_port = htons(slot.port);
+                    if (inet_pton(AF_INET, config.ips[slot.host].c_str(), &slot.address.sin_addr) != 1) {
+                        continue;
+                    }
+
+                    if (!direct) {
+                        slot.fd = ::socket(AF_INET, SOCK_STREAM, 0);
+                        if (slot.fd < 0) {
+                            io_uring::detail::throw_errno(errno, "sys call socket failed");
+                        }
+                    }
+
+                    free_slots.pop_back();
+                    ++prepared;
+                    slot.stage = Stage::connecting;
+                    slot.diagnostics = ConnectDiagnostics{ 0, 0, 0, false };
+
+                    if (config.rate > 0) {
+                        slot.start = next_departure = std::max(next_departure, std::chrono::steady_clock::now());
+                        next_departure += gap;
+
+                        auto since_boot = std::chrono::duration_cast<std::chrono::nanoseconds>(slot.start.time_since_epoch()).count();
+                        slot.departure.tv_sec = since_boot / 1000000000;
+                        slot.departure.tv_nsec = since_boot % 1000000000;
+                        prep_pace(ring, slot, index);
+                        in_flight += 1;
+                    }
+                    else {
+                        submitted.emplace_back(index);
+                    }
+
+                    if (direct) {
+                        prep_socket(ring, index);
+                        in_flight += 1;
+                    }
+                    prep_connect(ring, slot, index, &timeout);
+                    in_flight += 2;
+                }
+
+                // the clocks start once every sqe is prepared, socket() calls and all, and stop when
+                // the batch is reaped, before the callbacks of the cqes ahead run. a full batch
+                // does not wait, the next one goes out after its completions so far are reaped.
+                auto now = std::chrono::steady_clock::now();
+                for (size_t index : submitted) {
+                    slots[index].start = now;
+                }
+                ring.submit_and_wait(in_flight > 0 && prepared < submit_batch ? 1 : 0);
+                auto reaped = std::chrono::steady_clock::now();
+
+                // filled buffers go back after the whole batch, so the peak is how many one batch
+                // held, not how many the kernel holds between batches.
+                taken.clear();
+                ring.for_each_cqe([&](const struct io_uring_cqe& cqe) {
+                    --in_flight;
+
+                    size_t index = (size_t)(cqe.user_data >> 8);
+                    Op op = (Op)(cqe.user_data & 0xFF);
+                    if (op == op_pace && cqe.res == -EINVAL) {
+                        io_uring::detail::throw_errno(EINVAL, "io_uring pacing timeout refused, kernel pacing needs linux 6.0 or newer");
+                    }
+                    if (op == op_socket && cqe.res < 0) {
+                        // the connect linked behind it comes back canceled, which is no timeout.
+                        // like socket() without direct descriptors, a host side failure ends the scan.
+                        io_uring::detail::throw_errno(-cqe.res, "io_uring socket failed");
+                    }
+                    if (cqe.user_data == io_uring::BufferRing::provide_user_data || op == op_timeout || op == op_socket || op == op_pace
+                        || op == op_send) {
+                        return;
+                    }
+
+                    Slot& slot = slots[index];
+
+                    if (op == op_close) {
+                        slot.stage = Stage::free;
+                        free_slots.emplace_back(index);
+                        return;
+                    }
+
+                    if (op == op_connect) {
+                        if (slot.fd >= 0 && (cqe.res == 0 || cqe.res == -ECONNREFUSED)) {
+                            slot.diagnostics = tcp_diagnostics(slot.fd);
+                        }
+
+                        if (cqe.res < 0) {
+                            // the linked timeout cancels a connect which took too long.
+                            ConnectState state = (cqe.res == -ECONNREFUSED ? ConnectState::refused
+                                                  : (cqe.res == -ECANCELED ? ConnectState::timed_out : ConnectState::failed));
+                            if (config.report_closed && state != ConnectState::failed) {
+                                on_result(ScanResult{ slot.host, slot.port, false, elapsed_micros(slot, reaped), nullptr, 0, slot.diagnostics, state });
+                            }
+                            finish(index);
+                        }
+                        else if (config.grab_banners) {
+                            slot.stage = Stage::reading;
+                            slot.connect_micros = elapsed_micros(slot, reaped);
+
+                            slot.request.resize(buffer_size);
+                            size_t n = (config.request ? config.request(slot.host, slot.port, &slot.request[0], slot.request.size()) : 0);
+                            slot.request.resize(std::min(n, slot.request.size()));
+                            slot.request_pending = !slot.request.empty();
+                            retry_reads.emplace_back(index);
+                        }
+                        else {
+                            on_result(ScanResult{ slot.host, slot.port, true, elapsed_micros(slot, reaped), nullptr, 0, slot.diagnostics, ConnectState::opened });
+                            finish(index);
+                        }
+                        return;
+                    }
+
+                    // op_recv.
+                    if (cqe.res == -ENOBUFS) {
+                        ++last_stats.buffer_exhausted;
+                        retry_reads.emplace_back(index);
+                        return;
+                    }
+
+                    if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+                        uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                        const char* data = buffers.take(bid);
+
+                        ++last_stats.reads_with_data;
+                        last_stats.bytes += cqe.res;
+                        on_result(ScanResult{ slot.host, slot.port, true, slot.connect_micros, data, (size_t)cqe.res, slot.diagnostics, ConnectState::opened });
+                        taken.emplace_back(bid);
+                    }
+                    else {
+                        ++last_stats.reads_without_data;
+                        on_result(ScanResult{ slot.host, slot.port, true, slot.connect_micros, nullptr, 0, slot.diagnostics, ConnectState::opened });
+                    }
+
+                    finish(index);
+                });
+
+                for (uint16_t bid : taken) {
+                    buffers.recycle(bid);
+                }
+                if (!taken.empty() || buffers.uncommitted()) {
+                    in_flight += buffers.commit();
+                }
+
+                last_stats.peak_buffers_per_batch = buffers.peak();
+            }
+        }
+    };
+}
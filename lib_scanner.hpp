@@ -0,0 +1,75 @@
+#pragma once
+
+// @brief  creates scan engines by name. which engines exist depends on the build:
+//           epoll   linux.
+//           raw     linux, half-open syn scan, needs CAP_NET_RAW when created.
+//           asio    build with -DPORT_SCANNER_WITH_ASIO and the asio include path.
+//           coro    linux, build with -std=c++20.
+//           io_uring  linux 5.7 or newer, build with -DPORT_SCANNER_WITH_IO_URING.
+#include <memory>
+#include <string>
+
+#include "lib_scan_engine.hpp"
+
+#ifdef __linux__
+#include "lib_scan_engine_epoll.hpp"
+#include "lib_scan_engine_raw.hpp"
+#endif
+
+#ifdef PORT_SCANNER_WITH_ASIO
+#include "lib_scan_engine_asio.hpp"
+#endif
+
+#if defined(__linux__) && __cplusplus >= 202002L
+#include "lib_probe_coro.hpp"
+#endif
+
+#if defined(__linux__) && defined(PORT_SCANNER_WITH_IO_URING)
+#include "lib_scan_engine_uring.hpp"
+#endif
+
+namespace scan_engine {
+    inline std::string available_engines() {
+        std::string names;
+#ifdef __linux__
+        names += "epoll raw ";
+#endif
+#ifdef PORT_SCANNER_WITH_ASIO
+        names += "asio ";
+#endif
+#if defined(__linux__) && __cplusplus >= 202002L
+        names += "coro ";
+#endif
+#if defined(__linux__) && defined(PORT_SCANNER_WITH_IO_URING)
+        names += "io_uring ";
+#endif
+        return names;
+    }
+
+    inline std::unique_ptr<ScanEngine> make_engine(const std::string& name) {
+#ifdef __linux__
+        if (name == "epoll") {
+            return std::unique_ptr<ScanEngine>{ new EpollEngine{} };
+        }
+        if (name == "raw") {
+            return std::unique_ptr<ScanEngine>{ new RawSynEngine{} };
+        }
+#endif
+#ifdef PORT_SCANNER_WITH_ASIO
+        if (name == "asio") {
+            return std::unique_ptr<ScanEngine>{ new AsioEngine{} };
+        }
+#endif
+#if defined(__linux__) && __cplusplus >= 202002L
+        if (name == "coro") {
+            return std::unique_ptr<ScanEngine>{ new probe_coro::CoroEngine{} };
+        }
+#endif
+#if defined(__linux__) && defined(PORT_SCANNER_WITH_IO_URING)
+        if (name == "io_uring") {
+            return std::unique_ptr<ScanEngine>{ new IoUringEngine{} };
+        }
+#endif
+        throw EngineUnavailableException{ name, available_engines() };
+    }
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+// @brief  single producer single consumer result ring in shared memory, for a local
+//         process which wants the results as they arrive without parsing stdout.
+//         the ring lives in a memfd, consumers map it through /proc/<pid>/fd/<fd>.
+//         the fast path is plain loads and stores, a futex is only touched when the
+//         consumer sleeps on an empty ring. when the ring is full, results are dropped
+//         and counted rather than blocking the scan.
+#include <stdexcept>
+#include <system_error>
+#include <string>
+#include <atomic>
+#include <new>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+namespace shm_channel {
+    const uint32_t channel_magic = 0x52435350;     // "PSCR".
+    const uint32_t channel_version = 1;
+
+    struct ShmResult {
+        uint32_t ipv4;          // network byte order.
+        uint16_t port;
+        uint8_t state;          // 0 closed, 1 opened.
+        uint8_t reserved;
+        uint32_t rtt_micros;
+        uint32_t reserved2;
+        int64_t timestamp_micros;
+    };
+
+    struct alignas(64) ChannelHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t capacity;      // power of 2.
+        uint32_t record_size;
+
+        alignas(64) std::atomic<uint64_t> head;         // written by the producer.
+        std::atomic<uint64_t> dropped;
+        std::atomic<uint32_t> closed;
+
+        alignas(64) std::atomic<uint64_t> tail;         // written by the consumer.
+        std::atomic<uint32_t> waiting;
+        std::atomic<uint32_t> wake_seq;                 // futex word.
+    };
+
+    namespace detail {
+        inline size_t mapping_size(uint32_t capacity) {
+            return sizeof(ChannelHeader) + (size_t)capacity * sizeof(ShmResult);
+        }
+
+        inline long futex(std::atomic<uint32_t>* addr, int op, uint32_t val, const struct timespec* timeout) {
+            return syscall(SYS_futex, (uint32_t*)addr, op, val, timeout, nullptr, 0);
+        }
+
+        inline void throw_errno(const char* what) {
+            std::error_code ec(errno, std::system_category());
+            throw std::system_error{ ec, what };
+        }
+    }
+
+    class ShmProducer {
+        int fd;
+        ChannelHeader* header;
+        ShmResult* records;
+        uint64_t head;          // local copy, only this side writes it.
+        uint64_t cached_tail;
+    public:
+        ShmProducer(uint32_t capacity = 1 << 20)
+            : fd{ -1 }, header{ nullptr }, records{ nullptr }, head{ 0 }, cached_tail{ 0 }
+        {
+            if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+                throw std::invalid_argument{ "shm channel capacity must be a power of 2" };
+            }
+
+#ifdef __NR_memfd_create
+            fd = (int)syscall(__NR_memfd_create, "port_scanner_results", 0);
+#else
+            errno = ENOSYS;
+#endif
+            if (fd < 0) {
+                detail::throw_errno("sys call memfd_create failed");
+            }
+
+            size_t size = detail::mapping_size(capacity);
+            if (ftruncate(fd, (off_t)size) < 0) {
+                ::close(fd);
+                detail::throw_errno("sys call ftruncate failed");
+            }
+
+            void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED) {
+                ::close(fd);
+                detail::throw_errno("sys call mmap failed");
+            }
+
+            header = new (addr) ChannelHeader{};
+            header->magic = channel_magic;
+            header->version = channel_version;
+            header->capacity = capacity;
+            header->record_size = sizeof(ShmResult);
+            records = (ShmResult*)(header + 1);
+        }
+
+        ShmProducer(const ShmProducer&) = delete;
+        ShmProducer& operator=(const ShmProducer&) = delete;
+
+        ~ShmProducer() {
+            close();
+            munmap(header, detail::mapping_size(header->capacity));
+            ::close(fd);
+        }
+
+        // the path a consumer of another process opens.
+        std::string path() const {
+            return "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(fd);
+        }
+
+        // returns false when the ring is full, the result is dropped.
+        bool publish(const ShmResult& result) {
+            if (head - cached_tail >= header->capacity) {
+                cached_tail = header->tail.load(std::memory_order_acquire);
+                if (head - cached_tail >= header->capacity) {
+                    header->dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+
+            records[head & (header->capacity - 1)] = result;
+            ++head;
+            header->head.store(head, std::memory_order_seq_cst);
+
+            // one wake per sleep, the flag is cleared here so later publishes stay syscall free.
+            if (header->waiting.load(std::memory_order_seq_cst) && header->waiting.exchange(0)) {
+                header->wake_seq.fetch_add(1, std::memory_order_seq_cst);
+                detail::futex(&header->wake_seq, FUTEX_WAKE, 1, nullptr);
+            }
+            return true;
+        }
+
+        void close() {
+            if (header && !header->closed.exchange(1)) {
+                header->wake_seq.fetch_add(1);
+                detail::futex(&header->wake_seq, FUTEX_WAKE, 1, nullptr);
+            }
+        }
+    };
+
+    class ShmConsumer {
+        int fd;
+        size_t size;
+        ChannelHeader* header;
+        const ShmResult* records;
+        uint64_t tail;
+    public:
+        // `path` is `ShmProducer::path()` of the scanner process.
+        ShmConsumer(const std::string& path)
+            : fd{ open(path.c_str(), O_RDWR) }, size{ 0 }, header{ nullptr }, records{ nullptr }, tail{ 0 }
+        {
+            if (fd < 0) {
+                detail::throw_errno("open shm channel failed");
+            }
+
+            struct stat st;
+            if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ChannelHeader)) {
+                ::close(fd);
+                throw std::runtime_error{ "not a shm channel: " + path };
+            }
+
+            size = (size_t)st.st_size;
+            void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED) {
+                ::close(fd);
+                detail::throw_errno("sys call mmap failed");
+            }
+
+            header = (ChannelHeader*)addr;
+            if (header->magic != channel_magic || header->version != channel_version
+                || header->record_size != sizeof(ShmResult) || detail::mapping_size(header->capacity) > size) {
+                munmap(addr, size);
+                ::close(fd);
+                throw std::runtime_error{ "not a shm channel: " + path };
+            }
+
+            records = (const ShmResult*)(header + 1);
+            tail = header->tail.load(std::memory_order_relaxed);
+        }
+
+        ShmConsumer(const ShmConsumer&) = delete;
+        ShmConsumer& operator=(const ShmConsumer&) = delete;
+
+        ~ShmConsumer() {
+            munmap(header, size);
+            ::close(fd);
+        }
+
+        // copies up to `max` results, never blocks.
+        size_t poll(ShmResult* out, size_t max) {
+            uint64_t head = header->head.load(std::memory_order_acquire);
+            size_t n = 0;
+
+            while (tail != head && n < max) {
+                out[n++] = records[tail & (header->capacity - 1)];
+                ++tail;
+            }
+
+            header->tail.store(tail, std::memory_order_release);
+            return n;
+        }
+
+        // sleeps until results are available, the producer closed, or the timeout passed.
+        void wait(int timeout_millisec) {
+            uint32_t seq = header->wake_seq.load(std::memory_order_seq_cst);
+            header->waiting.store(1, std::memory_order_seq_cst);
+
+            if (header->head.load(std::memory_order_seq_cst) == tail && !header->closed.load()) {
+                struct timespec ts;
+                ts.tv_sec = timeout_millisec / 1000;
+                ts.tv_nsec = (long)(timeout_millisec % 1000) * 1000000;
+                detail::futex(&header->wake_seq, FUTEX_WAIT, seq, &ts);
+            }
+
+            header->waiting.store(0, std::memory_order_relaxed);
+        }
+
+        bool closed() const {
+            return header->closed.load() && header->head.load(std::memory_order_acquire) == tail;
+        }
+
+        uint64_t dropped() const {
+            return header->dropped.load(std::memory_order_relaxed);
+        }
+    };
+}
@@ -0,0 +1,370 @@
+#pragma once
+
+// @brief  the listening tcp sockets of this machine, straight from the kernel through
+//         netlink sock_diag (inet_diag), one dump instead of a connect per port.
+//         `NetnsScope` moves the calling thread into another network namespace, a
+//         container's for example, and back, so its listeners can be listed too.
+//         `LocalEngine` answers local targets from the listeners and hands every other
+//         target to a real engine, with results in the same form either way.
+#include <system_error>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/rtnetlink.h>
+#include <netinet/in.h>
+#include <ifaddrs.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lib_scan_engine.hpp"
+
+namespace sock_diag {
+    namespace detail {
+        inline void throw_errno(int err, const std::string& what) {
+            std::error_code ec(err, std::system_category());
+            throw std::system_error{ ec, what };
+        }
+
+        const int tcp_listen = 10;      // TCP_LISTEN of the kernel's tcp states.
+    }
+
+    // a listening socket, a v4 one or a v6 one which also takes v4 connections.
+    struct Listener {
+        uint32_t ipv4;          // host byte order, 0 for any address.
+        uint16_t port;
+    };
+
+    // raii netlink socket for sock_diag.
+    class DiagSocket {
+        int fd;
+    public:
+        DiagSocket() {
+            fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+            if (fd < 0) {
+                detail::throw_errno(errno, "sys call socket failed on `NETLINK_SOCK_DIAG`");
+            }
+        }
+
+        DiagSocket(const DiagSocket&) = delete;
+        DiagSocket& operator=(const DiagSocket&) = delete;
+
+        ~DiagSocket() {
+            close(fd);
+        }
+
+        // calls func(msg, attributes_length) for every socket of the dump.
+        template<typename Func>
+        void dump(uint8_t family, uint32_t states, Func func) {
+            struct {
+                struct nlmsghdr nlh;
+                struct inet_diag_req_v2 req;
+            } request;
+            std::memset(&request, 0, sizeof(request));
+
+            request.nlh.nlmsg_len = sizeof(request);
+            request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+            request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+            request.req.sdiag_family = family;
+            request.req.sdiag_protocol = IPPROTO_TCP;
+            request.req.idiag_states = states;
+
+            struct sockaddr_nl kernel;
+            std::memset(&kernel, 0, sizeof(kernel));
+            kernel.nl_family = AF_NETLINK;
+
+            if (sendto(fd, &request, sizeof(request), 0, (struct sockaddr*)&kernel, sizeof(kernel)) < 0) {
+                detail::throw_errno(errno, "sys call sendto failed on sock_diag");
+            }
+
+            alignas(struct nlmsghdr) char buf[32 * 1024];
+            while (true) {
+                ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    detail::throw_errno(errno, "sys call recv failed on sock_diag");
+                }
+
+                int left = (int)n;
+                for (struct nlmsghdr* nlh = (struct nlmsghdr*)buf; NLMSG_OK(nlh, left); nlh = NLMSG_NEXT(nlh, left)) {
+                    if (nlh->nlmsg_type == NLMSG_DONE) {
+                        return;
+                    }
+                    if (nlh->nlmsg_type == NLMSG_ERROR) {
+                        const struct nlmsgerr* err = (const struct nlmsgerr*)NLMSG_DATA(nlh);
+                        detail::throw_errno(-err->error, "sock_diag dump failed");
+                    }
+
+                    const struct inet_diag_msg* msg = (const struct inet_diag_msg*)NLMSG_DATA(nlh);
+                    func(msg, (int)(nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*msg))));
+                }
+            }
+        }
+    };
+
+    // the tcp listeners of the calling thread's network namespace which take ipv4 connections.
+    inline std::vector<Listener> tcp_listeners() {
+        std::vector<Listener> listeners;
+        DiagSocket diag;
+
+        diag.dump(AF_INET, 1u << detail::tcp_listen, [&listeners](const struct inet_diag_msg* msg, int) {
+            listeners.emplace_back(Listener{ ntohl(msg->id.idiag_src[0]), ntohs(msg->id.idiag_sport) });
+        });
+
+        // a v6 socket on `::` takes v4 too unless it is v6 only, one on ::ffff:a.b.c.d takes a.b.c.d.
+        diag.dump(AF_INET6, 1u << detail::tcp_listen, [&listeners](const struct inet_diag_msg* msg, int length) {
+            const uint32_t* src = msg->id.idiag_src;
+            bool any = (src[0] == 0 && src[1] == 0 && src[2] == 0 && src[3] == 0);
+            bool mapped = (src[0] == 0 && src[1] == 0 && src[2] == htonl(0xFFFF));
+
+            bool v6only = false;
+            const struct rtattr* attr = (const struct rtattr*)(msg + 1);
+            for (; RTA_OK(attr, length); attr = RTA_NEXT(attr, length)) {
+                if (attr->rta_type == INET_DIAG_SKV6ONLY) {
+                    v6only = (*(const uint8_t*)RTA_DATA(attr) != 0);
+                }
+            }
+
+            if (any && !v6only) {
+                listeners.emplace_back(Listener{ 0, ntohs(msg->id.idiag_sport) });
+            }
+            else if (mapped) {
+                listeners.emplace_back(Listener{ ntohl(src[3]), ntohs(msg->id.idiag_sport) });
+            }
+        });
+
+        return listeners;
+    }
+
+    // the ipv4 addresses of the calling thread's network namespace, host byte order.
+    inline std::vector<uint32_t> local_addresses() {
+        std::vector<uint32_t> addresses;
+
+        struct ifaddrs* list = nullptr;
+        if (getifaddrs(&list) < 0) {
+            detail::throw_errno(errno, "sys call getifaddrs failed");
+        }
+        for (struct ifaddrs* it = list; it; it = it->ifa_next) {
+            if (it->ifa_addr && it->ifa_addr->sa_family == AF_INET) {
+                addresses.emplace_back(ntohl(((const struct sockaddr_in*)it->ifa_addr)->sin_addr.s_addr));
+            }
+        }
+        freeifaddrs(list);
+
+        return addresses;
+    }
+
+    // raii, the calling thread is in the network namespace at `path` while this lives, a
+    // /proc/<pid>/ns/net or /var/run/netns/<name>. needs CAP_SYS_ADMIN.
+    class NetnsScope {
+        int original;
+    public:
+        NetnsScope(const std::string& path) : original{ -1 } {
+            original = ::open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+            if (original < 0) {
+                detail::throw_errno(errno, "open /proc/thread-self/ns/net failed");
+            }
+
+            int target = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (target < 0) {
+                int err = errno;
+                close(original);
+                detail::throw_errno(err, "open " + path + " failed");
+            }
+
+            int ret = setns(target, CLONE_NEWNET);
+            int err = errno;
+            close(target);
+            if (ret < 0) {
+                close(original);
+                detail::throw_errno(err, "sys call setns failed on " + path);
+            }
+        }
+
+        NetnsScope(const NetnsScope&) = delete;
+        NetnsScope& operator=(const NetnsScope&) = delete;
+
+        ~NetnsScope() {
+            // going back cannot fail for a namespace this thread was in.
+            setns(original, CLONE_NEWNET);
+            close(original);
+        }
+    };
+
+    // the listeners of this machine and of the given namespaces, by the address they answer on.
+    class LocalListeners {
+        std::vector<uint32_t> host_addresses;               // sorted, the loopback net is implied.
+        std::vector<uint32_t> netns_addresses;              // sorted, of the other namespaces.
+        std::vector<std::pair<uint32_t, uint16_t>> bound;   // sorted (address, port), address 0 for any of the host's.
+
+        bool is_host_address(uint32_t address) const {
+            return (address >> 24) == 127 || std::binary_search(host_addresses.begin(), host_addresses.end(), address);
+        }
+
+        void add_namespace(bool with_loopback) {
+            std::vector<uint32_t> own = local_addresses();
+            std::vector<Listener> listeners = tcp_listeners();
+
+            // a namespace's loopback is its own, from outside only its other addresses reach it.
+            auto reachable = [with_loopback](uint32_t address) {
+                return with_loopback || (address >> 24) != 127;
+            };
+
+            for (uint32_t address : own) {
+                if (reachable(address)) {
+                    (with_loopback ? host_addresses : netns_addresses).emplace_back(address);
+                }
+            }
+            for (const auto& listener : listeners) {
+                if (listener.ipv4 != 0) {
+                    if (reachable(listener.ipv4)) {
+                        bound.emplace_back(listener.ipv4, listener.port);
+                    }
+                    continue;
+                }
+
+                // on any address, the host namespace keeps it as is, another one gets it per address.
+                if (with_loopback) {
+                    bound.emplace_back(0, listener.port);
+                }
+                else {
+                    for (uint32_t address : own) {
+                        if (reachable(address)) {
+                            bound.emplace_back(address, listener.port);
+                        }
+                    }
+                }
+            }
+        }
+    public:
+        LocalListeners(const std::vector<std::string>& netns_paths) : host_addresses{}, netns_addresses{}, bound{} {
+            add_namespace(true);
+            for (const auto& path : netns_paths) {
+                NetnsScope scope{ path };
+                add_namespace(false);
+            }
+
+            std::sort(host_addresses.begin(), host_addresses.end());
+            std::sort(netns_addresses.begin(), netns_addresses.end());
+            std::sort(bound.begin(), bound.end());
+        }
+
+        bool is_local(uint32_t address) const {
+            return is_host_address(address) || std::binary_search(netns_addresses.begin(), netns_addresses.end(), address);
+        }
+
+        // whether a connect to (address, port) of a local address would be accepted.
+        bool is_listening(uint32_t address, uint16_t port) const {
+            if (std::binary_search(bound.begin(), bound.end(), std::make_pair(address, port))) {
+                return true;
+            }
+            // the host's listeners on any address do not take connects to another namespace.
+            return is_host_address(address) && std::binary_search(bound.begin(), bound.end(), std::make_pair(0u, port));
+        }
+
+        size_t size() const {
+            return bound.size();
+        }
+    };
+
+    // answers local targets from the kernel's listeners, the rest goes to `remote`.
+    class LocalEngine : public scan_engine::ScanEngine {
+        scan_engine::ScanEngine& remote;
+        std::vector<std::string> netns_paths;
+        size_t local_hosts;
+    public:
+        LocalEngine(scan_engine::ScanEngine& _remote, const std::vector<std::string>& _netns_paths)
+            : remote(_remote), netns_paths{ _netns_paths }, local_hosts{ 0 }
+        {}
+
+        const char* name() const override {
+            return "local";
+        }
+
+        void scan(const scan_engine::ScanConfig& config, const scan_engine::ResultCallback& on_result) override {
+            LocalListeners listeners{ netns_paths };
+
+            scan_engine::ScanConfig remote_config = config;
+            remote_config.ips.clear();
+            std::vector<size_t> remote_hosts;
+            std::vector<uint32_t> banner_hosts;     // per remote host, its local address, 0 for a real remote.
+            local_hosts = 0;
+
+            for (size_t host = 0; host < config.ips.size(); ++host) {
+                struct in_addr addr;
+                uint32_t address = (inet_pton(AF_INET, config.ips[host].c_str(), &addr) == 1 ? ntohl(addr.s_addr) : 0);
+
+                if (address == 0 || !listeners.is_local(address)) {
+                    remote_config.ips.emplace_back(config.ips[host]);
+                    remote_hosts.emplace_back(host);
+                    banner_hosts.emplace_back(0);
+                    continue;
+                }
+
+                ++local_hosts;
+                // listeners have no banner to give, their ports go to the remote engine to read one.
+                if (config.grab_banners) {
+                    remote_config.ips.emplace_back(config.ips[host]);
+                    remote_hosts.emplace_back(host);
+                    banner_hosts.emplace_back(address);
+                }
+
+                // a local port nobody listens on answers a connect with a rst.
+                for (int port : config.ports) {
+                    if (config.skipped(host, port)) {
+                        continue;
+                    }
+                    bool listening = listeners.is_listening(address, (uint16_t)port);
+                    if (listening && config.grab_banners) {
+                        continue;
+                    }
+                    if (listening || config.report_closed) {
+                        on_result(scan_engine::ScanResult{ host, port, listening, 0, nullptr, 0, scan_engine::ConnectDiagnostics{},
+                                                           (listening ? scan_engine::ConnectState::opened : scan_engine::ConnectState::refused) });
+                    }
+                }
+            }
+
+            if (remote_hosts.empty()) {
+                return;
+            }
+
+            // the remote engine sees only remote hosts, and the listening ports of local ones
+            // when banners are read, its indexes are mapped back.
+            if (config.skip || config.grab_banners) {
+                remote_config.skip = [&config, &remote_hosts, &banner_hosts, &listeners](size_t host, int port) {
+                    if (banner_hosts[host] != 0 && !listeners.is_listening(banner_hosts[host], (uint16_t)port)) {
+                        return true;
+                    }
+                    return config.skipped(remote_hosts[host], port);
+                };
+            }
+            if (config.request) {
+                remote_config.request = [&config, &remote_hosts](size_t host, int port, char* buf, size_t cap) {
+                    return config.request(remote_hosts[host], port, buf, cap);
+                };
+            }
+            remote.scan(remote_config, [&on_result, &remote_hosts](const scan_engine::ScanResult& result) {
+                scan_engine::ScanResult mapped = result;
+                mapped.host_index = remote_hosts[result.host_index];
+                on_result(mapped);
+            });
+        }
+
+        // hosts of the last scan answered from the listeners.
+        size_t local_host_count() const {
+            return local_hosts;
+        }
+    };
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+// @brief  writes scan results into a sqlite database, build with -lsqlite3.
+//         results are buffered on the scan thread, a background thread inserts each
+//         buffer with one prepared statement inside one transaction (wal mode),
+//         so the scan loop only pays for a push_back.
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include <sqlite3.h>
+
+namespace sqlite_sink {
+    class SqliteException : public std::runtime_error {
+    public:
+        SqliteException(const std::string& msg)
+            : std::runtime_error{ "sqlite error: " + msg }
+        {}
+    };
+
+    struct ResultRow {
+        std::string host;
+        int port;
+        int state;      // 0 closed, 1 opened.
+        int rtt_micros;
+        int64_t timestamp_micros;
+    };
+
+    class SqliteSink {
+        sqlite3* db;
+        sqlite3_stmt* insert_stmt;
+        size_t batch_rows;
+
+        std::vector<ResultRow> buffer;      // owned by the scan thread.
+
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::vector<ResultRow> pending;
+        bool stopping;
+        std::string error;
+
+        std::thread writer;
+
+        void check(int rc, const char* what) {
+            if (rc != SQLITE_OK && rc != SQLITE_DONE && rc != SQLITE_ROW) {
+                throw SqliteException{ std::string{ what } + ": " + sqlite3_errmsg(db) };
+            }
+        }
+
+        void exec(const char* sql) {
+            check(sqlite3_exec(db, sql, nullptr, nullptr, nullptr), sql);
+        }
+
+        void insert_all(const std::vector<ResultRow>& rows) {
+            exec("BEGIN");
+
+            for (const auto& row : rows) {
+                sqlite3_bind_text(insert_stmt, 1, row.host.data(), (int)row.host.size(), SQLITE_STATIC);
+                sqlite3_bind_int(insert_stmt, 2, row.port);
+                sqlite3_bind_int(insert_stmt, 3, row.state);
+                sqlite3_bind_int(insert_stmt, 4, row.rtt_micros);
+                sqlite3_bind_int64(insert_stmt, 5, row.timestamp_micros);
+
+                check(sqlite3_step(insert_stmt), "insert");
+                sqlite3_reset(insert_stmt);
+            }
+
+            exec("COMMIT");
+        }
+
+        void writer_loop() {
+            std::vector<ResultRow> rows;
+
+            try {
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock{ mtx };
+                        cv.wait(lock, [this] { return stopping || !pending.empty(); });
+
+                        if (pending.empty()) {
+                            break;
+                        }
+
+                        rows.swap(pending);
+                    }
+
+                    insert_all(rows);
+                    rows.clear();
+                }
+            }
+            catch (const SqliteException& e) {
+                std::lock_guard<std::mutex> lock{ mtx };
+                error = e.what();
+            }
+        }
+
+        void submit_buffer() {
+            if (buffer.empty()) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock{ mtx };
+            if (pending.empty()) {
+                pending.swap(buffer);
+            }
+            else {
+                // the writer is behind, keep growing its next batch instead of waiting.
+                pending.insert(pending.end(), buffer.begin(), buffer.end());
+                buffer.clear();
+            }
+            cv.notify_one();
+        }
+    public:
+        SqliteSink(const std::string& filePath, size_t _batch_rows = 16384)
+            : db{ nullptr }, insert_stmt{ nullptr }, batch_rows{ _batch_rows }, buffer{}, mtx{}, cv{},
+              pending{}, stopping{ false }, error{}, writer{}
+        {
+            if (sqlite3_open(filePath.c_str(), &db) != SQLITE_OK) {
+                std::string msg = (db ? sqlite3_errmsg(db) : "out of memory");
+                sqlite3_close(db);
+                throw SqliteException{ "open " + filePath + " failed: " + msg };
+            }
+
+            try {
+                exec("PRAGMA journal_mode = WAL");
+                exec("PRAGMA synchronous = NORMAL");
+                exec("CREATE TABLE IF NOT EXISTS results ("
+                     "host TEXT NOT NULL, port INTEGER NOT NULL, state INTEGER NOT NULL, "
+                     "rtt_micros INTEGER NOT NULL, timestamp_micros INTEGER NOT NULL)");
+
+                const char* sql = "INSERT INTO results VALUES (?, ?, ?, ?, ?)";
+                check(sqlite3_prepare_v2(db, sql, -1, &insert_stmt, nullptr), sql);
+            }
+            catch (...) {
+                sqlite3_close(db);
+                throw;
+            }
+
+            buffer.reserve(batch_rows);
+            writer = std::thread{ &SqliteSink::writer_loop, this };
+        }
+
+        SqliteSink(const SqliteSink&) = delete;
+        SqliteSink& operator=(const SqliteSink&) = delete;
+
+        ~SqliteSink() {
+            try {
+                close();
+            }
+            catch (...) {}
+        }
+
+        void append(const std::string& host, int port, bool opened, int rtt_micros, int64_t timestamp_micros) {
+            buffer.emplace_back(ResultRow{ host, port, opened ? 1 : 0, rtt_micros, timestamp_micros });
+
+            if (buffer.size() >= batch_rows) {
+                submit_buffer();
+                buffer.reserve(batch_rows);
+            }
+        }
+
+        void close() {
+            if (!db) {
+                return;
+            }
+
+            submit_buffer();
+            {
+                std::lock_guard<std::mutex> lock{ mtx };
+                stopping = true;
+                cv.notify_one();
+            }
+
+            writer.join();
+            sqlite3_finalize(insert_stmt);
+            sqlite3_close(db);
+            db = nullptr;
+
+            if (!error.empty()) {
+                throw SqliteException{ error };
+            }
+        }
+    };
+}
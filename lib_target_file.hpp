@@ -0,0 +1,530 @@
+#pragma once
+
+// @brief  parser for large target and exclusion files, millions of lines of
+//             10.0.0.1
+//             192.168.0.0/16      # comments and blank lines are skipped
+//         the file is mapped, not read, lines are found 16 bytes at a time with sse2 and
+//         handed out as views into the mapping, so no line is ever copied or allocated.
+//         entries are parsed straight into binary networks, then canonicalized: sorted
+//         (radix sorted in parallel for large lists), overlaps merged, excludes taken out.
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <array>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace target_file {
+    class TargetFileException : public std::runtime_error {
+    public:
+        TargetFileException(const std::string& msg)
+            : std::runtime_error{ "target file error: " + msg }
+        {}
+    };
+
+    // a piece of a mapped file, valid while the mapping lives.
+    struct View {
+        const char* data;
+        size_t size;
+
+        std::string str() const {
+            return std::string{ data, size };
+        }
+    };
+
+    // an ipv4 network in host byte order, a single address is a /32.
+    struct Ipv4Network {
+        uint32_t address;
+        uint32_t prefix;
+
+        uint32_t first() const {
+            return (prefix == 0 ? 0 : address & (0xFFFFFFFFu << (32 - prefix)));
+        }
+
+        uint32_t last() const {
+            return first() | (prefix == 0 ? 0xFFFFFFFFu : ~(0xFFFFFFFFu << (32 - prefix)));
+        }
+    };
+
+    struct ParseStats {
+        size_t lines;
+        size_t entries;
+        size_t invalid;
+        size_t first_invalid_line;      // 1-based, 0 when every line parsed.
+    };
+
+    // raii read-only mapping of a whole file.
+    class MappedFile {
+        void* addr;
+        size_t length;
+    public:
+        MappedFile(const std::string& path) : addr{ nullptr }, length{ 0 } {
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                throw TargetFileException{ "open " + path + " failed, " + std::strerror(errno) };
+            }
+
+            struct stat st;
+            if (fstat(fd, &st) < 0) {
+                int err = errno;
+                ::close(fd);
+                throw TargetFileException{ "stat " + path + " failed, " + std::strerror(err) };
+            }
+
+            length = (size_t)st.st_size;
+            if (length > 0) {
+                addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+                if (addr == MAP_FAILED) {
+                    int err = errno;
+                    addr = nullptr;
+                    ::close(fd);
+                    throw TargetFileException{ "mmap " + path + " failed, " + std::strerror(err) };
+                }
+                madvise(addr, length, MADV_SEQUENTIAL);
+            }
+
+            ::close(fd);
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile() {
+            if (addr) {
+                munmap(addr, length);
+            }
+        }
+
+        const char* data() const {
+            return (const char*)addr;
+        }
+
+        size_t size() const {
+            return length;
+        }
+    };
+
+    namespace detail {
+        // the first `c` in [p, end), or end.
+        inline const char* find_byte(const char* p, const char* end, char c) {
+#if defined(__SSE2__)
+            const __m128i needle = _mm_set1_epi8(c);
+            while (end - p >= 16) {
+                __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+                int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+                if (mask != 0) {
+                    return p + __builtin_ctz(mask);
+                }
+                p += 16;
+            }
+#endif
+            const void* hit = std::memchr(p, c, end - p);
+            return (hit ? (const char*)hit : end);
+        }
+
+        inline bool is_blank(char c) {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        inline View trim_blanks(const char* p, const char* end) {
+            while (p < end && is_blank(*p)) {
+                ++p;
+            }
+            while (end > p && is_blank(end[-1])) {
+                --end;
+            }
+            return View{ p, (size_t)(end - p) };
+        }
+
+        // trims blanks and a trailing comment.
+        inline View trim(const char* p, const char* end) {
+            const char* hash = (const char*)std::memchr(p, '#', end - p);
+            if (hash) {
+                end = hash;
+            }
+            while (p < end && is_blank(*p)) {
+                ++p;
+            }
+            while (end > p && is_blank(end[-1])) {
+                --end;
+            }
+            return View{ p, (size_t)(end - p) };
+        }
+
+        // up to `max_digits` digits no greater than `max`, advances p.
+        inline bool parse_number(const char*& p, const char* end, uint32_t max, int max_digits, uint32_t& out) {
+            uint32_t n = 0;
+            int digits = 0;
+            while (p < end && *p >= '0' && *p <= '9' && digits < max_digits) {
+                n = n * 10 + (uint32_t)(*p - '0');
+                ++p;
+                ++digits;
+            }
+            out = n;
+            return digits > 0 && n <= max;
+        }
+
+        // one to three digits no greater than 255, without a branch per digit. reads 4 bytes
+        // from p, only bytes before `end` count, `readable` bounds what may be loaded.
+        inline bool parse_octet(const char*& p, const char* end, const char* readable, uint32_t& out) {
+            if (readable - p < 4) {
+                return parse_number(p, end, 255, 3, out);
+            }
+
+            uint32_t word;
+            std::memcpy(&word, p, 4);
+
+            // ascii digits become 0..9, anything else has a byte above 9.
+            uint32_t x = word ^ 0x30303030u;
+            uint32_t nondigit = ((x + 0x76767676u) | x) & 0x80808080u;
+            if (end - p < 4) {
+                nondigit |= 0x80808080u << (8 * (end - p));
+            }
+            if (nondigit == 0) {
+                return false;
+            }
+
+            int len = __builtin_ctz(nondigit) / 8;
+            if (len == 0) {
+                return false;
+            }
+
+            // the digits moved to the top bytes, the most significant first.
+            x <<= 8 * (4 - len);
+            uint32_t value = ((x >> 8) & 0xFF) * 100 + ((x >> 16) & 0xFF) * 10 + (x >> 24);
+
+            p += len;
+            out = value;
+            return value <= 255;
+        }
+    }
+
+    // calls func(line) for every line, the view excludes the '\n'.
+    template<typename Func>
+    void for_each_line(const char* data, size_t size, Func func) {
+        const char* p = data;
+        const char* end = data + size;
+
+        while (p < end) {
+            const char* nl = detail::find_byte(p, end, '\n');
+            func(View{ p, (size_t)(nl - p) });
+            p = nl + 1;
+        }
+    }
+
+    // "a.b.c.d" or "a.b.c.d/n", nothing else on the view. `readable` is how far past the
+    // view memory may be read, the end of the mapping for views of a mapped file.
+    inline bool parse_ipv4_network(View text, Ipv4Network& network, const char* readable = nullptr) {
+        const char* p = text.data;
+        const char* end = text.data + text.size;
+        uint32_t address = 0;
+
+        if (readable == nullptr) {
+            readable = end;
+        }
+
+        for (int i = 0; i < 4; ++i) {
+            uint32_t octet;
+            if (!detail::parse_octet(p, end, readable, octet)) {
+                return false;
+            }
+            address = (address << 8) | octet;
+
+            if (i < 3) {
+                if (p >= end || *p != '.') {
+                    return false;
+                }
+                ++p;
+            }
+        }
+
+        uint32_t prefix = 32;
+        if (p < end && *p == '/') {
+            ++p;
+            if (!detail::parse_number(p, end, 32, 2, prefix)) {
+                return false;
+            }
+        }
+
+        if (p != end) {
+            return false;
+        }
+
+        network.address = address;
+        network.prefix = prefix;
+        return true;
+    }
+
+    // appends every entry of a mapped target file to `networks`.
+    inline ParseStats parse_targets(const char* data, size_t size, std::vector<Ipv4Network>& networks) {
+        ParseStats stats = ParseStats{};
+
+        // entries take 8 to 19 bytes, guess from the low end of typical lines.
+        networks.reserve(networks.size() + size / 12);
+
+        for_each_line(data, size, [&](View line) {
+            ++stats.lines;
+
+            // most lines are a bare entry, only look for a comment when that fails.
+            Ipv4Network network;
+            View entry = detail::trim_blanks(line.data, line.data + line.size);
+            bool parsed = (entry.size > 0 && parse_ipv4_network(entry, network, data + size));
+
+            if (!parsed) {
+                entry = detail::trim(line.data, line.data + line.size);
+                if (entry.size == 0) {
+                    return;
+                }
+                parsed = parse_ipv4_network(entry, network, data + size);
+            }
+
+            if (parsed) {
+                networks.emplace_back(network);
+                ++stats.entries;
+            }
+            else {
+                ++stats.invalid;
+                if (stats.first_invalid_line == 0) {
+                    stats.first_invalid_line = stats.lines;
+                }
+            }
+        });
+
+        return stats;
+    }
+
+    inline ParseStats load_targets(const std::string& path, std::vector<Ipv4Network>& networks) {
+        MappedFile file{ path };
+        return parse_targets(file.data(), file.size(), networks);
+    }
+
+    // calls func(key, value) for every "key = value" line, the same syntax as config_parser.
+    template<typename Func>
+    void for_each_key_value(const char* data, size_t size, Func func) {
+        for_each_line(data, size, [&](View line) {
+            const char* end = line.data + line.size;
+            const char* eq = (const char*)std::memchr(line.data, '=', line.size);
+            if (!eq) {
+                return;
+            }
+
+            const char* key_begin = line.data;
+            while (key_begin < eq && detail::is_blank(*key_begin)) {
+                ++key_begin;
+            }
+            const char* key_end = key_begin;
+            while (key_end < eq && !detail::is_blank(*key_end)) {
+                ++key_end;
+            }
+
+            const char* value_begin = eq + 1;
+            while (value_begin < end && detail::is_blank(*value_begin)) {
+                ++value_begin;
+            }
+            const char* value_end = end;
+            while (value_end > value_begin && detail::is_blank(value_end[-1])) {
+                --value_end;
+            }
+
+            if (key_end > key_begin && value_end > value_begin) {
+                func(View{ key_begin, (size_t)(key_end - key_begin) }, View{ value_begin, (size_t)(value_end - value_begin) });
+            }
+        });
+    }
+
+    // inclusive [first, last] address ranges, sorted and disjoint.
+    using Ranges = std::vector<std::pair<uint32_t, uint32_t>>;
+
+    // what canonicalizing a target list did.
+    struct TargetStats {
+        uint64_t listed;        // addresses over every entry, duplicates counted each time.
+        uint64_t unique;        // distinct addresses left after the excludes.
+        uint64_t excluded;      // distinct addresses the excludes took out.
+        size_t ranges;          // disjoint ranges they make up.
+    };
+
+    namespace detail {
+        // runs func(id) for id in [0, threads), on threads - 1 new threads and this one.
+        template<typename Func>
+        void run_parallel(unsigned threads, Func func) {
+            std::vector<std::thread> workers;
+            for (unsigned id = 1; id < threads; ++id) {
+                workers.emplace_back(func, id);
+            }
+            func(0);
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+
+        // stable lsd radix sort of keys by their top 32 bits, a byte per pass. every thread
+        // counts and scatters its own slice, slices keep their order, so passes stay stable.
+        inline void radix_sort_high32(std::vector<uint64_t>& keys, unsigned threads) {
+            const size_t n = keys.size();
+            std::vector<uint64_t> buffer(n);
+            std::vector<std::array<size_t, 256>> counts(threads);
+
+            for (int shift = 32; shift < 64; shift += 8) {
+                run_parallel(threads, [&](unsigned id) {
+                    auto& count = counts[id];
+                    count.fill(0);
+                    for (size_t i = id * n / threads; i < (id + 1) * n / threads; ++i) {
+                        ++count[(keys[i] >> shift) & 0xFF];
+                    }
+                });
+
+                // slice `id` of digit `d` goes after every earlier digit and after the slices before it.
+                size_t offset = 0;
+                bool one_digit = false;
+                for (int d = 0; d < 256; ++d) {
+                    size_t total = 0;
+                    for (unsigned id = 0; id < threads; ++id) {
+                        size_t count = counts[id][d];
+                        counts[id][d] = offset;
+                        offset += count;
+                        total += count;
+                    }
+                    one_digit = one_digit || total == n;
+                }
+                if (one_digit) {
+                    continue;
+                }
+
+                run_parallel(threads, [&](unsigned id) {
+                    auto& next = counts[id];
+                    for (size_t i = id * n / threads; i < (id + 1) * n / threads; ++i) {
+                        buffer[next[(keys[i] >> shift) & 0xFF]++] = keys[i];
+                    }
+                });
+                keys.swap(buffer);
+            }
+        }
+
+        // ranges sorted by first address, radix sorted on every core when there are many.
+        inline void sort_ranges(Ranges& ranges) {
+            const size_t radix_threshold = 1 << 16;
+            if (ranges.size() < radix_threshold) {
+                std::sort(ranges.begin(), ranges.end());
+                return;
+            }
+
+            std::vector<uint64_t> keys;
+            keys.reserve(ranges.size());
+            for (const auto& range : ranges) {
+                keys.emplace_back((uint64_t)range.first << 32 | range.second);
+            }
+
+            unsigned threads = std::max(1u, std::min(std::thread::hardware_concurrency(), 16u));
+            radix_sort_high32(keys, threads);
+
+            for (size_t i = 0; i < keys.size(); ++i) {
+                ranges[i] = std::make_pair((uint32_t)(keys[i] >> 32), (uint32_t)keys[i]);
+            }
+        }
+
+        inline uint64_t range_size(const std::pair<uint32_t, uint32_t>& range) {
+            return (uint64_t)range.second - range.first + 1;
+        }
+    }
+
+    // the addresses of `networks` as sorted disjoint ranges, overlapping and adjacent ones merged.
+    inline Ranges merge_ranges(const std::vector<Ipv4Network>& networks) {
+        Ranges ranges;
+        ranges.reserve(networks.size());
+        for (const auto& network : networks) {
+            ranges.emplace_back(network.first(), network.last());
+        }
+        detail::sort_ranges(ranges);
+
+        // sorted by first address only, so a range may end before the one it follows.
+        Ranges merged;
+        for (const auto& range : ranges) {
+            if (!merged.empty() && (uint64_t)range.first <= (uint64_t)merged.back().second + 1) {
+                merged.back().second = std::max(merged.back().second, range.second);
+            }
+            else {
+                merged.emplace_back(range);
+            }
+        }
+        return merged;
+    }
+
+    // ranges are disjoint, so only the one starting last at or before an address can hold it.
+    inline bool in_ranges(const Ranges& ranges, uint32_t address) {
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), std::make_pair(address, 0xFFFFFFFFu));
+        return it != ranges.begin() && (it - 1)->second >= address;
+    }
+
+    // `targets` minus `excludes`, both sorted and disjoint, in one walk over the two.
+    inline Ranges subtract_ranges(const Ranges& targets, const Ranges& excludes) {
+        Ranges result;
+        size_t e = 0;
+
+        for (const auto& target : targets) {
+            uint64_t first = target.first;
+            const uint64_t last = target.second;
+
+            while (e < excludes.size() && excludes[e].second < first) {
+                ++e;
+            }
+            for (size_t k = e; k < excludes.size() && excludes[k].first <= last && first <= last; ++k) {
+                if (excludes[k].first > first) {
+                    result.emplace_back((uint32_t)first, excludes[k].first - 1);
+                }
+                first = (uint64_t)excludes[k].second + 1;
+            }
+            if (first <= last) {
+                result.emplace_back((uint32_t)first, (uint32_t)last);
+            }
+        }
+        return result;
+    }
+
+    // the scan set of `targets` outside of `excludes`: every address once, in address order.
+    inline Ranges canonical_targets(const std::vector<Ipv4Network>& targets, const std::vector<Ipv4Network>& excludes, TargetStats& stats) {
+        stats = TargetStats{};
+        for (const auto& network : targets) {
+            stats.listed += (uint64_t)network.last() - network.first() + 1;
+        }
+
+        Ranges merged = merge_ranges(targets);
+        Ranges ranges = subtract_ranges(merged, merge_ranges(excludes));
+
+        uint64_t distinct = 0;
+        for (const auto& range : merged) {
+            distinct += detail::range_size(range);
+        }
+        for (const auto& range : ranges) {
+            stats.unique += detail::range_size(range);
+        }
+        stats.excluded = distinct - stats.unique;
+        stats.ranges = ranges.size();
+        return ranges;
+    }
+
+    // the addresses of `ranges` as dotted strings.
+    inline void expand_ranges(const Ranges& ranges, std::vector<std::string>& ips) {
+        char buf[INET_ADDRSTRLEN];
+        for (const auto& range : ranges) {
+            for (uint64_t address = range.first; address <= range.second; ++address) {
+                uint32_t be = htonl((uint32_t)address);
+                inet_ntop(AF_INET, &be, buf, sizeof(buf));
+                ips.emplace_back(buf);
+            }
+        }
+    }
+}
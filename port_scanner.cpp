@@ -4,67 +4,21 @@
 */
 #include <iostream>
 #include <string>
-#include <bitset>
 #include <vector>
 #include <chrono>
 #include <memory>
 #include <cctype>
+#include <climits>
 
 #include <asio.hpp>
 #include "lib_config_parser.hpp"
 
-// port scanner.
-class PortScanner {
-    using PortsTable = std::bitset<65536>;
-
-    asio::io_context ioc;
-    PortsTable table;
-
-    void port_scan(const std::string& ip, int port, int timeout_millisec) {
-        auto socket = std::make_shared<asio::ip::tcp::socket>(ioc);
-        asio::ip::tcp::endpoint endpoint(asio::ip::make_address(ip), port);
-        
-        socket->async_connect(endpoint, 
-            [this, port, socket](const std::error_code& ec) {
-                if (!ec) {
-                    table.set(port, true);
-                }
-            });
-        
-        auto timer = std::make_shared<asio::steady_timer>(ioc);
-        timer->expires_after(std::chrono::milliseconds(timeout_millisec));
-        timer->async_wait([socket, timer](const std::error_code& ec) {
-            if (!ec) {
-                if (socket->is_open()) {
-                    socket->cancel();
-                }
-            }
-        });
-    }
-
-    void scan_all(const std::string& ip, int port_start, int port_end, int timeout_millisec) {
-        for (int i = port_start; i <= port_end; ++i) {
-            if (!table.test(i)) {
-                port_scan(ip, i, timeout_millisec);
-            }
-        }
-    }
-public:
-    PortScanner() : ioc{}, table{} {}
-
-    void scan(const std::string& ip, int port_start, int port_end, int timeout_millisec) {
-        // scan 3 times, to increase the scan quality, especially for bad network environment.
-        scan_all(ip, port_start, port_end, timeout_millisec);
-        scan_all(ip, port_start, port_end, timeout_millisec);
-        scan_all(ip, port_start, port_end, timeout_millisec);
-
-        ioc.run();
-    }
-
-    const PortsTable& get_ports_table() {
-        return table;
-    }
-};
+// this build always has the asio engine, the others come with the platform and build flags.
+#ifndef PORT_SCANNER_WITH_ASIO
+#define PORT_SCANNER_WITH_ASIO
+#endif
+#include "lib_scanner.hpp"
+#include "lib_result_table.hpp"
 
 // some utils.
 int parse_port(const std::string& str) noexcept {
@@ -73,6 +27,9 @@ int parse_port(const std::string& str) noexcept {
     for (char c : str) {
         if (isdigit(c)) {
             port = 10 * port + (c - '0');
+            if (port > 65535) {
+                return -1;
+            }
         }
         else {
             return -1;
@@ -86,11 +43,15 @@ int parse_port(const std::string& str) noexcept {
     return port;
 }
 
+// -1 on anything but digits, and on numbers beyond int.
 int parse_positive_integer(const std::string& str) noexcept {
     int number = 0;
 
     for (char c : str) {
         if (isdigit(c)) {
+            if (number > (INT_MAX - (c - '0')) / 10) {
+                return -1;
+            }
             number = 10 * number + (c - '0');
         }
         else {
@@ -112,7 +73,8 @@ enum class ConfigExtractError {
 
     invalid_port_start,
     invalid_port_end,
-    invalid_timeout_millisec
+    invalid_timeout_millisec,
+    invalid_concurrency_hint
 };
 
 struct Config {
@@ -120,6 +82,8 @@ struct Config {
     int port_start;
     int port_end;
     int timeout_millisec;
+    std::string engine;         // asio by default, or any engine of lib_scanner.hpp to compare with.
+    int concurrency_hint;       // of the asio io_context, 1 by default.
 };
 
 const char* config_extract_strerr(ConfigExtractError err) {
@@ -140,6 +104,8 @@ const char* config_extract_strerr(ConfigExtractError err) {
             return "config invalid: port_end";
         case ConfigExtractError::invalid_timeout_millisec:
             return "config invalid: timeout_millisec";
+        case ConfigExtractError::invalid_concurrency_hint:
+            return "config invalid: concurrency_hint";
         default:
             return "unknown config extract error";
     }
@@ -173,12 +139,12 @@ ConfigExtractError config_extract(const std::map<std::string, std::string>& conf
 
     config.ip = ip_iter->second;
     
-    int port_start = parse_positive_integer(port_start_iter->second);
+    int port_start = parse_port(port_start_iter->second);
     if (port_start < 0) {
         return ConfigExtractError::invalid_port_start;
     }
 
-    int port_end = parse_positive_integer(port_end_iter->second);
+    int port_end = parse_port(port_end_iter->second);
     if (port_end < 0) {
         return ConfigExtractError::invalid_port_end;
     }
@@ -191,11 +157,25 @@ ConfigExtractError config_extract(const std::map<std::string, std::string>& conf
     config.port_start = (port_start < port_end ? port_start : port_end);
     config.port_end = (port_start > port_end ? port_start : port_end);
     config.timeout_millisec = timeout_millisec;
+
+    auto engine_iter = configMap.find("engine");
+    config.engine = (engine_iter != configMap.cend() ? engine_iter->second : "asio");
+
+    config.concurrency_hint = 1;
+    auto concurrency_hint_iter = configMap.find("concurrency_hint");
+    if (concurrency_hint_iter != configMap.cend()) {
+        config.concurrency_hint = parse_positive_integer(concurrency_hint_iter->second);
+        if (config.concurrency_hint < 1) {
+            return ConfigExtractError::invalid_concurrency_hint;
+        }
+    }
+
     return ConfigExtractError::success;
 }
 
 // g++ port_scanner.cpp -I D:\\third-party\\asio-master\\asio\\include -std=c++11 -l ws2_32 -O2 -s -o port_scanner
 // g++ port_scanner.cpp -I /home/3rd_party/asio-master/asio/include -std=c++11 -O2 -s -o port_scanner
+// g++ port_scanner.cpp -I /home/3rd_party/asio-master/asio/include -std=c++11 -O2 -s -DASIO_HAS_IO_URING -DASIO_DISABLE_EPOLL -DPORT_SCANNER_WITH_IO_URING -luring -o port_scanner
 int main(int argc, char* argv[]) {
     if (argc != 2) {
         std::cerr << "usage: " << argv[0] << " <config_file>\n";
@@ -216,24 +196,46 @@ int main(int argc, char* argv[]) {
         }
 
         // scan.
-        PortScanner scanner;
+        std::unique_ptr<scan_engine::ScanEngine> scanner;
+        if (config.engine == "asio") {
+            scanner.reset(new scan_engine::AsioEngine{ config.concurrency_hint });
+        }
+        else {
+            scanner = scan_engine::make_engine(config.engine);
+        }
+
+        scan_engine::ScanConfig scanConfig;
+        result_table::ConcurrentPortsTable portsTable{ 1 };     // asio calls back from `concurrency_hint` threads.
+
+        scanConfig.ips.emplace_back(config.ip);
+        scanConfig.timeout_millisec = config.timeout_millisec;
+        for (int port = config.port_start; port <= config.port_end; ++port) {
+            scanConfig.ports.emplace_back(port);
+        }
 
         std::cout << "ip: " << config.ip << "\n";
         std::cout << "ports: " << config.port_start << " to " << config.port_end << "\n";
         std::cout << "timeout limit: " << config.timeout_millisec << "ms\n";
+        if (config.engine == "asio") {
+            std::cout << "engine: asio, " << scan_engine::AsioEngine::backend() << " backend, concurrency hint " << config.concurrency_hint << "\n";
+        }
+        else {
+            std::cout << "engine: " << config.engine << "\n";
+        }
         std::cout << "\nscanning...\n";
 
         auto start = std::chrono::steady_clock::now();
-        scanner.scan(config.ip, config.port_start, config.port_end, config.timeout_millisec);
+        scanner->scan(scanConfig, [&portsTable](const scan_engine::ScanResult& result) {
+            portsTable.set(0, result.port);
+        });
         auto end = std::chrono::steady_clock::now();
 
         // print result.
         std::cout << "scan takes " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms\n";
         std::cout << "\nopened tcp ports: ";
 
-        const auto& portsTable = scanner.get_ports_table();
-        for (size_t i = 0; i < portsTable.size(); ++i) {
-            if (portsTable.test(i)) {
+        for (int i = 0; i < 65536; ++i) {
+            if (portsTable.test(0, i)) {
                 std::cout << i << " ";
             }
         }
@@ -244,10 +246,18 @@ int main(int argc, char* argv[]) {
         std::cerr << "given config file does not exist\n";
         return 1;
     }
+    catch(const scan_engine::EngineUnavailableException& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
     catch(const asio::system_error& se) {
         std::cerr << "asio system error, " << se.code() << ", " << se.what() << "\n";
         return 1;
     }
+    catch(const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
 
     return 0;
 }
@@ -0,0 +1,181 @@
+// @brief  C ABI over lib_scanner.hpp, no exception crosses this boundary.
+// g++ port_scanner_capi.cpp -std=c++11 -O2 -shared -fPIC -o libport_scanner.so
+#include <exception>
+#include <stdexcept>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+
+#include "port_scanner_capi.h"
+#include "lib_scanner.hpp"
+
+static_assert(sizeof(ps_result) == 12, "ps_result layout is part of the ABI");
+
+struct ps_results {
+    std::vector<ps_result> records;
+};
+
+struct ps_scanner {
+    std::unique_ptr<scan_engine::ScanEngine> engine;
+    scan_engine::ScanConfig config;
+    std::unique_ptr<ps_results> results;    // of the last run, until taken.
+    std::string last_error;
+};
+
+namespace {
+    thread_local std::string last_global_error;
+
+    // runs `func`, turns a thrown exception into -1 and `last_error`.
+    template<typename Func>
+    int guarded(ps_scanner* scanner, Func func) {
+        if (!scanner) {
+            return -1;
+        }
+
+        try {
+            func();
+            scanner->last_error.clear();
+            return 0;
+        }
+        catch (const std::exception& e) {
+            scanner->last_error = e.what();
+        }
+        catch (...) {
+            scanner->last_error = "unknown error";
+        }
+
+        return -1;
+    }
+}
+
+extern "C" {
+
+int ps_abi_version(void) {
+    return PS_ABI_VERSION;
+}
+
+ps_scanner* ps_scanner_create(const char* engine) {
+    try {
+        std::unique_ptr<ps_scanner> scanner{ new ps_scanner{} };
+        scanner->engine = scan_engine::make_engine(engine ? engine : "epoll");
+        last_global_error.clear();
+        return scanner.release();
+    }
+    catch (const std::exception& e) {
+        last_global_error = e.what();
+    }
+    catch (...) {
+        last_global_error = "unknown error";
+    }
+    return nullptr;
+}
+
+void ps_scanner_destroy(ps_scanner* scanner) {
+    delete scanner;
+}
+
+int ps_scanner_add_host(ps_scanner* scanner, const char* ip) {
+    return guarded(scanner, [scanner, ip] {
+        if (!ip) {
+            throw std::invalid_argument{ "ip is null" };
+        }
+
+        // engines skip what does not parse, a bad host must fail here, not in an empty run.
+        struct in_addr addr;
+        if (inet_pton(AF_INET, ip, &addr) != 1) {
+            throw std::invalid_argument{ std::string{ "not an ipv4 address: " } + ip };
+        }
+        scanner->config.ips.emplace_back(ip);
+    });
+}
+
+int ps_scanner_add_port_range(ps_scanner* scanner, int port_start, int port_end) {
+    return guarded(scanner, [scanner, port_start, port_end] {
+        if (port_start < 1 || port_end > 65535 || port_start > port_end) {
+            throw std::invalid_argument{ "invalid port range" };
+        }
+
+        for (int port = port_start; port <= port_end; ++port) {
+            scanner->config.ports.emplace_back(port);
+        }
+    });
+}
+
+int ps_scanner_set_timeout(ps_scanner* scanner, int timeout_millisec) {
+    return guarded(scanner, [scanner, timeout_millisec] {
+        if (timeout_millisec < 0) {
+            throw std::invalid_argument{ "invalid timeout" };
+        }
+        scanner->config.timeout_millisec = timeout_millisec;
+    });
+}
+
+int ps_scanner_set_window(ps_scanner* scanner, int window) {
+    return guarded(scanner, [scanner, window] {
+        if (window <= 0) {
+            throw std::invalid_argument{ "invalid window" };
+        }
+        scanner->config.window = window;
+    });
+}
+
+int ps_scanner_run(ps_scanner* scanner) {
+    return guarded(scanner, [scanner] {
+        // a new buffer every run, results taken before stay as they were.
+        std::unique_ptr<ps_results> results{ new ps_results{} };
+
+        scanner->engine->scan(scanner->config, [&results](const scan_engine::ScanResult& result) {
+            ps_result record;
+            record.host_index = (uint32_t)result.host_index;
+            record.port = (uint16_t)result.port;
+            record.state = (result.opened ? 1 : 0);
+            record.reserved = 0;
+            record.rtt_micros = (uint32_t)result.best_rtt_micros();
+            results->records.emplace_back(record);
+        });
+
+        scanner->results = std::move(results);
+    });
+}
+
+const ps_result* ps_scanner_results(const ps_scanner* scanner, size_t* count) {
+    return ps_results_data(scanner ? scanner->results.get() : nullptr, count);
+}
+
+ps_results* ps_scanner_take_results(ps_scanner* scanner) {
+    return scanner ? scanner->results.release() : nullptr;
+}
+
+const ps_result* ps_results_data(const ps_results* results, size_t* count) {
+    if (count) {
+        *count = (results ? results->records.size() : 0);
+    }
+    return (results && !results->records.empty() ? results->records.data() : nullptr);
+}
+
+void ps_results_free(ps_results* results) {
+    delete results;
+}
+
+size_t ps_scanner_host_count(const ps_scanner* scanner) {
+    return scanner ? scanner->config.ips.size() : 0;
+}
+
+const char* ps_scanner_host(const ps_scanner* scanner, uint32_t host_index) {
+    if (!scanner || host_index >= scanner->config.ips.size()) {
+        return nullptr;
+    }
+    return scanner->config.ips[host_index].c_str();
+}
+
+const char* ps_scanner_last_error(const ps_scanner* scanner) {
+    return scanner ? scanner->last_error.c_str() : "scanner is null";
+}
+
+const char* ps_last_error(void) {
+    return last_global_error.c_str();
+}
+
+}
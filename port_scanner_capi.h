@@ -0,0 +1,64 @@
+/*
+    @brief  stable C ABI of the scanning library, for embedding from other languages.
+            build: g++ port_scanner_capi.cpp -std=c++11 -O2 -shared -fPIC -o libport_scanner.so
+*/
+#ifndef PORT_SCANNER_CAPI_H
+#define PORT_SCANNER_CAPI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PS_ABI_VERSION 2
+
+/* one opened (host, port), 12 bytes, layout is part of the ABI. */
+typedef struct ps_result {
+    uint32_t host_index;    /* order of `ps_scanner_add_host` calls. */
+    uint16_t port;
+    uint8_t state;          /* 0 closed, 1 opened. */
+    uint8_t reserved;
+    uint32_t rtt_micros;
+} ps_result;
+
+typedef struct ps_scanner ps_scanner;
+
+/* the results of one run, in memory of their own. */
+typedef struct ps_results ps_results;
+
+int ps_abi_version(void);
+
+/* engine is an engine name like "epoll", NULL for the default. returns NULL on failure, see `ps_last_error`. */
+ps_scanner* ps_scanner_create(const char* engine);
+void ps_scanner_destroy(ps_scanner* scanner);
+
+/* these return 0 on success, -1 on failure, see `ps_scanner_last_error`. hosts are ipv4 addresses, ports 1 to 65535. */
+int ps_scanner_add_host(ps_scanner* scanner, const char* ip);
+int ps_scanner_add_port_range(ps_scanner* scanner, int port_start, int port_end);
+int ps_scanner_set_timeout(ps_scanner* scanner, int timeout_millisec);
+int ps_scanner_set_window(ps_scanner* scanner, int window);
+int ps_scanner_run(ps_scanner* scanner);
+
+/* results are owned by the scanner, valid until the next run or destroy. */
+const ps_result* ps_scanner_results(const ps_scanner* scanner, size_t* count);
+
+/* hands the results of the last run over, they stay valid across later runs and the
+   destroy of the scanner until `ps_results_free`. NULL when there was no run since. */
+ps_results* ps_scanner_take_results(ps_scanner* scanner);
+const ps_result* ps_results_data(const ps_results* results, size_t* count);
+void ps_results_free(ps_results* results);
+
+size_t ps_scanner_host_count(const ps_scanner* scanner);
+const char* ps_scanner_host(const ps_scanner* scanner, uint32_t host_index);
+const char* ps_scanner_last_error(const ps_scanner* scanner);
+
+/* the error of the last call of this thread which failed without a scanner to keep it in. */
+const char* ps_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
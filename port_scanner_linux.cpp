@@ -1,289 +1,1032 @@
 // @date   2025-12-08
 // @author yuan
-// @brief  a port scanner written in C++11, only for linux platform, based on epoll mode.
+// @brief  a port scanner written in C++11, only for linux platform, the engines live in lib_scanner.hpp.
 #include <iostream>
 #include <system_error>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <array>
+#include <map>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <unordered_set>
 #include <cerrno>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <atomic>
+#include <csignal>
 
 #include <arpa/inet.h>
-#include <sys/socket.h>
-#include <sys/select.h>
-#include <sys/time.h>
-#include <sys/epoll.h>
-#include <unistd.h>
-#include <fcntl.h>
 
-// raii wrapper for socket.
-class Socket {
-    int fd;
-public:
-    Socket() : fd{ -1 } {}
+#include "lib_config_parser.hpp"
+#include "lib_config_schema.hpp"
+#include "lib_scanner.hpp"
+#include "lib_probe_module.hpp"
+#include "lib_port_index.hpp"
+#include "lib_arrow_writer.hpp"
+#include "lib_output_sink.hpp"
+#include "lib_shm_channel.hpp"
+#include "lib_target_file.hpp"
+#include "lib_live_config.hpp"
+#include "lib_dedup_filter.hpp"
+#include "lib_result_cache.hpp"
+#include "lib_sock_diag.hpp"
+#include "lib_monitor.hpp"
+#include "lib_congestion_watchdog.hpp"
 
-    Socket(int domain, int type, int protocol) {
-        fd = socket(domain, type, protocol);
-        if (fd < 0) {
-            std::error_code ec(errno, std::system_category());
-            throw std::system_error{ ec, "sys call socket failed" };
+#ifdef PORT_SCANNER_WITH_SQLITE
+#include "lib_sqlite_sink.hpp"
+#endif
+
+// some utils.
+// "a, b c" -> { "a", "b", "c" }
+std::vector<std::string> split_list(const std::string& str) {
+    std::vector<std::string> items;
+    std::string item;
+
+    for (char c : str) {
+        if (c == ',' || isspace(c)) {
+            if (!item.empty()) {
+                items.emplace_back(item);
+                item.clear();
+            }
+        }
+        else {
+            item += c;
         }
     }
 
-    Socket(int _fd) : fd{ _fd } {}
+    if (!item.empty()) {
+        items.emplace_back(item);
+    }
+
+    return items;
+}
 
-    Socket(const Socket&) = delete;
-    Socket& operator=(const Socket&) = delete;
+// "22, 80 8000-8100" -> { 22, 80, 8000, ..., 8100 }, false on a bad item.
+bool parse_port_list(const std::string& str, std::vector<int>& ports) {
+    for (const auto& item : split_list(str)) {
+        size_t dash = item.find('-');
+        long long first = 0;
+        long long last = 0;
 
-    Socket(Socket&& other)
-        : fd{ other.fd }
-    {
-        other.fd = -1;
+        if (!config_schema::parse_integer(item.substr(0, dash), 0, 65535, first)) {
+            return false;
+        }
+        last = first;
+        if (dash != std::string::npos && !config_schema::parse_integer(item.substr(dash + 1), first, 65535, last)) {
+            return false;
+        }
+
+        for (long long port = first; port <= last; ++port) {
+            ports.emplace_back((int)port);
+        }
     }
+    return !ports.empty();
+}
+
+// config, one per profile.
+struct Config {
+    std::string profile;        // section name, empty for a file without sections.
+    std::vector<std::string> ips;   // every target address once, in address order.
+    std::string target_file;    // optional, addresses and cidrs, one per line.
+    std::string exclude_file;   // optional, taken out of the targets.
+    std::vector<int> ports;     // from `ports`, or from `port_start` to `port_end`.
+    int port_start;
+    int port_end;
+    int timeout_millisec;
+    int window;                 // max in-flight connects, the scan rate knob.
+    int rate;                   // optional, connects per second, 0 is unlimited, epoll, io_uring and raw engines only.
+    int host_window;            // optional, max in-flight connects to one host, 0 is window, epoll engine only.
+    bool syn_defense;           // optional, throttle hosts which start dropping under load, true by default.
+    bool hot_reload;            // optional, apply edits of window, timeout_millisec, rate and exclude_file mid-scan.
+    bool congestion_watchdog;   // optional, throttle window and rate while this machine drops packets, epoll engine only.
+    std::string engine;         // scan engine name, epoll by default.
+    std::string probe_module;   // optional, banner, http, redis or the path of a module .so.
+    std::string index_file;     // optional, where to save the port -> hosts index.
+    std::string arrow_file;     // optional, where to export results as an arrow ipc file.
+    bool arrow_closed;          // optional, arrow_file also gets the refused and timed out ports.
+    std::string output_file;    // optional, text results, zstd seekable when named *.zst.
+    int output_zstd_level;      // -1 picks 3 for *.zst and 0 otherwise.
+    std::string sqlite_file;    // optional, needs the build with sqlite.
+    std::string shm_channel;    // optional, file to announce the shared memory result channel in.
+    bool grab_banners;          // optional, print what opened ports send first, epoll, io_uring and coro engines only.
+    bool dedup_filter;          // optional, drop repeated results of a (host, port) through a bloom filter.
+    double dedup_fp_rate;       // its false positive rate, sized for every probe, 1e-6 by default.
+    int dedup_memory_kb;        // its memory budget, 64 MB by default, the rate rises when it is too small.
+    bool local_mode;            // optional, answer local targets from the kernel's listeners, scan the rest.
+    std::vector<std::string> netns;     // optional, network namespaces whose addresses count as local too.
+    bool monitor;               // optional, hold a connection to every (host, port) and report changes until ctrl-c.
+    monitor::MonitorConfig monitor_config;      // its keepalive and reconnect backoff.
+    std::string cache_file;     // optional, last state per (host, port), closed ones within cache_ttl_sec are skipped.
+    int cache_ttl_sec;          // 600 by default.
+    std::map<std::string, std::string> entries;     // the keys it was read from, to tell what a reload changed.
+    target_file::TargetStats target_stats;          // what deduplicating the targets saved.
+
+    Config()
+        : profile{}, ips{}, target_file{}, exclude_file{}, ports{}, port_start{ -1 }, port_end{ -1 }, timeout_millisec{ 0 },
+          window{ 256 }, rate{ 0 }, host_window{ 0 }, syn_defense{ true }, hot_reload{ false }, congestion_watchdog{ false }, engine{ "epoll" },
+          probe_module{}, index_file{}, arrow_file{}, arrow_closed{ false }, output_file{}, output_zstd_level{ -1 }, sqlite_file{}, shm_channel{}, grab_banners{ false }, dedup_filter{ false }, dedup_fp_rate{ 1e-6 }, dedup_memory_kb{ 64 * 1024 },
+          local_mode{ false }, netns{}, monitor{ false }, monitor_config{}, cache_file{}, cache_ttl_sec{ 600 }, entries{}, target_stats{}
+    {}
+};
+
+const config_schema::Schema<Config>& config_schema_of_scan() {
+    static const config_schema::Schema<Config> schema = config_schema::Schema<Config>{}
+        .custom("ip", [](const std::string& value, Config& config) -> std::string {
+            auto ips = split_list(value);
+            if (ips.empty()) {
+                return "config invalid: ip";
+            }
+            config.ips.insert(config.ips.end(), ips.begin(), ips.end());
+            return "";
+        })
+        .string("target_file", &Config::target_file)
+        .string("exclude_file", &Config::exclude_file)
+        .custom("ports", [](const std::string& value, Config& config) -> std::string {
+            return (parse_port_list(value, config.ports) ? "" : "config invalid: ports, expects ports and ranges like 22, 80, 8000-8100");
+        })
+        .integer("port_start", &Config::port_start, 0, 65535)
+        .integer("port_end", &Config::port_end, 0, 65535)
+        .integer("timeout_millisec", &Config::timeout_millisec, 0, 3600 * 1000, true)
+        .integer("window", &Config::window, 1, 1 << 20)
+        .integer("rate", &Config::rate, 0, 10 * 1000 * 1000)
+        .integer("host_window", &Config::host_window, 0, 1 << 20)
+        .boolean("syn_defense", &Config::syn_defense)
+        .boolean("hot_reload", &Config::hot_reload)
+        .boolean("congestion_watchdog", &Config::congestion_watchdog)
+        .string("engine", &Config::engine)
+        .string("probe_module", &Config::probe_module)
+        .string("index_file", &Config::index_file)
+        .string("arrow_file", &Config::arrow_file)
+        .boolean("arrow_closed", &Config::arrow_closed)
+        .string("output_file", &Config::output_file)
+        .integer("output_zstd_level", &Config::output_zstd_level, 0, 22)
+        .custom("sqlite_file", [](const std::string& value, Config& config) -> std::string {
+#ifndef PORT_SCANNER_WITH_SQLITE
+            (void)value;
+            (void)config;
+            return "config invalid: sqlite_file, built without sqlite, rebuild with -DPORT_SCANNER_WITH_SQLITE -lsqlite3";
+#else
+            config.sqlite_file = value;
+            return "";
+#endif
+        })
+        .string("shm_channel", &Config::shm_channel)
+        .boolean("grab_banners", &Config::grab_banners)
+        .boolean("dedup_filter", &Config::dedup_filter)
+        .real("dedup_fp_rate", &Config::dedup_fp_rate, 1e-12, 0.5)
+        .integer("dedup_memory_kb", &Config::dedup_memory_kb, 1, 64 * 1024 * 1024)
+        .boolean("local_mode", &Config::local_mode)
+        .custom("netns", [](const std::string& value, Config& config) -> std::string {
+            config.netns = split_list(value);
+            return (config.netns.empty() ? "config invalid: netns, expects paths like /proc/<pid>/ns/net or /var/run/netns/<name>" : "");
+        })
+        .boolean("monitor", &Config::monitor)
+        .custom("keepalive_idle_sec", [](const std::string& value, Config& config) -> std::string {
+            long long number = 0;
+            bool valid = config_schema::parse_integer(value, 1, 32767, number);
+            config.monitor_config.keepalive_idle_sec = (int)number;
+            return (valid ? "" : "config invalid: keepalive_idle_sec, expects an integer in 1..32767");
+        })
+        .custom("keepalive_interval_sec", [](const std::string& value, Config& config) -> std::string {
+            long long number = 0;
+            bool valid = config_schema::parse_integer(value, 1, 32767, number);
+            config.monitor_config.keepalive_interval_sec = (int)number;
+            return (valid ? "" : "config invalid: keepalive_interval_sec, expects an integer in 1..32767");
+        })
+        .custom("keepalive_count", [](const std::string& value, Config& config) -> std::string {
+            long long number = 0;
+            bool valid = config_schema::parse_integer(value, 1, 127, number);
+            config.monitor_config.keepalive_count = (int)number;
+            return (valid ? "" : "config invalid: keepalive_count, expects an integer in 1..127");
+        })
+        .custom("reconnect_max_millisec", [](const std::string& value, Config& config) -> std::string {
+            long long number = 0;
+            bool valid = config_schema::parse_integer(value, 100, 3600 * 1000, number);
+            config.monitor_config.backoff_max_millisec = (int)number;
+            return (valid ? "" : "config invalid: reconnect_max_millisec, expects an integer in 100..3600000");
+        })
+        .string("cache_file", &Config::cache_file)
+        .integer("cache_ttl_sec", &Config::cache_ttl_sec, 0, 365 * 24 * 3600);
+
+    return schema;
+}
+
+// canonicalizes the targets: the `ip` hosts and the target_file entries sorted into one
+// list which holds every address once, minus those of config.exclude_file.
+std::string load_targets(Config& config) {
+    const size_t host_limit = 1 << 24;
 
-    Socket& operator=(Socket&& other) {
-        if (this != &other) {
-            fd = other.fd;
-            other.fd = -1;
+    std::vector<target_file::Ipv4Network> targets;
+    for (const auto& ip : config.ips) {
+        target_file::Ipv4Network network;
+        if (!target_file::parse_ipv4_network(target_file::View{ ip.data(), ip.size() }, network)) {
+            return "config invalid: ip, bad address " + ip;
         }
+        targets.emplace_back(network);
+    }
 
-        return *this;
+    if (!config.target_file.empty()) {
+        auto stats = target_file::load_targets(config.target_file, targets);
+        if (stats.invalid > 0) {
+            return "config invalid: target_file, bad entry on line " + std::to_string(stats.first_invalid_line);
+        }
     }
 
-    ~Socket() {
-        if (fd >= 0) {
-            ::close(fd);
+    std::vector<target_file::Ipv4Network> excludes;
+    if (!config.exclude_file.empty()) {
+        auto stats = target_file::load_targets(config.exclude_file, excludes);
+        if (stats.invalid > 0) {
+            return "config invalid: exclude_file, bad entry on line " + std::to_string(stats.first_invalid_line);
         }
     }
 
-    void close() {
-        if (fd >= 0) {
-            ::close(fd);
-            fd = -1;
+    auto ranges = target_file::canonical_targets(targets, excludes, config.target_stats);
+    if (config.target_stats.unique > host_limit) {
+        return "config invalid: target_file, more than " + std::to_string(host_limit) + " hosts";
+    }
+    if (config.target_stats.unique == 0) {
+        return "config invalid: exclude_file, every host is excluded";
+    }
+
+    config.ips.clear();
+    config.ips.reserve(config.target_stats.unique);
+    target_file::expand_ranges(ranges, config.ips);
+    return "";
+}
+
+// validates `section` into `config`, returns an error message, or empty string on success.
+std::string config_extract(const std::map<std::string, std::string>& section, Config& config) {
+    std::string error = config_schema_of_scan().apply(section, config);
+    if (!error.empty()) {
+        return error;
+    }
+
+    if (config.ips.empty() && config.target_file.empty()) {
+        return "config not found: ip or target_file";
+    }
+
+    if ((config.host_window > 0 || config.hot_reload || config.congestion_watchdog) && config.engine != "epoll") {
+        return "config invalid: host_window, hot_reload and congestion_watchdog, only the epoll engine supports them";
+    }
+
+    if (config.rate > 0 && config.engine != "epoll" && config.engine != "io_uring" && config.engine != "raw") {
+        return "config invalid: rate, only the epoll, io_uring and raw engines support it";
+    }
+
+    if (config.arrow_closed && config.arrow_file.empty()) {
+        return "config invalid: arrow_closed, needs arrow_file";
+    }
+
+    if (!config.probe_module.empty() && config.engine != "epoll" && config.engine != "io_uring" && config.engine != "coro") {
+        return "config invalid: probe_module, only the epoll, io_uring and coro engines read from opened ports";
+    }
+
+    error = load_targets(config);
+    if (!error.empty()) {
+        return error;
+    }
+
+    if (config.ports.empty()) {
+        if (config.port_start < 0 || config.port_end < 0) {
+            return "config not found: ports, or port_start and port_end";
+        }
+
+        int first = (config.port_start < config.port_end ? config.port_start : config.port_end);
+        int last = (config.port_start > config.port_end ? config.port_start : config.port_end);
+        for (int port = first; port <= last; ++port) {
+            config.ports.emplace_back(port);
         }
     }
 
-    void set_nonblock() {
-        int flag = fcntl(fd, F_GETFL, 0);
-        fcntl(fd, F_SETFL, flag | O_NONBLOCK);
+    const size_t monitor_limit = 10000;
+    if (config.monitor && config.ips.size() * config.ports.size() > monitor_limit) {
+        return "config invalid: monitor, more than " + std::to_string(monitor_limit) + " connections to hold";
     }
+    config.monitor_config.connect_timeout_millisec = config.timeout_millisec;
 
-    int handle() {
-        return fd;
+    const size_t cache_limit = 1 << 26;
+    if (!config.cache_file.empty()) {
+        if (config.hot_reload) {
+            return "config invalid: cache_file, not with hot_reload, hosts excluded mid-scan would be cached as closed";
+        }
+        if (config.ips.size() * config.ports.size() > cache_limit) {
+            return "config invalid: cache_file, more than " + std::to_string(cache_limit) + " probes to cache";
+        }
     }
-};
 
-// raii wrapper for epoll.
-class Epoll {
-    int fd;
-public:
-    Epoll() {
-        fd = epoll_create1(0);
-        if (fd < 0) {
-            std::error_code ec(errno, std::system_category());
-            throw std::system_error{ ec, "sys call epoll_create1 failed" };
+    if (config.output_zstd_level < 0) {
+        const std::string zst_suffix = ".zst";
+        bool is_zst = config.output_file.size() > zst_suffix.size()
+            && config.output_file.compare(config.output_file.size() - zst_suffix.size(), zst_suffix.size(), zst_suffix) == 0;
+        config.output_zstd_level = (is_zst ? 3 : 0);
+    }
+
+    return "";
+}
+
+// every profile of the file, keys before the first `[profile]` header are defaults for all of them.
+std::string config_extract_profiles(const std::vector<config_parser::Section>& sections, std::vector<Config>& configs) {
+    const auto& defaults = sections.front().entries;
+
+    for (size_t i = 1; i < sections.size(); ++i) {
+        std::map<std::string, std::string> entries = sections[i].entries;
+        entries.insert(defaults.begin(), defaults.end());
+
+        Config config;
+        config.profile = sections[i].name;
+        config.entries = entries;
+
+        std::string error = config_extract(entries, config);
+        if (!error.empty()) {
+            return "profile " + config.profile + ": " + error;
         }
+        configs.emplace_back(std::move(config));
     }
 
-    Epoll(const Epoll&) = delete;
-    Epoll& operator=(const Epoll&) = delete;
+    if (configs.empty()) {
+        Config config;
+        config.entries = defaults;
+        std::string error = config_extract(defaults, config);
+        if (!error.empty()) {
+            return error;
+        }
+        configs.emplace_back(std::move(config));
+    }
+
+    return "";
+}
+
+// the settings of `config` an engine may take mid-scan. exclude_file was applied to the
+// targets already, so only a reload reads it into the live settings.
+std::string live_settings_of(const Config& config, bool read_excludes, scan_engine::LiveSettings& settings) {
+    settings.timeout_millisec = config.timeout_millisec;
+    settings.window = config.window;
+    settings.rate = config.rate;
+    settings.excluded.clear();
 
-    Epoll(Epoll&& other)
-        : fd{ other.fd }
-    {
-        other.fd = -1;
+    if (read_excludes && !config.exclude_file.empty()) {
+        std::vector<target_file::Ipv4Network> excludes;
+        auto stats = target_file::load_targets(config.exclude_file, excludes);
+        if (stats.invalid > 0) {
+            return "config invalid: exclude_file, bad entry on line " + std::to_string(stats.first_invalid_line);
+        }
+        settings.excluded = target_file::merge_ranges(excludes);
     }
+    return "";
+}
+
+// reads the running profile from the config file again and hands its live settings to `publish`.
+// any other key which changed is reported and waits for the next run.
+void reload_live_settings(const std::string& path, const Config& running, const std::function<void(const scan_engine::LiveSettings&)>& publish) {
+    static const char* const live_keys[] = { "window", "timeout_millisec", "rate", "exclude_file" };
+
+    try {
+        config_parser::ConfigParser parser;
+        auto sections = parser.parse_sections(path);
+
+        std::map<std::string, std::string> entries = sections.front().entries;
+        for (size_t i = 1; i < sections.size(); ++i) {
+            if (sections[i].name == running.profile) {
+                entries = sections[i].entries;
+                entries.insert(sections.front().entries.begin(), sections.front().entries.end());
+            }
+        }
+
+        Config config;
+        std::string error = config_schema_of_scan().apply(entries, config);
+        if (!error.empty()) {
+            std::cerr << "config reload failed, " << error << ", keeping the running settings\n";
+            return;
+        }
+
+        std::map<std::string, std::string> changed;
+        for (const auto& entry : entries) {
+            auto it = running.entries.find(entry.first);
+            if (it == running.entries.cend() || it->second != entry.second) {
+                changed.insert(entry);
+            }
+        }
+        for (const auto& entry : running.entries) {
+            if (entries.find(entry.first) == entries.cend()) {
+                changed.insert(entry);
+            }
+        }
+        for (const char* key : live_keys) {
+            changed.erase(key);
+        }
+        for (const auto& entry : changed) {
+            std::cerr << "config reload: " << entry.first << " changed, it applies from the next run\n";
+        }
 
-    Epoll& operator=(Epoll&& other) {
-        if (this != &other) {
-            fd = other.fd;
-            other.fd = -1;
+        scan_engine::LiveSettings settings;
+        error = live_settings_of(config, true, settings);
+        if (!error.empty()) {
+            std::cerr << "config reload failed, " << error << ", keeping the running settings\n";
+            return;
         }
 
-        return *this;
+        publish(settings);
+        std::cerr << "config reloaded, window " << settings.window << ", timeout " << settings.timeout_millisec << " ms, rate "
+                  << settings.rate << "/s, " << settings.excluded.size() << " excluded ranges\n";
+    }
+    catch (const std::exception& e) {
+        std::cerr << "config reload failed, " << e.what() << ", keeping the running settings\n";
     }
+}
+
+// `query <index_file> <expression>`, prints the matched hosts.
+int run_query(const std::string& index_file, const std::string& expr) {
+    port_index::PortIndex index;
+    index.load(index_file);
+
+    port_index::Query query{ index };
+    auto hosts = query.evaluate(expr);
+
+    hosts.for_each([&index](uint32_t id) {
+        std::cout << index.host_name(id) << "\n";
+    });
 
-    ~Epoll() {
-        if (fd >= 0) {
-            close(fd);
+    std::cerr << hosts.cardinality() << " of " << index.host_count() << " hosts matched\n";
+    return 0;
+}
+
+// `consume <channel_path>`, prints results published by a running scan.
+int run_consume(const std::string& path) {
+    shm_channel::ShmConsumer consumer{ path };
+    std::array<shm_channel::ShmResult, 256> results;
+
+    while (!consumer.closed()) {
+        size_t n = consumer.poll(results.data(), results.size());
+        if (n == 0) {
+            consumer.wait(1000);
+            continue;
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &results[i].ipv4, ip, sizeof(ip));
+            std::cout << ip << " " << results[i].port << " " << results[i].rtt_micros << "\n";
         }
     }
 
-    int handle() {
-        return fd;
+    std::cerr << consumer.dropped() << " results dropped by the producer\n";
+    return 0;
+}
+
+int64_t unix_time_micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::atomic<bool> monitor_stop{ false };
+
+// `monitor = true`, a line per (host, port) which goes up or down, until ctrl-c or sigterm.
+int run_monitor(const Config& config) {
+    std::vector<monitor::Target> targets;
+    for (const auto& ip : config.ips) {
+        for (int port : config.ports) {
+            targets.emplace_back(monitor::Target{ ip, port });
+        }
     }
 
-    void add_fd(struct epoll_event* ev, int descriptor) {
-        if (epoll_ctl(fd, EPOLL_CTL_ADD, descriptor, ev) < 0) {
-            std::error_code ec(errno, std::system_category());
-            throw std::system_error{ ec, "sys call epoll_ctl failed on `EPOLL_CTL_ADD`" };
+    monitor_stop.store(false);
+    std::signal(SIGINT, [](int) { monitor_stop.store(true); });
+    std::signal(SIGTERM, [](int) { monitor_stop.store(true); });
+
+    monitor::ConnectionMonitor connections{ targets, config.monitor_config };
+    connections.run(monitor_stop, [&connections](const monitor::MonitorEvent& event) {
+        const monitor::Target& target = connections.target(event.target_index);
+        std::cout << unix_time_micros() / 1000000 << " " << target.ip << " " << target.port << " ";
+        if (event.status == monitor::Status::up) {
+            std::cout << "up " << event.rtt_micros << "us\n";
+        }
+        else {
+            std::cout << "down " << event.reason << "\n";
         }
+        std::cout.flush();
+    });
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    std::cerr << connections.quick_reconnects() << " connections closed by a peer and made again at once\n";
+    return 0;
+}
+
+// the first line of a banner, control bytes as '.'.
+std::string printable(const char* data, size_t len) {
+    std::string line;
+    for (size_t i = 0; i < len && data[i] != '\r' && data[i] != '\n'; ++i) {
+        line += (std::isprint((unsigned char)data[i]) ? data[i] : '.');
     }
-    
-    void del_fd(int descriptor) {
-        if (epoll_ctl(fd, EPOLL_CTL_DEL, descriptor, nullptr) < 0) {
-            std::error_code ec(errno, std::system_category());
-            throw std::system_error{ ec, "sys call epoll_ctl failed on `EPOLL_CTL_DEL`" };
+    return line;
+}
+
+// what the probe module sends on every opened port, the engine sends it on the connection of the scan.
+template<typename Module>
+std::function<size_t(size_t, int, char*, size_t)> probe_request(const Config& config, Module module) {
+    return probe_module::ProbeRunner<Module>{ module }.request(config.ips);
+}
+
+std::function<size_t(size_t, int, char*, size_t)> probe_module_request(const Config& config) {
+    if (config.probe_module == "banner") {
+        return probe_request(config, probe_module::BannerModule{});
+    }
+    else if (config.probe_module == "http") {
+        return probe_request(config, probe_module::HttpModule{});
+    }
+    else if (config.probe_module == "redis") {
+        return probe_request(config, probe_module::RedisModule{});
+    }
+    else {
+        return probe_request(config, probe_module::DynamicModule{ config.probe_module });
+    }
+}
+
+// after the scan, classifies what the opened ports answered.
+template<typename Module>
+void run_probes(const Config& config, const std::vector<probe_module::ProbeTarget>& targets, Module module) {
+    probe_module::ProbeRunner<Module> runner{ module };
+
+    // the response's first line follows the label.
+    runner.run(targets, [&config](const probe_module::ProbeResult& result) {
+        std::cout << config.ips[result.host_index] << " " << result.port << " "
+                  << (result.matched ? result.label : "unknown");
+        if (!result.response.empty()) {
+            std::cout << " " << printable(result.response.data(), result.response.size());
         }
+        std::cout << "\n";
+    });
+}
+
+void run_probe_module(const Config& config, const std::vector<probe_module::ProbeTarget>& targets) {
+    if (config.probe_module == "banner") {
+        run_probes(config, targets, probe_module::BannerModule{});
     }
-};
+    else if (config.probe_module == "http") {
+        run_probes(config, targets, probe_module::HttpModule{});
+    }
+    else if (config.probe_module == "redis") {
+        run_probes(config, targets, probe_module::RedisModule{});
+    }
+    else {
+        run_probes(config, targets, probe_module::DynamicModule{ config.probe_module });
+    }
+}
 
-// connector, it will do the things.
-template<int N>
-class BatchConnector {
-    struct ConnectRecord {
-        int port;
-        Socket sock;
-        bool opened;
-    };
-
-    std::array<ConnectRecord, N> records;
-    Epoll epoll;
-    int len;
-
-    bool is_connected(int fd) {
-        int error = -1;
-        socklen_t len = sizeof(error);
-
-        int ret = getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
-        return ret == 0 && error == 0;
-    }
-public:
-    BatchConnector() 
-        : records{}, epoll{}, len{ 0 } 
-    {}
+int run_scan(const Config& config, const std::string& config_path, scan_engine::ScanEngine& engine) {
+    port_index::PortIndex index;
+    std::unique_ptr<arrow_ipc::ResultArrowWriter> arrow;
 
-    void submit(const std::string& ip, int port) {
-        // this connector could only hold N elements.
-        if (len == N) {
-            return;
+    if (!config.arrow_file.empty()) {
+        arrow.reset(new arrow_ipc::ResultArrowWriter{ config.arrow_file });
+    }
+
+    std::unique_ptr<output_sink::OutputSink> output;
+    if (!config.output_file.empty()) {
+        output.reset(new output_sink::OutputSink{ config.output_file, config.output_zstd_level });
+    }
+
+    std::unique_ptr<shm_channel::ShmProducer> shm;
+    if (!config.shm_channel.empty()) {
+        shm.reset(new shm_channel::ShmProducer{});
+
+        std::ofstream announce{ config.shm_channel };
+        announce << shm->path() << "\n";
+        if (!announce) {
+            std::cerr << "write shm channel path failed: " << config.shm_channel << "\n";
+            return 1;
         }
+    }
+
+#ifdef PORT_SCANNER_WITH_SQLITE
+    std::unique_ptr<sqlite_sink::SqliteSink> sqlite;
+    if (!config.sqlite_file.empty()) {
+        sqlite.reset(new sqlite_sink::SqliteSink{ config.sqlite_file });
+    }
+#endif
+
+    scan_engine::ScanConfig scan_config;
+    scan_config.ips = config.ips;
+    scan_config.timeout_millisec = config.timeout_millisec;
+    scan_config.window = config.window;
+    scan_config.host_window = config.host_window;
+    scan_config.rate = config.rate;
+    scan_config.syn_defense = config.syn_defense;
+    scan_config.grab_banners = config.grab_banners;
+    scan_config.ports = config.ports;
+
+    // refused and timed out ports only reach the arrow file.
+    if (config.arrow_closed) {
+        scan_config.report_closed = true;
+    }
+
+    // the probe module runs on the connections of the scan, its answers come back as banners.
+    if (!config.probe_module.empty()) {
+        scan_config.grab_banners = true;
+        scan_config.request = probe_module_request(config);
+    }
+
+    const auto& targets = config.target_stats;
+    uint64_t duplicates = targets.listed - targets.unique - targets.excluded;
+    if (duplicates > 0) {
+        std::cerr << "targets " << targets.listed << " listed, " << targets.unique << " unique in " << targets.ranges << " ranges, "
+                  << duplicates << " duplicates dropped, " << duplicates * config.ports.size() << " probes saved\n";
+    }
 
-        auto& record = records[len];
+    scan_engine::LiveSettings settings;
+    live_settings_of(config, false, settings);
+    live_config::RcuCell<scan_engine::LiveSettings> live{ settings };
 
-        record.opened = false;
-        record.port = port;
+    // the watchdog scales whatever a reload publishes, so it goes first and stops last.
+    std::unique_ptr<congestion_watchdog::CongestionWatchdog> watchdog;
+    if (config.congestion_watchdog) {
+        scan_config.live = &live;
+        watchdog.reset(new congestion_watchdog::CongestionWatchdog{ live, settings });
+    }
 
-        record.sock = Socket{ AF_INET, SOCK_STREAM, 0 };
-        record.sock.set_nonblock();
+    std::unique_ptr<live_config::FileWatcher> watcher;
+    if (config.hot_reload) {
+        scan_config.live = &live;
+        auto* scaled = watchdog.get();
+        watcher.reset(new live_config::FileWatcher{ config_path, [config_path, &config, &live, scaled] {
+            reload_live_settings(config_path, config, [&live, scaled](const scan_engine::LiveSettings& reloaded) {
+                if (scaled) {
+                    scaled->set_base(reloaded);
+                }
+                else {
+                    live.publish(reloaded);
+                }
+            });
+        } });
+    }
 
-        struct sockaddr_in address;
-        address.sin_family = AF_INET;
-        address.sin_port = htons(port);
-        inet_pton(AF_INET, ip.c_str(), &address.sin_addr);
+    // only the probed ports have a known state, the rest stay unknown to queries.
+    for (int port : config.ports) {
+        index.record_scanned(port);
+    }
+
+    // host index in the scan config is also the host id in the port index.
+    std::vector<shm_channel::ShmResult> shm_results(config.ips.size());
+    for (size_t i = 0; i < config.ips.size(); ++i) {
+        index.add_host(config.ips[i]);
+
+        std::memset(&shm_results[i], 0, sizeof(shm_results[i]));
+        inet_pton(AF_INET, config.ips[i].c_str(), &shm_results[i].ipv4);
+    }
+
+    std::unique_ptr<dedup_filter::BlockedBloomFilter> dedup;
+    size_t duplicate_results = 0;
+    if (config.dedup_filter) {
+        size_t probes = config.ips.size() * config.ports.size();
+        dedup.reset(new dedup_filter::BlockedBloomFilter{ probes, config.dedup_fp_rate, (size_t)config.dedup_memory_kb * 1024 });
+
+        if (dedup->budget_limited()) {
+            std::cerr << "dedup filter capped at " << dedup->bytes() << " bytes, false positive rate "
+                      << dedup->expected_fp_rate(probes) << " if every probe answers\n";
+        }
+    }
 
-        int ret = connect(record.sock.handle(), (struct sockaddr*)&address, sizeof(address));
-        if (ret < 0) {
-            if (errno == EINPROGRESS) {
-                struct epoll_event ev;
-                ev.events = EPOLLOUT | EPOLLERR | EPOLLHUP;
-                ev.data.ptr = (void*)(records.data() + len);
+    // closed within the ttl is skipped, opened is probed again to confirm it.
+    std::unique_ptr<result_cache::ResultCache> cache;
+    std::vector<uint32_t> addresses;
+    std::unordered_set<uint64_t> opened_keys;
+    std::unordered_set<uint64_t> refused_keys;
+    size_t cached_closed = 0;
+    size_t cached_opened = 0;
+    int64_t now_secs = unix_time_micros() / 1000000;
 
-                epoll.add_fd(&ev, record.sock.handle());
+    if (!config.cache_file.empty()) {
+        cache.reset(new result_cache::ResultCache{ config.cache_file, (uint64_t)config.ips.size() * config.ports.size() });
+        for (const auto& shm_result : shm_results) {
+            addresses.emplace_back(ntohl(shm_result.ipv4));
+        }
+
+        // only a rst proves a port closed, a timeout may be a lost syn or a busy host.
+        scan_config.report_closed = true;
+
+        scan_config.skip = [&](size_t host, int port) {
+            result_cache::CacheEntry entry;
+            if (!cache->lookup(addresses[host], (uint16_t)port, entry) || now_secs - entry.seen_secs > config.cache_ttl_sec) {
+                return false;
             }
-            else {
-                record.sock.close();
+            return entry.state == result_cache::PortState::closed;
+        };
+    }
+
+    std::vector<probe_module::ProbeTarget> probe_targets;
+
+    std::unique_ptr<sock_diag::LocalEngine> local;
+    if (config.local_mode) {
+        local.reset(new sock_diag::LocalEngine{ engine, config.netns });
+    }
+
+    auto scan_start = std::chrono::steady_clock::now();
+    (local ? *local : engine).scan(scan_config, [&](const scan_engine::ScanResult& result) {
+        const std::string& ip = config.ips[result.host_index];
+
+        if (!result.opened) {
+            bool refused = (result.state == scan_engine::ConnectState::refused);
+            if (refused) {
+                refused_keys.insert((uint64_t)result.host_index << 16 | (uint64_t)result.port);
+            }
+            if (arrow && config.arrow_closed) {
+                arrow->append(ip, result.port, (refused ? arrow_ipc::state_closed : arrow_ipc::state_timed_out), result.best_rtt_micros(),
+                              nullptr, 0, unix_time_micros());
             }
+            return;
         }
-        else if (ret == 0) {   // hardly to happen.
-            record.opened = true;
-            record.sock.close();
+
+        if (dedup && dedup->test_and_set((uint64_t)result.host_index << 16 | (uint64_t)result.port)) {
+            ++duplicate_results;
+            return;
         }
 
-        ++len;
-    }
+        if (cache) {
+            opened_keys.insert((uint64_t)result.host_index << 16 | (uint64_t)result.port);
+        }
 
-    void collect_opened_ports(std::vector<int>& opened_ports, int timeout_millisec) {
-        std::array<struct epoll_event, N> events;
+        if (!config.probe_module.empty()) {
+            std::string response = (result.banner ? std::string(result.banner, result.banner_length) : std::string{});
+            probe_targets.emplace_back(probe_module::ProbeTarget{ result.host_index, result.port, response, result.best_rtt_micros() });
+        }
+
+        index.record_opened((uint32_t)result.host_index, result.port);
+        std::cout << ip << " " << result.port;
+        if (config.grab_banners && result.banner_length > 0) {
+            std::cout << " " << printable(result.banner, result.banner_length);
+        }
+        std::cout << "\n";
 
-        int nfds = epoll_wait(epoll.handle(), events.data(), events.size(), timeout_millisec);
-        if (nfds > 0) {
-            for (int i = 0; i < nfds; ++i) {
-                ConnectRecord* record = (ConnectRecord*)events[i].data.ptr;
+        // the kernel's smoothed rtt where the engine read it, else the one timed here.
+        int rtt_micros = result.best_rtt_micros();
 
-                if (events[i].events & EPOLLOUT) {
-                    if (is_connected(record->sock.handle())) {
-                        record->opened = true;
-                    }
-                }
+        if (arrow) {
+            arrow->append(ip, result.port, arrow_ipc::state_opened, rtt_micros, result.banner, result.banner_length, unix_time_micros());
+        }
+
+        if (output) {
+            output->write(ip + " " + std::to_string(result.port) + " " + std::to_string(rtt_micros) + "\n");
+        }
 
-                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
-                    record->opened = false;
+        if (shm) {
+            auto& shm_result = shm_results[result.host_index];
+            shm_result.port = (uint16_t)result.port;
+            shm_result.state = 1;
+            shm_result.rtt_micros = (uint32_t)rtt_micros;
+            shm_result.timestamp_micros = unix_time_micros();
+            shm->publish(shm_result);
+        }
+
+#ifdef PORT_SCANNER_WITH_SQLITE
+        if (sqlite) {
+            sqlite->append(ip, result.port, true, rtt_micros, unix_time_micros());
+        }
+#endif
+    });
+
+    // the settings are the running scan's, a later edit belongs to the next run.
+    watcher.reset();
+    if (watchdog) {
+        watchdog->stop();
+    }
+
+    if (cache) {
+        // what was probed this run, the skipped pairs keep their entry and its time. engines may
+        // ask the skip predicate more than once per pair, so the cache hits are counted here.
+        for (size_t host = 0; host < config.ips.size(); ++host) {
+            for (int port : config.ports) {
+                result_cache::CacheEntry entry;
+                bool fresh = cache->lookup(addresses[host], (uint16_t)port, entry) && now_secs - entry.seen_secs <= config.cache_ttl_sec;
+                if (fresh && entry.state == result_cache::PortState::closed) {
+                    ++cached_closed;
+                    continue;
+                }
+                if (fresh && entry.state == result_cache::PortState::opened) {
+                    ++cached_opened;
                 }
-            }
 
-            for (int i = 0; i < len; ++i) {
-                if (records[i].opened) {
-                    opened_ports.emplace_back(records[i].port);
+                // a pair which timed out, or whose result the dedup filter dropped, keeps its old entry.
+                uint64_t key = (uint64_t)host << 16 | (uint64_t)port;
+                if (opened_keys.count(key) > 0) {
+                    cache->store(addresses[host], (uint16_t)port, result_cache::PortState::opened, now_secs);
+                }
+                else if (refused_keys.count(key) > 0) {
+                    cache->store(addresses[host], (uint16_t)port, result_cache::PortState::closed, now_secs);
                 }
             }
         }
+
+        std::cerr << "cache " << cached_closed << " closed ports skipped as cached, " << cached_opened << " cached open ports reconfirmed, "
+                  << cache->size() << " entries\n";
     }
-};
 
-template<int N>
-std::vector<int> port_scan(const std::string& ip, const std::vector<int>& ports, int timeout_millisec) {
-    std::vector<int> opened_ports;
+    if (dedup) {
+        std::cerr << "dedup filter " << dedup->bytes() << " bytes, " << dedup->hash_count() << " hashes, "
+                  << dedup->inserted() << " results, " << duplicate_results << " duplicates dropped\n";
+    }
 
-    int i = 0;
-    int counter = 0;
-    while (i < ports.size()) {
-        BatchConnector<N> connector;
+    if (local) {
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - scan_start).count();
+        std::cerr << local->local_host_count() << " local hosts answered from the kernel's listeners, "
+                  << config.ips.size() - local->local_host_count() << " scanned by " << engine.name() << ", " << millis << " ms";
+        if (scan_config.grab_banners) {
+            std::cerr << ", the listening local ports connected for their banners";
+        }
+        std::cerr << "\n";
+    }
 
-        while (counter < N && i + counter < ports.size()) {
-            connector.submit(ip, ports[i + counter]);
-            ++counter;
+    if (auto epoll = dynamic_cast<scan_engine::EpollEngine*>(&engine)) {
+        for (const auto& host : epoll->throttled_hosts()) {
+            std::cerr << config.ips[host.host_index] << " looks syn flood protected after " << host.refused_before << " rsts, throttled to "
+                      << host.window << " in-flight connects, " << host.requeued << " timed out ports probed again\n";
         }
 
-        connector.collect_opened_ports(opened_ports, timeout_millisec);
+        const scan_engine::SynLossStats& loss = epoll->syn_loss_stats();
+        if (loss.late_answers > 0) {
+            std::cerr << loss.late_answers << " answers needed a syn sent again, " << loss.hosts_backed_off << " hosts backed off "
+                      << loss.backoffs << " times\n";
+        }
+    }
 
-        i += counter;
-        counter = 0;
+    if (watchdog) {
+        congestion_watchdog::WatchdogReport report = watchdog->report();
+        if (report.throttles == 0) {
+            std::cerr << "congestion watchdog saw no local drops\n";
+        }
+        else {
+            std::cerr << "congestion watchdog throttled " << report.throttles << " times, down to " << report.lowest_share * 100
+                      << "% of window and rate, on";
+            for (int i = 0; i < congestion_watchdog::DropCounters::count; ++i) {
+                if (report.drops[i] > 0) {
+                    std::cerr << " " << congestion_watchdog::DropCounters::name(i) << " " << report.drops[i] << ",";
+                }
+            }
+            if (report.pressure_samples > 0) {
+                std::cerr << " tcp_mem pressure in " << report.pressure_samples << " samples,";
+            }
+            std::cerr << " counted over the whole machine\n";
+        }
     }
 
-    return opened_ports;
-}
+#ifdef PORT_SCANNER_WITH_IO_URING
+    if (auto uring = dynamic_cast<scan_engine::IoUringEngine*>(&engine)) {
+        const scan_engine::IoUringStats& stats = uring->stats();
+        std::cerr << "sockets " << (stats.direct_descriptors ? "registered" : "in the fd table")
+                  << ", buffers " << stats.buffers << " x " << stats.buffer_size << " bytes, peak per batch " << stats.peak_buffers_per_batch
+                  << ", reads with data " << stats.reads_with_data << ", without data " << stats.reads_without_data
+                  << ", pool exhausted " << stats.buffer_exhausted << ", bytes " << stats.bytes << "\n";
+    }
+#endif
 
-template<int N>
-std::vector<int> port_scan_range(const std::string& ip, int port_start, int port_end, int timeout_millisec) {
-    std::vector<int> ports;
+    if (!config.probe_module.empty()) {
+        std::cout << "\nprobe " << config.probe_module << ":\n";
+        run_probe_module(config, probe_targets);
+    }
 
-    for (int port = port_start; port <= port_end; ++port) {
-        ports.emplace_back(port);
+    if (!config.index_file.empty()) {
+        index.save(config.index_file);
     }
 
-    return port_scan<N>(ip, ports, timeout_millisec);
-}
+    if (arrow) {
+        arrow->close();
+    }
+
+    if (output) {
+        output->close();
+    }
+
+    if (shm) {
+        shm->close();
+    }
+
+#ifdef PORT_SCANNER_WITH_SQLITE
+    if (sqlite) {
+        sqlite->close();
+    }
+#endif
 
-template<int N>
-std::vector<int> port_scan_commonly_used(const std::string& ip, int timeout_millisec) {
-    std::vector<int> ports;
-    
-    ports.emplace_back(21);    // ftp.
-    ports.emplace_back(22);    // ssh.
-    ports.emplace_back(23);    // telnet.
-    ports.emplace_back(25);    // smtp.
-    ports.emplace_back(53);    // dns.
-    ports.emplace_back(80);    // http.
-    ports.emplace_back(110);   // pop3.
-    ports.emplace_back(443);   // https.
-    ports.emplace_back(1433);  // sql server.
-    ports.emplace_back(3306);  // mysql.
-    ports.emplace_back(5432);  // pgsql.
-    ports.emplace_back(6379);  // redis.
-    ports.emplace_back(8000);
-    ports.emplace_back(8080);
-
-    return port_scan<N>(ip, ports, timeout_millisec);
+    return 0;
 }
 
+// g++ port_scanner_linux.cpp -std=c++11 -O2 -s -pthread -ldl -o port_scanner_linux
+// g++ port_scanner_linux.cpp -std=c++11 -O2 -s -pthread -ldl -DPORT_SCANNER_WITH_ZSTD -lzstd -o port_scanner_linux
+// g++ port_scanner_linux.cpp -std=c++11 -O2 -s -pthread -ldl -DPORT_SCANNER_WITH_SQLITE -lsqlite3 -o port_scanner_linux
+// g++ port_scanner_linux.cpp -std=c++11 -O2 -s -pthread -ldl -DPORT_SCANNER_WITH_IO_URING -o port_scanner_linux
 int main(int argc, char* argv[]) {
-    auto opened_ports = port_scan_range<256>("192.168.52.167", 0, 65535, 5000);
+    if (argc == 4 && std::string{ argv[1] } == "query") {
+        try {
+            return run_query(argv[2], argv[3]);
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+    }
 
-    for (int port : opened_ports) {
-        std::cout << port << " ";
+    if (argc == 3 && std::string{ argv[1] } == "consume") {
+        try {
+            return run_consume(argv[2]);
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
     }
 
-    std::cout << "\n";
-    return 0;
+    if (argc != 2) {
+        std::cerr << "usage: " << argv[0] << " <config_file>\n";
+        std::cerr << "       " << argv[0] << " query <index_file> <expression>, e.g. \"22 open and 80 closed\"\n";
+        std::cerr << "       " << argv[0] << " consume <shm_channel_path>\n";
+        return 1;
+    }
+
+    try {
+        config_parser::ConfigParser parser;
+        auto sections = parser.parse_sections(argv[1]);
+
+        // every profile is validated before the first one runs.
+        std::vector<Config> configs;
+        auto err = config_extract_profiles(sections, configs);
+
+        if (!err.empty()) {
+            std::cerr << err << "\n";
+            return 1;
+        }
+
+        // profiles run back to back, sharing one engine per engine name.
+        std::map<std::string, std::unique_ptr<scan_engine::ScanEngine>> engines;
+        for (const auto& config : configs) {
+            auto& engine = engines[config.engine];
+            if (!engine) {
+                engine = scan_engine::make_engine(config.engine);
+            }
+        }
+
+        int ret = 0;
+        for (const auto& config : configs) {
+            if (!config.profile.empty()) {
+                std::cout << "[" << config.profile << "]\n";
+            }
+
+            int profile_ret = (config.monitor ? run_monitor(config) : run_scan(config, argv[1], *engines[config.engine]));
+            ret = (ret != 0 ? ret : profile_ret);
+        }
+
+        return ret;
+    }
+    catch (const config_parser::FileNotFoundException& e) {
+        std::cerr << "given config file does not exist\n";
+        return 1;
+    }
+    catch (const std::system_error& se) {
+        std::cerr << "system error, " << se.code() << ", " << se.what() << "\n";
+        return 1;
+    }
+    catch (const probe_module::ProbeModuleException& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    catch (const scan_engine::EngineUnavailableException& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    catch (const scan_engine::RawSocketPermissionException& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    catch (const result_cache::CacheFileException& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    catch (const target_file::TargetFileException& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    catch (const port_index::IndexFileException& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    catch (const arrow_ipc::ArrowWriteException& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    catch (const output_sink::SinkException& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+#ifdef PORT_SCANNER_WITH_SQLITE
+    catch (const sqlite_sink::SqliteException& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+#endif
+    // anything else a library throws, like std::invalid_argument of the shm channel or std::bad_alloc.
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
 }
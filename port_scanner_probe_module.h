@@ -0,0 +1,53 @@
+/*
+    @brief  C ABI of out-of-tree probe modules, loaded as shared objects.
+            a module exports `ps_probe_module_entry`, for example:
+
+                static size_t payload(const char* ip, int port, char* buf, size_t cap) {
+                    return snprintf(buf, cap, "HELLO\r\n");
+                }
+
+                static int classify(const char* data, size_t len, char* label, size_t label_cap) {
+                    if (len >= 3 && memcmp(data, "OK ", 3) == 0) {
+                        snprintf(label, label_cap, "rpc");
+                        return 1;
+                    }
+                    return 0;
+                }
+
+                static const ps_probe_module module = { PS_PROBE_MODULE_ABI_VERSION, "rpc", payload, classify };
+
+                const ps_probe_module* ps_probe_module_entry(void) {
+                    return &module;
+                }
+
+            build: gcc rpc_module.c -O2 -shared -fPIC -o rpc_module.so
+*/
+#ifndef PORT_SCANNER_PROBE_MODULE_H
+#define PORT_SCANNER_PROBE_MODULE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PS_PROBE_MODULE_ABI_VERSION 1
+
+typedef struct ps_probe_module {
+    int abi_version;
+    const char* name;
+
+    /* writes the bytes to send after connect into buf, returns their count, 0 to only listen. */
+    size_t (*payload)(const char* ip, int port, char* buf, size_t cap);
+
+    /* returns 1 and fills label when the response matches, 0 otherwise. */
+    int (*classify)(const char* data, size_t len, char* label, size_t label_cap);
+} ps_probe_module;
+
+typedef const ps_probe_module* (*ps_probe_module_entry_fn)(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
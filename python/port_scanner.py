@@ -0,0 +1,167 @@
+"""
+    @brief  python bindings of libport_scanner.so (see port_scanner_capi.h).
+            results are a view over the buffer of one run: a numpy structured array when
+            numpy is installed, otherwise a memoryview of the records. either way a
+            million results are one buffer, not a million python objects. the buffer is
+            freed with the last view of it, later runs and close() leave it alone.
+"""
+import ctypes
+import ctypes.util
+import os
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+ABI_VERSION = 2
+
+
+class PsResult(ctypes.Structure):
+    _fields_ = [
+        ("host_index", ctypes.c_uint32),
+        ("port", ctypes.c_uint16),
+        ("state", ctypes.c_uint8),
+        ("reserved", ctypes.c_uint8),
+        ("rtt_micros", ctypes.c_uint32),
+    ]
+
+
+if numpy is not None:
+    RESULT_DTYPE = numpy.dtype({
+        "names": ["host", "port", "state", "rtt_micros"],
+        "formats": [numpy.uint32, numpy.uint16, numpy.uint8, numpy.uint32],
+        "offsets": [0, 4, 6, 8],
+        "itemsize": ctypes.sizeof(PsResult),
+    })
+
+
+class ScannerError(RuntimeError):
+    pass
+
+
+def _load_library(path=None):
+    candidates = [path, os.environ.get("PORT_SCANNER_LIB"),
+                  os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "libport_scanner.so"),
+                  ctypes.util.find_library("port_scanner")]
+
+    for candidate in candidates:
+        if candidate and (os.path.exists(candidate) or not os.path.dirname(candidate)):
+            lib = ctypes.CDLL(candidate)
+            break
+    else:
+        raise ScannerError("libport_scanner.so not found, set PORT_SCANNER_LIB")
+
+    lib.ps_abi_version.restype = ctypes.c_int
+    if lib.ps_abi_version() != ABI_VERSION:
+        raise ScannerError("libport_scanner.so abi version mismatch")
+
+    lib.ps_scanner_create.restype = ctypes.c_void_p
+    lib.ps_scanner_create.argtypes = [ctypes.c_char_p]
+    lib.ps_scanner_destroy.argtypes = [ctypes.c_void_p]
+    lib.ps_scanner_add_host.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+    lib.ps_scanner_add_port_range.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
+    lib.ps_scanner_set_timeout.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    lib.ps_scanner_set_window.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    lib.ps_scanner_run.argtypes = [ctypes.c_void_p]
+    lib.ps_scanner_results.restype = ctypes.POINTER(PsResult)
+    lib.ps_scanner_results.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_size_t)]
+    lib.ps_scanner_host_count.restype = ctypes.c_size_t
+    lib.ps_scanner_host_count.argtypes = [ctypes.c_void_p]
+    lib.ps_scanner_host.restype = ctypes.c_char_p
+    lib.ps_scanner_host.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    lib.ps_scanner_last_error.restype = ctypes.c_char_p
+    lib.ps_scanner_last_error.argtypes = [ctypes.c_void_p]
+    lib.ps_scanner_take_results.restype = ctypes.c_void_p
+    lib.ps_scanner_take_results.argtypes = [ctypes.c_void_p]
+    lib.ps_results_data.restype = ctypes.POINTER(PsResult)
+    lib.ps_results_data.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_size_t)]
+    lib.ps_results_free.argtypes = [ctypes.c_void_p]
+    lib.ps_last_error.restype = ctypes.c_char_p
+    return lib
+
+
+class _ResultBuffer(object):
+    """ owns the results of one run, every view of them keeps it alive. """
+
+    def __init__(self, lib, handle):
+        self._lib = lib
+        self._handle = handle
+
+    def view(self):
+        count = ctypes.c_size_t(0)
+        pointer = self._lib.ps_results_data(self._handle, ctypes.byref(count))
+
+        records = (PsResult * count.value).from_address(ctypes.addressof(pointer.contents)) if count.value else (PsResult * 0)()
+        records._owner = self
+        if numpy is None:
+            return memoryview(records)
+
+        view = numpy.frombuffer(records, dtype=RESULT_DTYPE)
+        view.flags.writeable = False
+        return view
+
+    def __del__(self):
+        if self._handle:
+            self._lib.ps_results_free(self._handle)
+            self._handle = None
+
+
+class Scanner(object):
+    """
+        scanner = Scanner("epoll")
+        scanner.add_host("192.168.1.1")
+        scanner.add_port_range(1, 1024)
+        results = scanner.run()     # view of this run, valid as long as it is referenced.
+        open_22 = results[results["port"] == 22]
+    """
+
+    def __init__(self, engine=None, library=None):
+        self._lib = _load_library(library)
+        self._results = None
+        self._handle = self._lib.ps_scanner_create(engine.encode() if engine else None)
+        if not self._handle:
+            raise ScannerError("create scanner failed, %s" % self._lib.ps_last_error().decode())
+
+    def _check(self, ret):
+        if ret != 0:
+            raise ScannerError(self._lib.ps_scanner_last_error(self._handle).decode())
+
+    def add_host(self, ip):
+        self._check(self._lib.ps_scanner_add_host(self._handle, ip.encode()))
+
+    def add_port_range(self, port_start, port_end):
+        self._check(self._lib.ps_scanner_add_port_range(self._handle, port_start, port_end))
+
+    def set_timeout(self, timeout_millisec):
+        self._check(self._lib.ps_scanner_set_timeout(self._handle, timeout_millisec))
+
+    def set_window(self, window):
+        self._check(self._lib.ps_scanner_set_window(self._handle, window))
+
+    def run(self):
+        self._check(self._lib.ps_scanner_run(self._handle))
+        self._results = _ResultBuffer(self._lib, self._lib.ps_scanner_take_results(self._handle)).view()
+        return self._results
+
+    def results(self):
+        """ the view of the last run, None before the first. """
+        return self._results
+
+    def hosts(self):
+        return [self._lib.ps_scanner_host(self._handle, i).decode()
+                for i in range(self._lib.ps_scanner_host_count(self._handle))]
+
+    def close(self):
+        if self._handle:
+            self._lib.ps_scanner_destroy(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        self.close()